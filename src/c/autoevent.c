@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "autoevent.h"
+#include "deadline.h"
+
+/* Milliseconds the reads of an auto-event have to start in, binding to the
+ * device and resolving object names, so that a device that does not answer
+ * does not hold up the auto-events of the others. A device whose I-Am comes
+ * later is read at the next interval.
+ */
+#define AUTOEVENT_START_TIMEOUT 1000
+
+/* One read of an auto-event's resources */
+typedef struct autoevent_batch_t autoevent_batch_t;
+
+typedef struct autoevent_reading_t
+{
+  autoevent_batch_t *batch;
+  uint32_t index;
+} autoevent_reading_t;
+
+struct autoevent_batch_t
+{
+  autoevent_ll *list;
+  autoevent_t *event;
+  devsdk_commandresult *results;
+  autoevent_reading_t *readings;
+  /* Reads not yet complete */
+  uint32_t remaining;
+  bool failed;
+};
+
+static void autoevent_free_event (autoevent_t *event)
+{
+  for (uint32_t i = 0; i < event->nreadings; i++)
+  {
+    free (event->attrs[i].name);
+    if (event->last[i])
+    {
+      iot_data_free (event->last[i]);
+    }
+  }
+  free (event->attrs);
+  free (event->last);
+  free (event->cov);
+  free (event->events);
+  free (event->trends);
+  free (event->device);
+  free (event->resource);
+  free (event);
+}
+
+/* Check whether any reading differs from the last posted, remembering the new values */
+static bool autoevent_changed (autoevent_t *event, devsdk_commandresult *results)
+{
+  bool changed = false;
+  for (uint32_t i = 0; i < event->nreadings; i++)
+  {
+    if (event->last[i] == NULL || !iot_data_equal (event->last[i], results[i].value))
+    {
+      changed = true;
+      if (event->last[i])
+      {
+        iot_data_free (event->last[i]);
+      }
+      event->last[i] = iot_data_add_ref (results[i].value);
+    }
+  }
+  return changed;
+}
+
+/* Check whether all the resources of an auto-event are pushed by active COV
+ * subscriptions or event notifications, or harvested from trend logs
+ */
+static bool autoevent_pushed (autoevent_ll *list, autoevent_t *event)
+{
+  if (event->trends)
+  {
+    return true;
+  }
+  if (event->cov == NULL && event->events == NULL)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < event->nreadings; i++)
+  {
+    if (event->cov && !cov_manager_is_active (list->cov, event->cov[i]))
+    {
+      return false;
+    }
+    if (event->events && !event_manager_is_active (list->events, event->events[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Post the readings of a batch once all its reads are complete */
+static void autoevent_batch_done (autoevent_batch_t *batch)
+{
+  autoevent_ll *list = batch->list;
+  autoevent_t *event = batch->event;
+
+  if (batch->failed)
+  {
+    iot_log_debug (list->lc, "Auto-event read of %s on %s failed", event->resource, event->device);
+  }
+  else if (!event->on_change || autoevent_changed (event, batch->results))
+  {
+    devsdk_post_readings (list->service, event->device, event->resource, batch->results);
+  }
+  devsdk_commandresult_free (batch->results, (int) event->nreadings);
+  free (batch->readings);
+  free (batch);
+
+  pthread_mutex_lock (&list->mutex);
+  event->busy = false;
+  bool stopped = event->stopped;
+  pthread_mutex_unlock (&list->mutex);
+  if (stopped)
+  {
+    autoevent_free_event (event);
+  }
+}
+
+/* Record the result of one read, which frees the value */
+static void autoevent_reading_done (autoevent_reading_t *reading, BACNET_APPLICATION_DATA_VALUE *value)
+{
+  autoevent_batch_t *batch = reading->batch;
+  devsdk_commandresult *result = &batch->results[reading->index];
+
+  if (value)
+  {
+    devsdk_commandresult_populate (result, value, 1);
+    result->origin = iot_time_nsecs ();
+  }
+  if (result->value == NULL)
+  {
+    __atomic_store_n (&batch->failed, true, __ATOMIC_RELAXED);
+  }
+  if (__atomic_sub_fetch (&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    autoevent_batch_done (batch);
+  }
+}
+
+/* Completion of an asynchronous read, run on the thread handling the response */
+static void autoevent_read_complete (return_data_t *data, void *context)
+{
+  BACNET_APPLICATION_DATA_VALUE *value = data->errorDetected ? NULL : data->value;
+  if (value == NULL && data->value)
+  {
+    free (data->value);
+  }
+  return_data_remove_by_ptr (returnDataHead, data);
+  autoevent_reading_done ((autoevent_reading_t *) context, value);
+}
+
+/* Start the reads of an auto-event */
+static void autoevent_start (autoevent_ll *list, autoevent_t *event)
+{
+  struct timespec deadline;
+  deadline_set (&deadline, AUTOEVENT_START_TIMEOUT);
+  autoevent_batch_t *batch = calloc (1, sizeof (autoevent_batch_t));
+  batch->list = list;
+  batch->event = event;
+  batch->results = calloc (event->nreadings, sizeof (devsdk_commandresult));
+  batch->readings = calloc (event->nreadings, sizeof (autoevent_reading_t));
+  /* Hold one count until all reads are started, so the batch cannot complete early */
+  batch->remaining = event->nreadings + 1;
+
+  for (uint32_t i = 0; i < event->nreadings; i++)
+  {
+    bacnet_attributes_t *attrs = &event->attrs[i];
+    uint32_t instance = attrs->instance;
+    autoevent_reading_t *reading = &batch->readings[i];
+    reading->batch = batch;
+    reading->index = i;
+    if ((attrs->name &&
+         !bacnet_resolve_object_name_within (&event->address, attrs->type, attrs->name, &instance, &deadline)) ||
+        !bacnetReadPropertyAsync (&event->address, attrs->type, instance, attrs->property,
+                                  attrs->index, REQUEST_PRIORITY_BACKGROUND,
+                                  autoevent_read_complete, reading, &deadline))
+    {
+      autoevent_reading_done (reading, NULL);
+    }
+  }
+  if (__atomic_sub_fetch (&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    autoevent_batch_done (batch);
+  }
+}
+
+static void *autoevent_run (void *arg)
+{
+  autoevent_ll *list = (autoevent_ll *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  while (list->running)
+  {
+    /* Collect the auto-events that are due and not still being read */
+    autoevent_t *due = NULL;
+    deadline_now (&now);
+    for (autoevent_t *event = list->first; event; event = event->next)
+    {
+      if (deadline_expired (&event->due, &now))
+      {
+        deadline_next (&event->due, event->interval, &now);
+        /* Reads of a device that is down would only time out, and
+         * resources pushed by notifications need no polling
+         */
+        if (!event->busy && liveness_is_up (list->liveness, event->address.deviceInstance) &&
+            !autoevent_pushed (list, event))
+        {
+          event->busy = true;
+          event->due_next = due;
+          due = event;
+        }
+      }
+    }
+
+    if (due)
+    {
+      pthread_mutex_unlock (&list->mutex);
+      while (due)
+      {
+        autoevent_t *next = due->due_next;
+        autoevent_start (list, due);
+        due = next;
+      }
+      pthread_mutex_lock (&list->mutex);
+      continue;
+    }
+
+    /* Sleep until the next auto-event is due */
+    const struct timespec *earliest = NULL;
+    for (autoevent_t *event = list->first; event; event = event->next)
+    {
+      if (earliest == NULL || deadline_expired (&event->due, earliest))
+      {
+        earliest = &event->due;
+      }
+    }
+    deadline_wait (&list->wakeup, &list->mutex, earliest);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return NULL;
+}
+
+/* Create an empty list of auto-events and start its thread */
+autoevent_ll *autoevent_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness,
+                               cov_manager_ll *cov, event_manager_ll *events, trend_log_ll *trends)
+{
+  autoevent_ll *list = calloc (1, sizeof (autoevent_ll));
+  list->service = service;
+  list->lc = lc;
+  list->liveness = liveness;
+  list->cov = cov;
+  list->events = events;
+  list->trends = trends;
+  list->running = true;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->wakeup);
+  pthread_create (&list->thread, NULL, autoevent_run, list);
+  return list;
+}
+
+/* Stop the thread, so that no more reads are started */
+void autoevent_stop (autoevent_ll *list)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool running = list->running;
+  list->running = false;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  if (running)
+  {
+    pthread_join (list->thread, NULL);
+  }
+}
+
+/* Free the auto-events. Reads still in progress must have completed. */
+void autoevent_free (autoevent_ll *list)
+{
+  autoevent_stop (list);
+
+  autoevent_t *current = list->first;
+  while (current)
+  {
+    autoevent_t *next = current->next;
+    autoevent_free_event (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->wakeup);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Add an auto-event, with its first reads due immediately */
+autoevent_t *autoevent_add (autoevent_ll *list, const devsdk_device_t *device,
+                            const char *resource, uint32_t nreadings,
+                            const devsdk_commandrequest *requests,
+                            uint64_t interval, bool on_change)
+{
+  autoevent_t *event = calloc (1, sizeof (autoevent_t));
+  event->device = strdup (device->name);
+  event->resource = strdup (resource);
+  event->address = *(bacnet_address_t *) device->address;
+  event->nreadings = nreadings;
+  event->attrs = calloc (nreadings, sizeof (bacnet_attributes_t));
+  event->last = calloc (nreadings, sizeof (iot_data_t *));
+  for (uint32_t i = 0; i < nreadings; i++)
+  {
+    event->attrs[i] = *(bacnet_attributes_t *) requests[i].resource->attrs;
+    if (event->attrs[i].name)
+    {
+      event->attrs[i].name = strdup (event->attrs[i].name);
+    }
+  }
+  event->interval = interval ? interval : 1;
+  event->on_change = on_change;
+  deadline_now (&event->due);
+
+  /* Subscribe to COV notifications when every resource asks for them */
+  bool cov = list->cov && nreadings;
+  for (uint32_t i = 0; i < nreadings; i++)
+  {
+    cov = cov && event->attrs[i].cov != BACNET_COV_NONE;
+  }
+  if (cov)
+  {
+    event->cov = calloc (nreadings, sizeof (cov_subscription_t *));
+    for (uint32_t i = 0; i < nreadings; i++)
+    {
+      event->cov[i] = cov_manager_add (list->cov, device, requests[i].resource->name, &event->attrs[i]);
+    }
+  }
+
+  /* Take event states from event notifications when the device has a
+   * notification class to register with
+   */
+  bool events = !cov && list->events && nreadings &&
+    event->address.notificationClass != UINT32_MAX;
+  for (uint32_t i = 0; i < nreadings; i++)
+  {
+    events = events && event->attrs[i].property == PROP_EVENT_STATE;
+  }
+  if (events)
+  {
+    event->events = calloc (nreadings, sizeof (event_watch_t *));
+    for (uint32_t i = 0; i < nreadings; i++)
+    {
+      event->events[i] = event_manager_add (list->events, device, requests[i].resource->name, &event->attrs[i]);
+    }
+  }
+
+  /* Harvest the new records of log buffers instead of reading them whole */
+  bool trends = !cov && !events && list->trends && nreadings;
+  for (uint32_t i = 0; i < nreadings; i++)
+  {
+    trends = trends && event->attrs[i].property == PROP_LOG_BUFFER;
+  }
+  if (trends)
+  {
+    event->trends = calloc (nreadings, sizeof (trend_log_t *));
+    for (uint32_t i = 0; i < nreadings; i++)
+    {
+      event->trends[i] = trend_log_add (list->trends, device, requests[i].resource->name, &event->attrs[i],
+                                        event->interval);
+    }
+  }
+
+  pthread_mutex_lock (&list->mutex);
+  event->next = list->first;
+  list->first = event;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  return event;
+}
+
+/* Remove an auto-event, freeing it now or when its reads in progress complete */
+void autoevent_remove (autoevent_ll *list, autoevent_t *event)
+{
+  pthread_mutex_lock (&list->mutex);
+  autoevent_t **link = &list->first;
+  while (*link && *link != event)
+  {
+    link = &(*link)->next;
+  }
+  if (*link)
+  {
+    *link = event->next;
+  }
+  /* Take the subscriptions, watches and logs while the auto-event cannot be
+   * freed, as once it is stopped its reads in progress may free it
+   */
+  uint32_t nreadings = event->nreadings;
+  cov_subscription_t **cov = event->cov;
+  event_watch_t **events = event->events;
+  trend_log_t **trends = event->trends;
+  event->cov = NULL;
+  event->events = NULL;
+  event->trends = NULL;
+  event->stopped = true;
+  bool busy = event->busy;
+  pthread_mutex_unlock (&list->mutex);
+  if (!busy)
+  {
+    autoevent_free_event (event);
+  }
+
+  for (uint32_t i = 0; cov && i < nreadings; i++)
+  {
+    cov_manager_remove (list->cov, cov[i]);
+  }
+  for (uint32_t i = 0; events && i < nreadings; i++)
+  {
+    event_manager_remove (list->events, events[i]);
+  }
+  for (uint32_t i = 0; trends && i < nreadings; i++)
+  {
+    trend_log_remove (list->trends, trends[i]);
+  }
+  free (cov);
+  free (events);
+  free (trends);
+}
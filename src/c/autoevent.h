@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <devsdk/devsdk.h>
+#include "driver.h"
+#include "liveness.h"
+#include "cov_manager.h"
+#include "event_manager.h"
+#include "trend_log.h"
+
+#ifndef DEVICE_BACNET_C_AUTOEVENT_H
+#define DEVICE_BACNET_C_AUTOEVENT_H
+
+/* A resource read periodically, with the readings posted when all reads complete */
+typedef struct autoevent_t
+{
+  char *device;
+  char *resource;
+  bacnet_address_t address;
+  uint32_t nreadings;
+  bacnet_attributes_t *attrs;
+  /* Interval between reads in milliseconds, and when the next reads are due */
+  uint64_t interval;
+  struct timespec due;
+  /* Only post readings when a value has changed */
+  bool on_change;
+  iot_data_t **last;
+  /* COV subscriptions of the resources when all are subscribed to, or NULL.
+   * The resources are only read while a subscription is not active.
+   */
+  cov_subscription_t **cov;
+  /* Event watches of the resources when all report the event state of an
+   * object of a device with a notification class, or NULL. The resources are
+   * only read while the device is not registered for event notifications.
+   */
+  event_watch_t **events;
+  /* Trend logs of the resources when all read log buffers, or NULL. The
+   * records are harvested by the trend log thread instead of read here.
+   */
+  trend_log_t **trends;
+  /* Set while reads are in progress, when the next reads are skipped */
+  bool busy;
+  /* Set when stopped while busy, so the completing reads free the auto-event */
+  bool stopped;
+  /* Next auto-event in the list, and in the set due to be read */
+  struct autoevent_t *next;
+  struct autoevent_t *due_next;
+} autoevent_t;
+
+/* Linked list of auto-events, with a thread starting their reads */
+typedef struct autoevent_ll
+{
+  autoevent_t *first;
+  devsdk_service_t *service;
+  iot_logger_t *lc;
+  /* Monitor whose down devices are not read, or NULL */
+  liveness_ll *liveness;
+  /* Subscriptions of resources subscribed to for COV, or NULL */
+  cov_manager_ll *cov;
+  /* Watches of event states pushed by event notifications, or NULL */
+  event_manager_ll *events;
+  /* Trend logs harvested for log buffer resources, or NULL */
+  trend_log_ll *trends;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+} autoevent_ll;
+
+autoevent_ll *autoevent_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness,
+                               cov_manager_ll *cov, event_manager_ll *events, trend_log_ll *trends);
+
+void autoevent_stop (autoevent_ll *list);
+
+void autoevent_free (autoevent_ll *list);
+
+autoevent_t *autoevent_add (autoevent_ll *list, const devsdk_device_t *device,
+                            const char *resource, uint32_t nreadings,
+                            const devsdk_commandrequest *requests,
+                            uint64_t interval, bool on_change);
+
+void autoevent_remove (autoevent_ll *list, autoevent_t *event);
+
+#endif //DEVICE_BACNET_C_AUTOEVENT_H
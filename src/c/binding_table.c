@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "binding_table.h"
+
+static uint32_t binding_table_hash (binding_table_t *table, uint32_t device_id)
+{
+  /* Fibonacci hashing spreads sequential device instances over the buckets */
+  return (device_id * 2654435761u) & table->mask;
+}
+
+static binding_entry_t *
+binding_table_get_locked (binding_table_t *table, uint32_t device_id)
+{
+  binding_entry_t *current = table->buckets[binding_table_hash (table, device_id)];
+
+  /* Walk the hash chain for the device ID */
+  while (current)
+  {
+    if (current->device_id == device_id)
+    {
+      break;
+    }
+    current = current->chain;
+  }
+  /* Return NULL if not found */
+  return current;
+}
+
+/* Remove an entry from the least recently used list */
+static void binding_table_unlink_locked (binding_table_t *table, binding_entry_t *entry)
+{
+  if (entry->prev)
+  {
+    entry->prev->next = entry->next;
+  }
+  else
+  {
+    table->first = entry->next;
+  }
+  if (entry->next)
+  {
+    entry->next->prev = entry->prev;
+  }
+  else
+  {
+    table->last = entry->prev;
+  }
+  entry->next = NULL;
+  entry->prev = NULL;
+}
+
+/* Make an entry the most recently used */
+static void binding_table_push_locked (binding_table_t *table, binding_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = table->first;
+  if (table->first)
+  {
+    table->first->prev = entry;
+  }
+  else
+  {
+    table->last = entry;
+  }
+  table->first = entry;
+}
+
+/* Remove an entry from the table and free it */
+static void binding_table_remove_locked (binding_table_t *table, binding_entry_t *entry)
+{
+  binding_entry_t **link = &table->buckets[binding_table_hash (table, entry->device_id)];
+  while (*link != entry)
+  {
+    link = &(*link)->chain;
+  }
+  *link = entry->chain;
+  binding_table_unlink_locked (table, entry);
+  table->size--;
+  free (entry);
+}
+
+/* Create a new table holding at most capacity bindings */
+binding_table_t *binding_table_alloc (uint32_t capacity)
+{
+  binding_table_t *table = malloc (sizeof (binding_table_t));
+  uint32_t nbuckets = 1;
+
+  if (capacity == 0)
+  {
+    capacity = 1;
+  }
+  /* Use a power of two number of buckets, at least as many as the capacity */
+  while (nbuckets < capacity && nbuckets < 0x80000000u)
+  {
+    nbuckets <<= 1;
+  }
+  table->buckets = calloc (nbuckets, sizeof (binding_entry_t *));
+  table->mask = nbuckets - 1;
+  table->size = 0;
+  table->capacity = capacity;
+  table->first = NULL;
+  table->last = NULL;
+  pthread_mutex_init (&table->mutex, NULL);
+  return table;
+}
+
+/* Remove all entries and free the table */
+void binding_table_free (binding_table_t *table)
+{
+  binding_entry_t *current = table->first;
+  binding_entry_t *next;
+
+  while (current)
+  {
+    next = current->next;
+    /* Free the entry */
+    free (current);
+    current = next;
+  }
+  pthread_mutex_destroy (&table->mutex);
+  free (table->buckets);
+  free (table);
+}
+
+/* Copy the binding for a device, marking it as recently used */
+bool binding_table_get (binding_table_t *table, uint32_t device_id,
+                        unsigned *max_apdu, BACNET_ADDRESS *address)
+{
+  if (!table)
+  {
+    return false;
+  }
+  pthread_mutex_lock (&table->mutex);
+  binding_entry_t *entry = binding_table_get_locked (table, device_id);
+  if (entry)
+  {
+    *max_apdu = entry->max_apdu;
+    *address = entry->address;
+    binding_table_unlink_locked (table, entry);
+    binding_table_push_locked (table, entry);
+  }
+  pthread_mutex_unlock (&table->mutex);
+  return entry != NULL;
+}
+
+/* Add or update the binding for a device, evicting the least recently used if full */
+void binding_table_set (binding_table_t *table, uint32_t device_id,
+                        unsigned max_apdu, BACNET_ADDRESS *address)
+{
+  pthread_mutex_lock (&table->mutex);
+  binding_entry_t *entry = binding_table_get_locked (table, device_id);
+  if (entry)
+  {
+    binding_table_unlink_locked (table, entry);
+  }
+  else
+  {
+    if (table->size >= table->capacity)
+    {
+      binding_table_remove_locked (table, table->last);
+    }
+    uint32_t bucket = binding_table_hash (table, device_id);
+    entry = malloc (sizeof (binding_entry_t));
+    memset (entry, 0, sizeof (binding_entry_t));
+    entry->device_id = device_id;
+    entry->chain = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+    table->size++;
+  }
+  entry->max_apdu = max_apdu;
+  entry->address = *address;
+  binding_table_push_locked (table, entry);
+  pthread_mutex_unlock (&table->mutex);
+}
+
+/* Update the binding for a device only if the device is already bound */
+bool binding_table_update (binding_table_t *table, uint32_t device_id,
+                           unsigned max_apdu, BACNET_ADDRESS *address)
+{
+  pthread_mutex_lock (&table->mutex);
+  binding_entry_t *entry = binding_table_get_locked (table, device_id);
+  if (entry)
+  {
+    entry->max_apdu = max_apdu;
+    entry->address = *address;
+  }
+  pthread_mutex_unlock (&table->mutex);
+  return entry != NULL;
+}
+
+/* Remove the binding for a device */
+void binding_table_remove (binding_table_t *table, uint32_t device_id)
+{
+  pthread_mutex_lock (&table->mutex);
+  binding_entry_t *entry = binding_table_get_locked (table, device_id);
+  if (entry)
+  {
+    binding_table_remove_locked (table, entry);
+  }
+  pthread_mutex_unlock (&table->mutex);
+}
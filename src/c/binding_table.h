@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_BINDING_TABLE_H
+#define DEVICE_BACNET_C_BINDING_TABLE_H
+
+/* Structure containing the bound address of a device */
+typedef struct binding_entry_t
+{
+  uint32_t device_id;
+  unsigned max_apdu;
+  BACNET_ADDRESS address;
+  /* Next entry in the same hash bucket */
+  struct binding_entry_t *chain;
+  /* Neighbours in the least recently used order, most recent first */
+  struct binding_entry_t *next;
+  struct binding_entry_t *prev;
+} binding_entry_t;
+
+/* Hash table of device bindings, bounded by evicting the least recently used */
+typedef struct binding_table_t
+{
+  binding_entry_t **buckets;
+  uint32_t mask;
+  uint32_t size;
+  uint32_t capacity;
+  binding_entry_t *first;
+  binding_entry_t *last;
+  pthread_mutex_t mutex;
+} binding_table_t;
+
+binding_table_t *binding_table_alloc (uint32_t capacity);
+
+void binding_table_free (binding_table_t *table);
+
+bool binding_table_get (binding_table_t *table, uint32_t device_id,
+                        unsigned *max_apdu, BACNET_ADDRESS *address);
+
+void binding_table_set (binding_table_t *table, uint32_t device_id,
+                        unsigned max_apdu, BACNET_ADDRESS *address);
+
+bool binding_table_update (binding_table_t *table, uint32_t device_id,
+                           unsigned max_apdu, BACNET_ADDRESS *address);
+
+void binding_table_remove (binding_table_t *table, uint32_t device_id);
+
+#endif //DEVICE_BACNET_C_BINDING_TABLE_H
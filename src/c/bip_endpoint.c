@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifdef BACDL_BIP
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <iot/os.h>
+#include <bip.h>
+#include <bvlc.h>
+#include "bip_endpoint.h"
+#include "stats.h"
+
+#define BVLC_HEADER_LENGTH 4
+#define BVLC_FORWARDED_HEADER_LENGTH 10
+
+/* Open a UDP socket bound to a port, allowing broadcasts */
+static int bip_endpoint_open (uint16_t port)
+{
+  struct sockaddr_in sin = {0};
+  int value = 1;
+  int sock = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (sock < 0)
+  {
+    return -1;
+  }
+  /* Share the port with other BACnet applications on this host */
+  if (setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &value, sizeof (value)) < 0 ||
+      setsockopt (sock, SOL_SOCKET, SO_BROADCAST, &value, sizeof (value)) < 0)
+  {
+    close (sock);
+    return -1;
+  }
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_ANY);
+  sin.sin_port = htons (port);
+  if (bind (sock, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+  {
+    close (sock);
+    return -1;
+  }
+  return sock;
+}
+
+static bip_endpoint_t *bip_endpoint_add_locked (bip_endpoint_ll *list, uint16_t port,
+                                                int sock, bool owned)
+{
+  bip_endpoint_t *endpoint = malloc (sizeof (bip_endpoint_t));
+  endpoint->port = port;
+  endpoint->socket = sock;
+  endpoint->owned = owned;
+  endpoint->next = list->first;
+  list->first = endpoint;
+
+  /* Wake the datalink thread when data arrives on the endpoint */
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.ptr = endpoint;
+  epoll_ctl (list->epoll_fd, EPOLL_CTL_ADD, sock, &event);
+  return endpoint;
+}
+
+/* Create the list of endpoints, starting with the stack's own socket and an
+ * endpoint on an ephemeral port for discovery. Each endpoint's socket is
+ * added to the epoll instance, with the endpoint as its data.
+ */
+bip_endpoint_ll *bip_endpoint_alloc (int stack_socket, uint16_t stack_port, int epoll_fd)
+{
+  bip_endpoint_ll *list = malloc (sizeof (bip_endpoint_ll));
+  list->first = NULL;
+  list->discovery = NULL;
+  list->epoll_fd = epoll_fd;
+  list->queues[0] = calloc (1, sizeof (bip_send_queue_t));
+  list->queues[1] = calloc (1, sizeof (bip_send_queue_t));
+  list->active = 0;
+  pthread_mutex_init (&list->mutex, NULL);
+
+  list->stack = bip_endpoint_add_locked (list, stack_port, stack_socket, false);
+  int sock = bip_endpoint_open (0);
+  if (sock >= 0)
+  {
+    struct sockaddr_in sin = {0};
+    socklen_t len = sizeof (sin);
+    getsockname (sock, (struct sockaddr *) &sin, &len);
+    list->discovery = bip_endpoint_add_locked (list, ntohs (sin.sin_port), sock, true);
+  }
+  return list;
+}
+
+/* Close the sockets opened here and free the list */
+void bip_endpoint_free (bip_endpoint_ll *list)
+{
+  bip_endpoint_t *current = list->first;
+  bip_endpoint_t *next;
+
+  while (current)
+  {
+    next = current->next;
+    if (current->owned)
+    {
+      close (current->socket);
+    }
+    free (current);
+    current = next;
+  }
+  free (list->queues[0]);
+  free (list->queues[1]);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Get the endpoint bound to a port, opening it on first use */
+bip_endpoint_t *bip_endpoint_get (bip_endpoint_ll *list, uint16_t port)
+{
+  pthread_mutex_lock (&list->mutex);
+  bip_endpoint_t *current = list->first;
+  while (current)
+  {
+    if (current->port == port && current != list->discovery)
+    {
+      break;
+    }
+    current = current->next;
+  }
+  if (current == NULL)
+  {
+    int sock = bip_endpoint_open (port);
+    if (sock >= 0)
+    {
+      current = bip_endpoint_add_locked (list, port, sock, true);
+    }
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return current;
+}
+
+/* Decode a BVLC message received on an endpoint, returning the length of the NPDU */
+static uint16_t bip_endpoint_decode (bip_endpoint_t *endpoint, uint8_t *buf, unsigned len,
+                                     const struct sockaddr_in *sin, BACNET_ADDRESS *src,
+                                     uint8_t **pdu)
+{
+  unsigned offset;
+
+  if (len < BVLC_HEADER_LENGTH || buf[0] != BVLL_TYPE_BACNET_IP ||
+      ((buf[2] << 8) | buf[3]) != len)
+  {
+    return 0;
+  }
+  /* Ignore our own broadcasts */
+  if (sin->sin_addr.s_addr == bip_get_addr () && ntohs (sin->sin_port) == endpoint->port)
+  {
+    return 0;
+  }
+
+  memset (src, 0, sizeof (BACNET_ADDRESS));
+  src->mac_len = 6;
+  switch (buf[1])
+  {
+    case BVLC_ORIGINAL_UNICAST_NPDU:
+    case BVLC_ORIGINAL_BROADCAST_NPDU:
+      offset = BVLC_HEADER_LENGTH;
+      memcpy (&src->mac[0], &sin->sin_addr.s_addr, 4);
+      memcpy (&src->mac[4], &sin->sin_port, 2);
+      break;
+    case BVLC_FORWARDED_NPDU:
+      /* The original source address follows the header */
+      if (len < BVLC_FORWARDED_HEADER_LENGTH)
+      {
+        return 0;
+      }
+      offset = BVLC_FORWARDED_HEADER_LENGTH;
+      memcpy (&src->mac[0], &buf[BVLC_HEADER_LENGTH], 6);
+      break;
+    default:
+      return 0;
+  }
+  *pdu = &buf[offset];
+  return (uint16_t) (len - offset);
+}
+
+/* Read the datagrams waiting on an endpoint with one call, returning how many were read */
+unsigned bip_endpoint_receive_batch (bip_endpoint_t *endpoint, bip_frame_t *frames,
+                                     unsigned max)
+{
+  struct mmsghdr msgs[BIP_RECEIVE_BATCH];
+  struct iovec iov[BIP_RECEIVE_BATCH];
+  struct sockaddr_in sin[BIP_RECEIVE_BATCH];
+
+  if (max > BIP_RECEIVE_BATCH)
+  {
+    max = BIP_RECEIVE_BATCH;
+  }
+  memset (msgs, 0, max * sizeof (struct mmsghdr));
+  for (unsigned i = 0; i < max; i++)
+  {
+    iov[i].iov_base = frames[i].buf;
+    iov[i].iov_len = sizeof (frames[i].buf);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &sin[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof (sin[i]);
+  }
+
+  int count = recvmmsg (endpoint->socket, msgs, max, MSG_DONTWAIT, NULL);
+  if (count <= 0)
+  {
+    return 0;
+  }
+  stats_record_rx_batch (count);
+  for (int i = 0; i < count; i++)
+  {
+    frames[i].pdu_len = bip_endpoint_decode (endpoint, frames[i].buf, msgs[i].msg_len,
+                                             &sin[i], &frames[i].src, &frames[i].pdu);
+  }
+  return (unsigned) count;
+}
+
+/* Queue an NPDU to be sent to a device from an endpoint. Returns the number
+ * of datagrams then queued, or 0 if the queue is full.
+ */
+unsigned bip_endpoint_queue_unicast (bip_endpoint_ll *list, bip_endpoint_t *endpoint,
+                                     const BACNET_ADDRESS *dest, const uint8_t *pdu,
+                                     unsigned pdu_len)
+{
+  unsigned len = pdu_len + BVLC_HEADER_LENGTH;
+  unsigned count = 0;
+
+  if (len > MAX_MPDU)
+  {
+    return 0;
+  }
+  pthread_mutex_lock (&list->mutex);
+  bip_send_queue_t *queue = list->queues[list->active];
+  if (queue->count < BIP_SEND_QUEUE_DEPTH)
+  {
+    bip_datagram_t *datagram = &queue->datagrams[queue->count];
+    datagram->socket = endpoint->socket;
+    memset (&datagram->dest, 0, sizeof (datagram->dest));
+    datagram->dest.sin_family = AF_INET;
+    memcpy (&datagram->dest.sin_addr.s_addr, &dest->mac[0], 4);
+    memcpy (&datagram->dest.sin_port, &dest->mac[4], 2);
+    datagram->len = (uint16_t) len;
+    datagram->buf[0] = BVLL_TYPE_BACNET_IP;
+    datagram->buf[1] = BVLC_ORIGINAL_UNICAST_NPDU;
+    datagram->buf[2] = (uint8_t) (len >> 8);
+    datagram->buf[3] = (uint8_t) (len & 0xFF);
+    memcpy (&datagram->buf[BVLC_HEADER_LENGTH], pdu, pdu_len);
+    count = ++queue->count;
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return count;
+}
+
+/* Send the queued datagrams, with one call for each run of datagrams on the same socket.
+ * Only one thread may flush.
+ */
+void bip_endpoint_flush (bip_endpoint_ll *list)
+{
+  struct mmsghdr msgs[BIP_SEND_QUEUE_DEPTH];
+  struct iovec iov[BIP_SEND_QUEUE_DEPTH];
+
+  /* Switch queues so that senders are not held up while this one is sent */
+  pthread_mutex_lock (&list->mutex);
+  bip_send_queue_t *queue = list->queues[list->active];
+  list->active ^= 1;
+  pthread_mutex_unlock (&list->mutex);
+
+  memset (msgs, 0, queue->count * sizeof (struct mmsghdr));
+  for (unsigned i = 0; i < queue->count; i++)
+  {
+    iov[i].iov_base = queue->datagrams[i].buf;
+    iov[i].iov_len = queue->datagrams[i].len;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &queue->datagrams[i].dest;
+    msgs[i].msg_hdr.msg_namelen = sizeof (queue->datagrams[i].dest);
+  }
+
+  unsigned start = 0;
+  while (start < queue->count)
+  {
+    int sock = queue->datagrams[start].socket;
+    unsigned end = start + 1;
+    while (end < queue->count && queue->datagrams[end].socket == sock)
+    {
+      end++;
+    }
+    int sent = sendmmsg (sock, &msgs[start], end - start, 0);
+    if (sent > 0)
+    {
+      stats_record_tx_batch (sent);
+      start += sent;
+    }
+    else
+    {
+      /* Drop the datagram that could not be sent; its request will time out */
+      start++;
+    }
+  }
+  queue->count = 0;
+}
+
+/* Broadcast an NPDU on the local network to the given port, from an endpoint */
+int bip_endpoint_send_broadcast (bip_endpoint_t *endpoint, uint16_t port,
+                                 uint8_t *pdu, unsigned pdu_len)
+{
+  uint8_t buf[MAX_MPDU];
+  struct sockaddr_in sin = {0};
+  unsigned len = pdu_len + BVLC_HEADER_LENGTH;
+
+  if (len > sizeof (buf))
+  {
+    return -1;
+  }
+  buf[0] = BVLL_TYPE_BACNET_IP;
+  buf[1] = BVLC_ORIGINAL_BROADCAST_NPDU;
+  buf[2] = (uint8_t) (len >> 8);
+  buf[3] = (uint8_t) (len & 0xFF);
+  memcpy (&buf[BVLC_HEADER_LENGTH], pdu, pdu_len);
+
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = bip_get_broadcast_addr ();
+  sin.sin_port = htons (port);
+  return (int) sendto (endpoint->socket, buf, len, 0, (struct sockaddr *) &sin, sizeof (sin));
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_BIP_ENDPOINT_H
+#define DEVICE_BACNET_C_BIP_ENDPOINT_H
+
+/* Maximum number of datagrams read by one receive call */
+#define BIP_RECEIVE_BATCH 32
+/* Maximum number of unicasts waiting to be sent */
+#define BIP_SEND_QUEUE_DEPTH 128
+
+/* A UDP socket used for BACnet/IP traffic on one port */
+typedef struct bip_endpoint_t
+{
+  /* UDP port the socket is bound to, in host order */
+  uint16_t port;
+  int socket;
+  /* False for the socket opened by the BACnet stack, which is not closed here */
+  bool owned;
+  struct bip_endpoint_t *next;
+} bip_endpoint_t;
+
+/* A received BACnet/IP message */
+typedef struct bip_frame_t
+{
+  BACNET_ADDRESS src;
+  /* The NPDU within buf, with pdu_len 0 if the message holds no NPDU */
+  uint8_t *pdu;
+  uint16_t pdu_len;
+  uint8_t buf[MAX_MPDU];
+} bip_frame_t;
+
+/* A BVLC message waiting to be sent */
+typedef struct bip_datagram_t
+{
+  int socket;
+  struct sockaddr_in dest;
+  uint16_t len;
+  uint8_t buf[MAX_MPDU];
+} bip_datagram_t;
+
+typedef struct bip_send_queue_t
+{
+  bip_datagram_t datagrams[BIP_SEND_QUEUE_DEPTH];
+  unsigned count;
+} bip_send_queue_t;
+
+/* Linked list of BACnet/IP endpoints */
+typedef struct bip_endpoint_ll
+{
+  bip_endpoint_t *first;
+  /* Endpoint for the socket opened by the stack */
+  bip_endpoint_t *stack;
+  /* Endpoint used to send discovery broadcasts */
+  bip_endpoint_t *discovery;
+  /* Unicasts are queued on the active queue while the other is sent */
+  bip_send_queue_t *queues[2];
+  unsigned active;
+  /* Epoll instance the endpoint sockets are registered with */
+  int epoll_fd;
+  pthread_mutex_t mutex;
+} bip_endpoint_ll;
+
+bip_endpoint_ll *bip_endpoint_alloc (int stack_socket, uint16_t stack_port, int epoll_fd);
+
+void bip_endpoint_free (bip_endpoint_ll *list);
+
+bip_endpoint_t *bip_endpoint_get (bip_endpoint_ll *list, uint16_t port);
+
+unsigned bip_endpoint_receive_batch (bip_endpoint_t *endpoint, bip_frame_t *frames,
+                                     unsigned max);
+
+unsigned bip_endpoint_queue_unicast (bip_endpoint_ll *list, bip_endpoint_t *endpoint,
+                                     const BACNET_ADDRESS *dest, const uint8_t *pdu,
+                                     unsigned pdu_len);
+
+void bip_endpoint_flush (bip_endpoint_ll *list);
+
+int bip_endpoint_send_broadcast (bip_endpoint_t *endpoint, uint16_t port,
+                                 uint8_t *pdu, unsigned pdu_len);
+
+#endif //DEVICE_BACNET_C_BIP_ENDPOINT_H
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "circuit_breaker.h"
+#include "hash.h"
+#include "deadline.h"
+
+static uint32_t circuit_breaker_hash (uint32_t device_id)
+{
+  return hash_word (HASH_INIT, device_id) % CIRCUIT_BREAKER_BUCKETS;
+}
+
+/* Find the breaker of a device, creating it if create is set */
+static circuit_breaker_t *circuit_breaker_get_locked (circuit_breaker_ll *list, uint32_t device_id,
+                                                      bool create)
+{
+  circuit_breaker_t **link = &list->buckets[circuit_breaker_hash (device_id)];
+  while (*link && (*link)->device_id != device_id)
+  {
+    link = &(*link)->next;
+  }
+  if (*link == NULL && create)
+  {
+    *link = calloc (1, sizeof (circuit_breaker_t));
+    (*link)->device_id = device_id;
+  }
+  return *link;
+}
+
+/* Remove the breaker of a device, as devices without one are closed */
+static void circuit_breaker_remove_locked (circuit_breaker_ll *list, circuit_breaker_t *breaker)
+{
+  circuit_breaker_t **link = &list->buckets[circuit_breaker_hash (breaker->device_id)];
+  while (*link != breaker)
+  {
+    link = &(*link)->next;
+  }
+  *link = breaker->next;
+  free (breaker);
+}
+
+static void circuit_breaker_open_locked (circuit_breaker_ll *list, circuit_breaker_t *breaker)
+{
+  breaker->state = CIRCUIT_BREAKER_OPEN;
+  deadline_set (&breaker->probe_due, list->probe_interval);
+}
+
+circuit_breaker_ll *circuit_breaker_alloc (uint32_t threshold, uint32_t probe_interval)
+{
+  circuit_breaker_ll *list = calloc (1, sizeof (circuit_breaker_ll));
+  list->threshold = threshold;
+  list->probe_interval = probe_interval;
+  pthread_mutex_init (&list->mutex, NULL);
+  return list;
+}
+
+static void circuit_breaker_clear_locked (circuit_breaker_ll *list)
+{
+  for (int i = 0; i < CIRCUIT_BREAKER_BUCKETS; i++)
+  {
+    circuit_breaker_t *current = list->buckets[i];
+    while (current)
+    {
+      circuit_breaker_t *next = current->next;
+      free (current);
+      current = next;
+    }
+    list->buckets[i] = NULL;
+  }
+}
+
+void circuit_breaker_free (circuit_breaker_ll *list)
+{
+  circuit_breaker_clear_locked (list);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Change the threshold and probe interval. A threshold of 0 closes every
+ * breaker; open breakers otherwise keep their probe time.
+ */
+void circuit_breaker_configure (circuit_breaker_ll *list, uint32_t threshold, uint32_t probe_interval)
+{
+  pthread_mutex_lock (&list->mutex);
+  list->threshold = threshold;
+  list->probe_interval = probe_interval;
+  if (threshold == 0)
+  {
+    circuit_breaker_clear_locked (list);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Check whether a request may be sent to a device. When a probe is due, the
+ * breaker becomes half-open and lets this one request through. Every allowed
+ * request must be followed by success, failure or cancel.
+ */
+bool circuit_breaker_allow (circuit_breaker_ll *list, uint32_t device_id)
+{
+  bool allow = true;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  circuit_breaker_t *breaker = circuit_breaker_get_locked (list, device_id, false);
+  if (breaker && breaker->state != CIRCUIT_BREAKER_CLOSED)
+  {
+    deadline_now (&now);
+    allow = breaker->state == CIRCUIT_BREAKER_OPEN && deadline_expired (&breaker->probe_due, &now);
+    if (allow)
+    {
+      breaker->state = CIRCUIT_BREAKER_HALF_OPEN;
+    }
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return allow;
+}
+
+/* Record that a device responded, closing its breaker */
+void circuit_breaker_success (circuit_breaker_ll *list, uint32_t device_id)
+{
+  pthread_mutex_lock (&list->mutex);
+  circuit_breaker_t *breaker = circuit_breaker_get_locked (list, device_id, false);
+  if (breaker)
+  {
+    circuit_breaker_remove_locked (list, breaker);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Record that a request to a device timed out, opening its breaker after
+ * threshold consecutive timeouts or when a probe fails
+ */
+void circuit_breaker_failure (circuit_breaker_ll *list, uint32_t device_id)
+{
+  pthread_mutex_lock (&list->mutex);
+  if (list->threshold == 0)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+  circuit_breaker_t *breaker = circuit_breaker_get_locked (list, device_id, true);
+  breaker->failures++;
+  if (breaker->state == CIRCUIT_BREAKER_HALF_OPEN || breaker->failures >= list->threshold)
+  {
+    circuit_breaker_open_locked (list, breaker);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Record that an allowed request ended without showing whether the device is
+ * reachable, so that another probe may be made
+ */
+void circuit_breaker_cancel (circuit_breaker_ll *list, uint32_t device_id)
+{
+  pthread_mutex_lock (&list->mutex);
+  circuit_breaker_t *breaker = circuit_breaker_get_locked (list, device_id, false);
+  if (breaker && breaker->state == CIRCUIT_BREAKER_HALF_OPEN)
+  {
+    breaker->state = CIRCUIT_BREAKER_OPEN;
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
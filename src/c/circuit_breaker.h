@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef DEVICE_BACNET_C_CIRCUIT_BREAKER_H
+#define DEVICE_BACNET_C_CIRCUIT_BREAKER_H
+
+#define CIRCUIT_BREAKER_BUCKETS 1024
+
+/* States of a device's circuit breaker. A closed breaker lets requests
+ * through. It opens after consecutive timeouts, when requests fail at once,
+ * and is half-open while a single probe request tests whether the device has
+ * recovered.
+ */
+#define CIRCUIT_BREAKER_CLOSED 0
+#define CIRCUIT_BREAKER_OPEN 1
+#define CIRCUIT_BREAKER_HALF_OPEN 2
+
+typedef struct circuit_breaker_t
+{
+  uint32_t device_id;
+  int state;
+  /* Consecutive requests that timed out */
+  uint32_t failures;
+  /* When the breaker may next let a probe through, while open */
+  struct timespec probe_due;
+  /* Next entry in the same hash bucket */
+  struct circuit_breaker_t *next;
+} circuit_breaker_t;
+
+/* Hash table of the circuit breakers of devices that have timed out */
+typedef struct circuit_breaker_ll
+{
+  circuit_breaker_t *buckets[CIRCUIT_BREAKER_BUCKETS];
+  /* Timeouts that open a breaker, 0 to never open, and the interval between probes in milliseconds */
+  uint32_t threshold;
+  uint32_t probe_interval;
+  pthread_mutex_t mutex;
+} circuit_breaker_ll;
+
+circuit_breaker_ll *circuit_breaker_alloc (uint32_t threshold, uint32_t probe_interval);
+
+void circuit_breaker_free (circuit_breaker_ll *list);
+
+void circuit_breaker_configure (circuit_breaker_ll *list, uint32_t threshold, uint32_t probe_interval);
+
+bool circuit_breaker_allow (circuit_breaker_ll *list, uint32_t device_id);
+
+void circuit_breaker_success (circuit_breaker_ll *list, uint32_t device_id);
+
+void circuit_breaker_failure (circuit_breaker_ll *list, uint32_t device_id);
+
+void circuit_breaker_cancel (circuit_breaker_ll *list, uint32_t device_id);
+
+#endif //DEVICE_BACNET_C_CIRCUIT_BREAKER_H
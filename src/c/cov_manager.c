@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include <iot/time.h>
+#include "cov_manager.h"
+#include "hash.h"
+#include "deadline.h"
+
+static uint32_t cov_manager_hash (uint32_t process_id)
+{
+  return hash_word (HASH_INIT, process_id);
+}
+
+static cov_subscription_t *cov_manager_get_locked (cov_manager_ll *list, uint32_t process_id)
+{
+  cov_subscription_t *current = list->buckets[cov_manager_hash (process_id) % COV_MANAGER_BUCKETS];
+  while (current && current->process_id != process_id)
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+static void cov_manager_free_subscription (cov_subscription_t *sub)
+{
+  free (sub->device);
+  free (sub->resource);
+  free (sub->name);
+  free (sub);
+}
+
+/* Completion of a cancellation, which is not waited for */
+static void cov_manager_cancel_complete (return_data_t *data, void *context)
+{
+  (void) context;
+  if (data->value)
+  {
+    free (data->value);
+  }
+  return_data_remove_by_ptr (returnDataHead, data);
+}
+
+/* Cancel a subscription that the device accepted */
+static void cov_manager_cancel (cov_subscription_t *sub)
+{
+  if (!bacnetSubscribeCOVAsync (&sub->address, sub->type, sub->instance, sub->process_id,
+                                false, 0, true, cov_manager_cancel_complete, NULL))
+  {
+    iot_log_debug (sub->list->lc, "COV subscription to %s on %s could not be cancelled",
+                   sub->resource, sub->device);
+  }
+}
+
+/* Schedule the next subscribe request, renewing an accepted subscription
+ * halfway through its lease plus up to a quarter of it chosen by the process
+ * identifier, so that subscriptions made together are renewed apart
+ */
+static void cov_manager_subscribe_done (cov_subscription_t *sub, bool accepted)
+{
+  cov_manager_ll *list = sub->list;
+  uint64_t lifetime = (uint64_t) list->lifetime * 1000;
+
+  pthread_mutex_lock (&list->mutex);
+  sub->busy = false;
+  if (sub->removed)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    if (accepted)
+    {
+      cov_manager_cancel (sub);
+    }
+    cov_manager_free_subscription (sub);
+    return;
+  }
+  deadline_now (&sub->due);
+  if (accepted)
+  {
+    sub->active = true;
+    sub->expires = sub->due;
+    deadline_add (&sub->expires, lifetime);
+    deadline_add (&sub->due, lifetime / 2 + cov_manager_hash (sub->process_id) % (lifetime / 4 + 1));
+  }
+  else
+  {
+    iot_log_debug (list->lc, "COV subscription to %s on %s failed", sub->resource, sub->device);
+    deadline_add (&sub->due, COV_RETRY_INTERVAL);
+  }
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Completion of a subscribe request, run on the thread handling the response */
+static void cov_manager_subscribe_complete (return_data_t *data, void *context)
+{
+  bool accepted = !data->errorDetected;
+  if (data->value)
+  {
+    free (data->value);
+  }
+  return_data_remove_by_ptr (returnDataHead, data);
+  cov_manager_subscribe_done ((cov_subscription_t *) context, accepted);
+}
+
+/* Make or renew a subscription */
+static void cov_manager_subscribe (cov_manager_ll *list, cov_subscription_t *sub)
+{
+  uint32_t instance = sub->instance;
+  if (sub->name && !bacnet_resolve_object_name (&sub->address, sub->type, sub->name, &instance))
+  {
+    cov_manager_subscribe_done (sub, false);
+    return;
+  }
+  pthread_mutex_lock (&list->mutex);
+  sub->instance = instance;
+  pthread_mutex_unlock (&list->mutex);
+  if (!bacnetSubscribeCOVAsync (&sub->address, sub->type, instance, sub->process_id, sub->confirmed,
+                                list->lifetime, false, cov_manager_subscribe_complete, sub))
+  {
+    cov_manager_subscribe_done (sub, false);
+  }
+}
+
+/* Post the changed value of a subscribed property as a reading. Run on the
+ * thread decoding the notification.
+ */
+static void cov_manager_notify (void *context, uint32_t device_id, uint32_t process_id,
+                                BACNET_OBJECT_TYPE type, uint32_t instance,
+                                BACNET_PROPERTY_VALUE *values)
+{
+  cov_manager_ll *list = (cov_manager_ll *) context;
+  BACNET_PROPERTY_VALUE *value = NULL;
+
+  pthread_mutex_lock (&list->mutex);
+  cov_subscription_t *sub = cov_manager_get_locked (list, process_id);
+  if (sub && sub->address.deviceInstance == device_id && sub->type == type && sub->instance == instance)
+  {
+    value = values;
+    while (value && value->propertyIdentifier != sub->property)
+    {
+      value = value->next;
+    }
+  }
+  if (value == NULL)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+  char *device = strdup (sub->device);
+  char *resource = strdup (sub->resource);
+  pthread_mutex_unlock (&list->mutex);
+
+  /* The reading takes a copy of the value, which it frees */
+  BACNET_APPLICATION_DATA_VALUE *copy = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
+  *copy = value->value;
+  copy->next = NULL;
+  devsdk_commandresult *result = calloc (1, sizeof (devsdk_commandresult));
+  devsdk_commandresult_populate (result, copy, 1);
+  if (result->value)
+  {
+    result->origin = iot_time_nsecs ();
+    devsdk_post_readings (list->service, device, resource, result);
+  }
+  devsdk_commandresult_free (result, 1);
+  free (device);
+  free (resource);
+}
+
+static void *cov_manager_run (void *arg)
+{
+  cov_manager_ll *list = (cov_manager_ll *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  while (list->running)
+  {
+    /* Collect the subscriptions that are due, and find when the next one is */
+    cov_subscription_t *due = NULL;
+    const struct timespec *earliest = NULL;
+    deadline_now (&now);
+    for (cov_subscription_t *sub = list->first; sub; sub = sub->order_next)
+    {
+      if (sub->busy)
+      {
+        continue;
+      }
+      if (deadline_expired (&sub->due, &now))
+      {
+        sub->busy = true;
+        sub->due_next = due;
+        due = sub;
+      }
+      else if (earliest == NULL || deadline_expired (&sub->due, earliest))
+      {
+        earliest = &sub->due;
+      }
+    }
+
+    if (due)
+    {
+      pthread_mutex_unlock (&list->mutex);
+      while (due)
+      {
+        cov_subscription_t *next = due->due_next;
+        cov_manager_subscribe (list, due);
+        due = next;
+      }
+      pthread_mutex_lock (&list->mutex);
+      continue;
+    }
+
+    deadline_wait (&list->wakeup, &list->mutex, earliest);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return NULL;
+}
+
+/* Create an empty set of subscriptions, start its thread and receive the
+ * COV notifications of the driver. Subscriptions are made for lifetime
+ * seconds.
+ */
+cov_manager_ll *cov_manager_alloc (devsdk_service_t *service, iot_logger_t *lc, uint32_t lifetime)
+{
+  cov_manager_ll *list = calloc (1, sizeof (cov_manager_ll));
+  list->service = service;
+  list->lc = lc;
+  list->lifetime = lifetime ? lifetime : DEFAULT_COV_LIFETIME;
+  list->next_process_id = 1;
+  list->running = true;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->wakeup);
+  pthread_create (&list->thread, NULL, cov_manager_run, list);
+  bacnet_set_cov_handler (cov_manager_notify, list);
+  return list;
+}
+
+/* Stop the thread, so that no more subscriptions are made or renewed */
+void cov_manager_stop (cov_manager_ll *list)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool running = list->running;
+  list->running = false;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  if (running)
+  {
+    pthread_join (list->thread, NULL);
+  }
+}
+
+/* Free the subscriptions. The driver must have stopped, so that no requests
+ * are in progress and no notifications are being decoded.
+ */
+void cov_manager_free (cov_manager_ll *list)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  cov_manager_stop (list);
+  bacnet_set_cov_handler (NULL, NULL);
+
+  cov_subscription_t *current = list->first;
+  while (current)
+  {
+    cov_subscription_t *next = current->order_next;
+    cov_manager_free_subscription (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->wakeup);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Subscribe to the COV notifications of a resource of a device, with the
+ * first subscribe request due immediately
+ */
+cov_subscription_t *cov_manager_add (cov_manager_ll *list, const devsdk_device_t *device,
+                                     const char *resource, const bacnet_attributes_t *attrs)
+{
+  cov_subscription_t *sub = calloc (1, sizeof (cov_subscription_t));
+  sub->list = list;
+  sub->device = strdup (device->name);
+  sub->resource = strdup (resource);
+  sub->address = *(bacnet_address_t *) device->address;
+  sub->type = attrs->type;
+  sub->instance = attrs->instance;
+  sub->name = attrs->name ? strdup (attrs->name) : NULL;
+  sub->property = attrs->property;
+  sub->confirmed = attrs->cov == BACNET_COV_CONFIRMED;
+  deadline_now (&sub->due);
+
+  pthread_mutex_lock (&list->mutex);
+  /* Take the next process identifier not in use, skipping 0 */
+  while (list->next_process_id == 0 || cov_manager_get_locked (list, list->next_process_id))
+  {
+    list->next_process_id++;
+  }
+  sub->process_id = list->next_process_id++;
+  uint32_t bucket = cov_manager_hash (sub->process_id) % COV_MANAGER_BUCKETS;
+  sub->next = list->buckets[bucket];
+  list->buckets[bucket] = sub;
+  sub->order_next = list->first;
+  list->first = sub;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  return sub;
+}
+
+/* Remove a subscription, cancelling it on the device if it was accepted */
+void cov_manager_remove (cov_manager_ll *list, cov_subscription_t *sub)
+{
+  pthread_mutex_lock (&list->mutex);
+  cov_subscription_t **link = &list->buckets[cov_manager_hash (sub->process_id) % COV_MANAGER_BUCKETS];
+  while (*link != sub)
+  {
+    link = &(*link)->next;
+  }
+  *link = sub->next;
+  link = &list->first;
+  while (*link != sub)
+  {
+    link = &(*link)->order_next;
+  }
+  *link = sub->order_next;
+  sub->removed = true;
+  bool busy = sub->busy;
+  bool active = sub->active;
+  pthread_mutex_unlock (&list->mutex);
+
+  if (!busy)
+  {
+    if (active)
+    {
+      cov_manager_cancel (sub);
+    }
+    cov_manager_free_subscription (sub);
+  }
+}
+
+/* Check whether a subscription has been accepted and its lease has not ended */
+bool cov_manager_is_active (cov_manager_ll *list, cov_subscription_t *sub)
+{
+  struct timespec now;
+  deadline_now (&now);
+  pthread_mutex_lock (&list->mutex);
+  bool active = sub->active && !deadline_expired (&sub->expires, &now);
+  pthread_mutex_unlock (&list->mutex);
+  return active;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <devsdk/devsdk.h>
+#include "driver.h"
+
+#ifndef DEVICE_BACNET_C_COV_MANAGER_H
+#define DEVICE_BACNET_C_COV_MANAGER_H
+
+#define COV_MANAGER_BUCKETS 1024
+
+/* Milliseconds before a subscription that failed is tried again */
+#define COV_RETRY_INTERVAL 30000
+
+/* A subscription to the COV notifications of a resource, whose changes are
+ * posted as readings
+ */
+typedef struct cov_subscription_t
+{
+  struct cov_manager_ll *list;
+  uint32_t process_id;
+  char *device;
+  char *resource;
+  bacnet_address_t address;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  /* Object name, resolved to the instance before subscribing when set */
+  char *name;
+  BACNET_PROPERTY_ID property;
+  bool confirmed;
+  /* When the subscription is next made or renewed */
+  struct timespec due;
+  /* Set once the device has accepted the subscription, until its lease ends */
+  bool active;
+  struct timespec expires;
+  /* Set while a subscribe request is in progress, and when removed
+   * meanwhile, so the completing request frees the subscription
+   */
+  bool busy;
+  bool removed;
+  /* Next subscription in the same hash bucket, in the list, and in the set due */
+  struct cov_subscription_t *next;
+  struct cov_subscription_t *order_next;
+  struct cov_subscription_t *due_next;
+} cov_subscription_t;
+
+/* Subscriptions hashed by process identifier, with a thread renewing each
+ * one halfway through its lease, staggered so that renewals are spread out
+ */
+typedef struct cov_manager_ll
+{
+  cov_subscription_t *buckets[COV_MANAGER_BUCKETS];
+  cov_subscription_t *first;
+  uint32_t next_process_id;
+  /* Lifetime of subscriptions in seconds */
+  uint32_t lifetime;
+  devsdk_service_t *service;
+  iot_logger_t *lc;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+} cov_manager_ll;
+
+cov_manager_ll *cov_manager_alloc (devsdk_service_t *service, iot_logger_t *lc, uint32_t lifetime);
+
+void cov_manager_stop (cov_manager_ll *list);
+
+void cov_manager_free (cov_manager_ll *list);
+
+cov_subscription_t *cov_manager_add (cov_manager_ll *list, const devsdk_device_t *device,
+                                     const char *resource, const bacnet_attributes_t *attrs);
+
+void cov_manager_remove (cov_manager_ll *list, cov_subscription_t *sub);
+
+bool cov_manager_is_active (cov_manager_ll *list, cov_subscription_t *sub);
+
+#endif //DEVICE_BACNET_C_COV_MANAGER_H
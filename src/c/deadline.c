@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "deadline.h"
+
+void deadline_now (struct timespec *now)
+{
+  clock_gettime (CLOCK_MONOTONIC, now);
+}
+
+/* Move a deadline a number of milliseconds later */
+void deadline_add (struct timespec *deadline, uint64_t ms)
+{
+  deadline->tv_sec += ms / 1000;
+  deadline->tv_nsec += (long) (ms % 1000) * 1000000;
+  if (deadline->tv_nsec >= 1000000000)
+  {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+/* Set a deadline a number of milliseconds from now */
+void deadline_set (struct timespec *deadline, uint64_t ms)
+{
+  deadline_now (deadline);
+  deadline_add (deadline, ms);
+}
+
+/* Move a periodic deadline that has expired to the next period, or to a
+ * period from now if that has also passed, so missed periods are not caught up
+ */
+void deadline_next (struct timespec *deadline, uint64_t ms, const struct timespec *now)
+{
+  deadline_add (deadline, ms);
+  if (deadline_expired (deadline, now))
+  {
+    *deadline = *now;
+    deadline_add (deadline, ms);
+  }
+}
+
+bool deadline_expired (const struct timespec *deadline, const struct timespec *now)
+{
+  return deadline->tv_sec < now->tv_sec ||
+         (deadline->tv_sec == now->tv_sec && deadline->tv_nsec <= now->tv_nsec);
+}
+
+/* Bring a deadline forward to a limit if the limit is earlier, or keep it if
+ * the limit is NULL. Returns true if the deadline was brought forward.
+ */
+bool deadline_limit (struct timespec *deadline, const struct timespec *limit)
+{
+  if (limit && deadline_expired (limit, deadline))
+  {
+    *deadline = *limit;
+    return true;
+  }
+  return false;
+}
+
+/* Initialize a condition variable whose timed waits use monotonic deadlines */
+void deadline_cond_init (pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (cond, &attr);
+  pthread_condattr_destroy (&attr);
+}
+
+/* Wait on a condition variable until a deadline, or until signalled if the
+ * deadline is NULL. The deadline is copied first, as the item holding it may
+ * change while the mutex is released.
+ */
+void deadline_wait (pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline)
+{
+  if (deadline)
+  {
+    struct timespec timeout = *deadline;
+    pthread_cond_timedwait (cond, mutex, &timeout);
+  }
+  else
+  {
+    pthread_cond_wait (cond, mutex);
+  }
+}
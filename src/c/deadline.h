@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef DEVICE_BACNET_C_DEADLINE_H
+#define DEVICE_BACNET_C_DEADLINE_H
+
+/* Deadlines are absolute times on CLOCK_MONOTONIC, so that they have
+ * millisecond resolution and do not move when the wall clock is changed.
+ * Condition variables waited on with a deadline must be initialized with
+ * deadline_cond_init.
+ */
+
+void deadline_now (struct timespec *now);
+
+void deadline_add (struct timespec *deadline, uint64_t ms);
+
+void deadline_set (struct timespec *deadline, uint64_t ms);
+
+void deadline_next (struct timespec *deadline, uint64_t ms, const struct timespec *now);
+
+bool deadline_expired (const struct timespec *deadline, const struct timespec *now);
+
+bool deadline_limit (struct timespec *deadline, const struct timespec *limit);
+
+void deadline_cond_init (pthread_cond_t *cond);
+
+/* The scheduler threads wait with deadline_wait for the earliest deadline of
+ * their items. An item is marked busy while its thread works on it without
+ * the mutex; an item removed meanwhile is only marked removed, and is freed
+ * by the thread once it is no longer busy.
+ */
+void deadline_wait (pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline);
+
+#endif //DEVICE_BACNET_C_DEADLINE_H
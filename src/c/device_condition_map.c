@@ -13,6 +13,7 @@
 #include <iot/os.h>
 #include <bacdef.h>
 #include "device_condition_map.h"
+#include "deadline.h"
 
 static device_condition_map_t *
 device_condition_map_get_locked (device_condition_map_ll *list, uint32_t device_id)
@@ -86,7 +87,7 @@ void device_condition_map_set (device_condition_map_ll *list,
   value->device_id = device_id;
 
   /* Initialize condition variable */
-  pthread_cond_init (&value->condition, NULL);
+  deadline_cond_init (&value->condition);
 
   /* Initialize mutex used by condition variable */
   pthread_mutex_init (&value->mutex, NULL);
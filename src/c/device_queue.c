@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "device_queue.h"
+#include "hash.h"
+
+static uint32_t device_queue_hash (uint32_t device_id)
+{
+  return hash_word (HASH_INIT, device_id) % DEVICE_QUEUE_BUCKETS;
+}
+
+/* Find the entry for a device, creating it if create is set */
+static device_queue_t *device_queue_get_locked (device_queue_ll *list, uint32_t device_id,
+                                                bool create)
+{
+  device_queue_t **link = &list->buckets[device_queue_hash (device_id)];
+  while (*link && (*link)->device_id != device_id)
+  {
+    link = &(*link)->next;
+  }
+  if (*link == NULL && create)
+  {
+    *link = calloc (1, sizeof (device_queue_t));
+    (*link)->device_id = device_id;
+  }
+  return *link;
+}
+
+/* Free the entry for a device once nothing is in progress */
+static void device_queue_release_locked (device_queue_ll *list, device_queue_t *queue)
+{
+  if (queue->depth || queue->reads)
+  {
+    return;
+  }
+  device_queue_t **link = &list->buckets[device_queue_hash (queue->device_id)];
+  while (*link != queue)
+  {
+    link = &(*link)->next;
+  }
+  *link = queue->next;
+  free (queue);
+}
+
+/* Copy a value returned by a read, for a thread sharing the read */
+static BACNET_APPLICATION_DATA_VALUE *device_queue_copy_value (const BACNET_APPLICATION_DATA_VALUE *value)
+{
+  if (value == NULL)
+  {
+    return NULL;
+  }
+  BACNET_APPLICATION_DATA_VALUE *copy = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
+  memcpy (copy, value, sizeof (BACNET_APPLICATION_DATA_VALUE));
+  copy->next = NULL;
+  return copy;
+}
+
+/* Drop a reference to a read, freeing it when unused */
+static void device_queue_unref_read_locked (device_queue_ll *list, device_queue_t *queue,
+                                            device_read_t *read)
+{
+  if (--read->refs)
+  {
+    return;
+  }
+  device_read_t **link = &queue->reads;
+  while (*link && *link != read)
+  {
+    link = &(*link)->next;
+  }
+  if (*link)
+  {
+    *link = read->next;
+  }
+  free (read->value);
+  free (read);
+  device_queue_release_locked (list, queue);
+}
+
+/* Create a table limiting each device to max_depth requests in progress */
+device_queue_ll *device_queue_alloc (uint32_t max_depth)
+{
+  device_queue_ll *list = calloc (1, sizeof (device_queue_ll));
+  list->max_depth = max_depth ? max_depth : 1;
+  pthread_mutex_init (&list->mutex, NULL);
+  pthread_cond_init (&list->done, NULL);
+  return list;
+}
+
+/* Change the maximum number of requests in progress to each device. Devices
+ * already over a lower maximum take no more requests until below it.
+ */
+void device_queue_set_depth (device_queue_ll *list, uint32_t max_depth)
+{
+  pthread_mutex_lock (&list->mutex);
+  list->max_depth = max_depth ? max_depth : 1;
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Free the table. No requests may be in progress. */
+void device_queue_free (device_queue_ll *list)
+{
+  for (int i = 0; i < DEVICE_QUEUE_BUCKETS; i++)
+  {
+    device_queue_t *current = list->buckets[i];
+    while (current)
+    {
+      device_queue_t *next = current->next;
+      free (current);
+      current = next;
+    }
+  }
+  pthread_cond_destroy (&list->done);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Count a request to a device, returning false if the device already has
+ * the maximum number of requests in progress
+ */
+bool device_queue_enter (device_queue_ll *list, uint32_t device_id)
+{
+  bool ret = false;
+  pthread_mutex_lock (&list->mutex);
+  device_queue_t *queue = device_queue_get_locked (list, device_id, true);
+  if (queue->depth < list->max_depth)
+  {
+    queue->depth++;
+    ret = true;
+  }
+  else
+  {
+    device_queue_release_locked (list, queue);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return ret;
+}
+
+/* Stop counting a request once it has completed */
+void device_queue_leave (device_queue_ll *list, uint32_t device_id)
+{
+  pthread_mutex_lock (&list->mutex);
+  device_queue_t *queue = device_queue_get_locked (list, device_id, false);
+  if (queue && queue->depth)
+  {
+    queue->depth--;
+    device_queue_release_locked (list, queue);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Find a read of the same property in progress, or start a new one. The
+ * leader flag is set if the caller must send the read and then call
+ * device_queue_finish_read; otherwise it waits with device_queue_wait_read.
+ */
+device_read_t *device_queue_join_read (device_queue_ll *list, uint32_t device_id,
+                                       BACNET_OBJECT_TYPE type, uint32_t instance,
+                                       BACNET_PROPERTY_ID property, uint32_t index,
+                                       bool *leader)
+{
+  pthread_mutex_lock (&list->mutex);
+  device_queue_t *queue = device_queue_get_locked (list, device_id, true);
+  device_read_t *read = queue->reads;
+  while (read)
+  {
+    if (!read->done && read->type == type && read->instance == instance &&
+        read->property == property && read->index == index)
+    {
+      break;
+    }
+    read = read->next;
+  }
+  *leader = (read == NULL);
+  if (read == NULL)
+  {
+    read = calloc (1, sizeof (device_read_t));
+    read->type = type;
+    read->instance = instance;
+    read->property = property;
+    read->index = index;
+    read->next = queue->reads;
+    queue->reads = read;
+  }
+  read->refs++;
+  pthread_mutex_unlock (&list->mutex);
+  return read;
+}
+
+/* Record the result of a read for the threads waiting for it */
+void device_queue_finish_read (device_queue_ll *list, uint32_t device_id, device_read_t *read,
+                               const BACNET_APPLICATION_DATA_VALUE *value)
+{
+  pthread_mutex_lock (&list->mutex);
+  device_queue_t *queue = device_queue_get_locked (list, device_id, false);
+  read->done = true;
+  if (read->refs > 1)
+  {
+    read->value = device_queue_copy_value (value);
+    pthread_cond_broadcast (&list->done);
+  }
+  device_queue_unref_read_locked (list, queue, read);
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Wait for a read sent by another thread, returning a copy of its value */
+BACNET_APPLICATION_DATA_VALUE *device_queue_wait_read (device_queue_ll *list, uint32_t device_id,
+                                                       device_read_t *read)
+{
+  pthread_mutex_lock (&list->mutex);
+  while (!read->done)
+  {
+    pthread_cond_wait (&list->done, &list->mutex);
+  }
+  BACNET_APPLICATION_DATA_VALUE *value = device_queue_copy_value (read->value);
+  device_queue_unref_read_locked (list, device_queue_get_locked (list, device_id, false), read);
+  pthread_mutex_unlock (&list->mutex);
+  return value;
+}
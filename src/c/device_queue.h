@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <bacdef.h>
+#include <bacapp.h>
+
+#ifndef DEVICE_BACNET_C_DEVICE_QUEUE_H
+#define DEVICE_BACNET_C_DEVICE_QUEUE_H
+
+#define DEVICE_QUEUE_BUCKETS 1024
+
+/* A read in progress, which identical reads of the same device wait for */
+typedef struct device_read_t
+{
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  BACNET_PROPERTY_ID property;
+  uint32_t index;
+  /* Threads using the read, including the one sending it */
+  uint32_t refs;
+  bool done;
+  /* Result of the read, NULL if it failed */
+  BACNET_APPLICATION_DATA_VALUE *value;
+  struct device_read_t *next;
+} device_read_t;
+
+/* Requests in progress to one device */
+typedef struct device_queue_t
+{
+  uint32_t device_id;
+  /* Number of requests sent or waiting to be sent */
+  uint32_t depth;
+  device_read_t *reads;
+  /* Next entry in the same hash bucket */
+  struct device_queue_t *next;
+} device_queue_t;
+
+/* Hash table of devices with requests in progress */
+typedef struct device_queue_ll
+{
+  device_queue_t *buckets[DEVICE_QUEUE_BUCKETS];
+  /* Maximum number of requests in progress to each device */
+  uint32_t max_depth;
+  pthread_mutex_t mutex;
+  /* Signalled whenever a read completes */
+  pthread_cond_t done;
+} device_queue_ll;
+
+device_queue_ll *device_queue_alloc (uint32_t max_depth);
+
+void device_queue_free (device_queue_ll *list);
+
+void device_queue_set_depth (device_queue_ll *list, uint32_t max_depth);
+
+bool device_queue_enter (device_queue_ll *list, uint32_t device_id);
+
+void device_queue_leave (device_queue_ll *list, uint32_t device_id);
+
+device_read_t *device_queue_join_read (device_queue_ll *list, uint32_t device_id,
+                                       BACNET_OBJECT_TYPE type, uint32_t instance,
+                                       BACNET_PROPERTY_ID property, uint32_t index,
+                                       bool *leader);
+
+void device_queue_finish_read (device_queue_ll *list, uint32_t device_id, device_read_t *read,
+                               const BACNET_APPLICATION_DATA_VALUE *value);
+
+BACNET_APPLICATION_DATA_VALUE *device_queue_wait_read (device_queue_ll *list, uint32_t device_id,
+                                                       device_read_t *read);
+
+#endif //DEVICE_BACNET_C_DEVICE_QUEUE_H
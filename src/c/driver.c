@@ -37,8 +37,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <time.h>       /* for time */
+#include <sched.h>
 #include <iot/logger.h>
 #include <bacapp.h>
 #include "rs485.h"
@@ -54,12 +56,36 @@
 #include "address.h"
 #include "npdu.h"
 #include "apdu.h"
+#include "bacint.h"
 #include "device.h"
 #include "net.h"
 #include "datalink.h"
 #include "whois.h"
+#include "whohas.h"
+#include "ihave.h"
+#include "cov.h"
+#include "event.h"
+#include "getevent.h"
+#include "readrange.h"
+#include "lighting.h"
 #include "device_condition_map.h"
 #include "return_data.h"
+#include "request_executor.h"
+#include "device_queue.h"
+#include "token_bucket.h"
+#include "deadline.h"
+#include "hash.h"
+#include "rtt_table.h"
+#include "circuit_breaker.h"
+#include "value_cache.h"
+#include "frame_queue.h"
+#include "stats.h"
+#ifdef BACDL_BIP
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "bip_endpoint.h"
+#endif
 /* some demo stuff needed */
 #include "filename.h"
 #include "handlers.h"
@@ -79,6 +105,135 @@ static device_condition_map_ll *deviceCondtionMapHead;
 /* Empty address table */
 static address_entry_ll *addressEntryHead;
 
+/* Cached table of routers to remote networks */
+static router_table_ll *routerTable;
+
+/* Address bindings of devices, used in place of the stack's fixed size address cache */
+static binding_table_t *bindingTable;
+
+/* Devices whose binding gave up at a deadline before their I-Am arrived,
+ * which are bound when it does
+ */
+static binding_table_t *pendingBinds;
+
+/* Executors owning the confirmed requests to each port and network */
+static request_executor_ll *requestExecutors;
+
+static bool send_request (return_data_t *data);
+static bool send_pdu (BACNET_ADDRESS *dest, BACNET_NPDU_DATA *npdu_data,
+                      uint8_t *pdu, unsigned pdu_len);
+
+/* Cached mapping of object names to object identifiers */
+static object_name_map_ll *objectNameMap;
+
+/* Requests in progress to each device, bounded by the configured queue depth */
+static device_queue_ll *deviceQueues;
+
+/* Budgets of the traffic sent on the datalink, and of broadcasts through a BBMD */
+static token_bucket_t datalinkBucket;
+static token_bucket_t bbmdBucket;
+
+/* Round trip times of devices, which set their request timeouts */
+static rtt_table_ll *rttTable;
+
+/* Circuit breakers failing requests to devices that have stopped responding */
+static circuit_breaker_ll *circuitBreakers;
+
+/* Last known good values of properties, when stale values may be served */
+static value_cache_ll *valueCache;
+
+/* Handler of the COV notifications received, or NULL */
+static bacnet_cov_handler_t covHandler;
+static void *covContext;
+
+/* Handler of the event notifications received, or NULL */
+static bacnet_event_handler_t eventHandler;
+static void *eventContext;
+
+/* Process identifier of the service in the notification classes it registers with */
+#define EVENT_PROCESS_ID 1
+
+#ifndef MAX_COV_PROPERTIES
+#define MAX_COV_PROPERTIES 2
+#endif
+
+/* Bytes of a ReadRange ACK besides its records, and the most a log record
+ * with a primitive value takes, to size the records asked for
+ */
+#define READ_RANGE_ACK_OVERHEAD 32
+#define LOG_RECORD_MAX_SIZE 32
+
+/* Bytes of a ReadProperty ACK for a whole object list besides its object
+ * identifiers, and the bytes each identifier takes
+ */
+#define OBJECT_LIST_ACK_OVERHEAD 16
+#define OBJECT_ID_SIZE 5
+
+/* Milliseconds to wait for I-Am responses when binding and in discovery, 0
+ * for the transaction timeout, and for MS/TP frames in the datalink thread.
+ * These may change while the driver runs.
+ */
+static uint32_t whoIsTimeout;
+static uint32_t discoveryTimeout;
+static uint32_t receiveTimeout = DEFAULT_RECEIVE_TIMEOUT;
+
+/* Thread decoding the frames received from a subset of peers */
+typedef struct decode_worker_t
+{
+  pthread_t thread;
+  frame_queue_t *queue;
+} decode_worker_t;
+
+/* Decode workers, with frames from the same source always going to the same worker */
+static decode_worker_t *decodeWorkers;
+static uint32_t decodeWorkerCount;
+static bool decodeRunning;
+
+/* Serializes the stack's server handlers, which share its transmit buffer */
+static pthread_mutex_t stackMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Whether initialization completed and started the datalink thread */
+static bool datalinkStarted = false;
+
+#ifdef BACDL_BIP
+/* UDP endpoints for each BACnet/IP port in use */
+static bip_endpoint_ll *bipEndpoints;
+
+/* Set when broadcasts must be distributed by a BBMD rather than sent locally */
+static bool bbmdActive;
+
+/* Epoll instance the datalink thread waits on, and an eventfd to wake it */
+static int datalinkEpoll = -1;
+static int datalinkEvent = -1;
+
+#define MAX_DATALINK_EVENTS 32
+
+/* Messages read by the datalink thread in one batch */
+static bip_frame_t rxFrames[BIP_RECEIVE_BATCH];
+#endif
+
+/* Find the request a response from a device is for and take it out of
+ * flight for the response to be stored, measuring the device's round trip
+ * time if the request was sent only once. Returns NULL if there is no such
+ * request, or it has already timed out or been answered.
+ */
+static return_data_t *claim_response (BACNET_ADDRESS *src, uint8_t invoke_id)
+{
+  return_data_t *data = return_data_claim (returnDataHead, src, invoke_id, request_executor_claim);
+  if (data == NULL)
+  {
+    return NULL;
+  }
+  uint64_t now = stats_now ();
+  data->responded = true;
+  if (!data->retransmitted)
+  {
+    rtt_table_sample (rttTable, data->deviceInstance, now - data->sent);
+  }
+  rtt_table_heard (rttTable, data->deviceInstance, now);
+  return data;
+}
+
 /* Error handler for BACnet requests */
 static void MyErrorHandler (
   BACNET_ADDRESS *src,
@@ -86,24 +241,18 @@ static void MyErrorHandler (
   BACNET_ERROR_CLASS error_class,
   BACNET_ERROR_CODE error_code)
 {
-  /* Find the return data struct matching the given invoke id */
-  return_data_t *data = return_data_get (returnDataHead, invoke_id);
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *data = claim_response (src, invoke_id);
   if (data != NULL)
   {
-    /* Check that the addresses match */
-    if (address_match (&data->targetAddress, src))
-    {
-      /* Print the error code*/
-      iot_log_error (lc, "BACnet Error: %s: %s",
-                     bactext_error_class_name ((unsigned) error_class),
-                     bactext_error_code_name ((unsigned) error_code));
+    /* Print the error code*/
+    iot_log_error (lc, "BACnet Error: %s: %s",
+                   bactext_error_class_name ((unsigned) error_class),
+                   bactext_error_code_name ((unsigned) error_code));
 
-      /* Set the error detected variable to be true */
-      data->errorDetected = true;
-    }
-    pthread_mutex_lock (&data->mutex);
-    pthread_cond_signal (&data->condition);
-    pthread_mutex_unlock (&data->mutex);
+    /* Set the error detected variable to be true */
+    data->errorDetected = true;
+    return_data_complete (data);
   }
 }
 
@@ -116,24 +265,17 @@ static void MyAbortHandler (
 {
   (void) server;
 
-  /* Find the return data struct matching the given invoke id */
-  return_data_t *data = return_data_get (returnDataHead, invoke_id);
-
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *data = claim_response (src, invoke_id);
   if (data != NULL)
   {
-    /* Check that the addresses match */
-    if (address_match (&data->targetAddress, src))
-    {
-      /* Print the abort reason */
-      iot_log_error (lc, "BACnet Abort: %s",
-                     bactext_abort_reason_name ((int) abort_reason));
+    /* Print the abort reason */
+    iot_log_error (lc, "BACnet Abort: %s",
+                   bactext_abort_reason_name ((int) abort_reason));
 
-      /* Set the error detected variable to be true */
-      data->errorDetected = true;
-    }
-    pthread_mutex_lock (&data->mutex);
-    pthread_cond_signal (&data->condition);
-    pthread_mutex_unlock (&data->mutex);
+    /* Set the error detected variable to be true */
+    data->errorDetected = true;
+    return_data_complete (data);
   }
 }
 
@@ -143,27 +285,51 @@ static void MyRejectHandler (
   uint8_t invoke_id,
   uint8_t reject_reason)
 {
-  /* Find the return data struct matching the given invoke id */
-  return_data_t *data = return_data_get (returnDataHead, invoke_id);
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *data = claim_response (src, invoke_id);
   if (data != NULL)
   {
-    /* Check that the addresses match */
-    if (address_match (&data->targetAddress, src))
-    {
-      /* Print the reject reason */
-      iot_log_error (lc, "BACnet Reject: %s",
-                     bactext_reject_reason_name ((int) reject_reason));
+    /* Print the reject reason */
+    iot_log_error (lc, "BACnet Reject: %s",
+                   bactext_reject_reason_name ((int) reject_reason));
 
-      /* Set the error detected variable to be true */
-      data->errorDetected = true;
+    /* Set the error detected variable to be true */
+    data->errorDetected = true;
+    return_data_complete (data);
+  }
+}
+
+/* Object identifiers of a whole object list, decoded by the ReadProperty ACK handler */
+typedef struct object_list_t
+{
+  BACNET_OBJECT_ID *objects;
+  uint32_t count;
+  uint32_t found;
+} object_list_t;
+
+/* Decode the object identifiers of a whole object list, failing if there are
+ * more than were expected
+ */
+static bool decode_object_list (BACNET_READ_PROPERTY_DATA *data, object_list_t *list)
+{
+  BACNET_APPLICATION_DATA_VALUE value;
+  int len = 0;
+  while (len < data->application_data_len)
+  {
+    int value_len = bacapp_decode_application_data (&data->application_data[len],
+                                                    (unsigned) (data->application_data_len - len), &value);
+    if (value_len <= 0 || value.tag != BACNET_APPLICATION_TAG_OBJECT_ID || list->found == list->count)
+    {
+      return false;
     }
-    pthread_mutex_lock (&data->mutex);
-    pthread_cond_signal (&data->condition);
-    pthread_mutex_unlock (&data->mutex);
+    list->objects[list->found++] = value.type.Object_Id;
+    len += value_len;
   }
+  return true;
 }
 
-/** Handler for a ReadProperty ACK.
+/** Handler for a ReadProperty ACK. A request waited for with an object list
+ * as its context has the object identifiers decoded into it.
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
  * @param src [in] BACNET_ADDRESS of the source of the message
@@ -178,32 +344,34 @@ static void My_Read_Property_Ack_Handler (
 {
   BACNET_READ_PROPERTY_DATA data;
 
-  /* Find the return data struct matching the given invoke id */
-  return_data_t *ret = return_data_get (returnDataHead,
-                                        service_data->invoke_id);
-  /* If a return data struct was found */
-  if (ret != NULL && ret->value == NULL)
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, service_data->invoke_id);
+  /* If a return data struct was found, and is still waiting for its response */
+  if (ret != NULL)
   {
-    pthread_mutex_lock (&ret->mutex);
-    /* Check that the addresses match */
-    if (src && address_match (&ret->targetAddress, src))
-    {
-      /* Decode the service request */
-      int len =
-        rp_ack_decode_service_request (service_request, service_len, &data);
+    /* Decode the service request */
+    int len =
+      rp_ack_decode_service_request (service_request, service_len, &data);
+    object_list_t *list = ret->callback ? NULL : (object_list_t *) ret->context;
 
-      /* If the service length decoding was successful */
-      if (len > 0)
+    if (list)
+    {
+      if (len <= 0 || !decode_object_list (&data, list))
       {
-        /* Decode the application data */
-        ret->value = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
-        bacapp_decode_application_data (data.application_data,
-                                        (uint8_t) data.application_data_len,
-                                        ret->value);
+        iot_log_error (lc, "Received ReadProperty ACK, but unable to decode the object list.");
+        ret->errorDetected = true;
       }
     }
-    pthread_cond_signal (&ret->condition);
-    pthread_mutex_unlock (&ret->mutex);
+    /* If the service length decoding was successful */
+    else if (len > 0)
+    {
+      /* Decode the application data */
+      ret->value = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
+      bacapp_decode_application_data (data.application_data,
+                                      (uint8_t) data.application_data_len,
+                                      ret->value);
+    }
+    return_data_complete (ret);
   }
 }
 
@@ -229,25 +397,39 @@ static void my_i_am_handler (
     /* If the decoding of the service request was successful */
     iot_log_debug (lc, "Processing I-Am Request from %lu",
                    (unsigned long) device_id);
+    rtt_table_heard (rttTable, device_id, stats_now ());
+    /* A device on a remote network is reached through the router that forwarded the I-Am */
+    if (src->net != 0 && src->net != BACNET_BROADCAST_NETWORK)
+    {
+      router_table_set (routerTable, src->net, src);
+    }
     /* If address is in address table, e.g. have already been sent read/write request */
     device_condition_map_t *map = device_condition_map_get (deviceCondtionMapHead,
                                                             device_id);
     if (map != NULL)
     {
-      /* If the address length is 0, the device should be bound to */
-      if (map->address->mac_len == 0)
-      {
-        /* Bind to the device */
-        address_add_binding (device_id, max_apdu, src);
-      }
+      /* Bind to the device */
+      binding_table_set (bindingTable, device_id, max_apdu, src);
       pthread_mutex_lock (&map->mutex);
       pthread_cond_signal (&map->condition);
       pthread_mutex_unlock (&map->mutex);
     }
     else
     {
+      BACNET_ADDRESS pending;
+      unsigned pending_apdu;
       /* Add the device to the address table */
       address_entry_set (addressEntryHead, device_id, max_apdu, src);
+      /* Bind the device if a bind gave up waiting for it, or refresh its binding */
+      if (binding_table_get (pendingBinds, device_id, &pending_apdu, &pending))
+      {
+        binding_table_remove (pendingBinds, device_id);
+        binding_table_set (bindingTable, device_id, max_apdu, src);
+      }
+      else
+      {
+        binding_table_update (bindingTable, device_id, max_apdu, src);
+      }
     }
     return;
   }
@@ -259,19 +441,372 @@ static void MyWritePropertySimpleAckHandler (
   BACNET_ADDRESS *src,
   uint8_t invoke_id)
 {
-  /* Find the return data struct matching the given invoke id */
-  return_data_t *ret = return_data_get (returnDataHead, invoke_id);
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, invoke_id);
+  if (ret != NULL)
+  {
+    iot_log_debug (lc, "WriteProperty Acknowledged!");
+    return_data_complete (ret);
+  }
+}
+
+/* SubscribeCOV handler for BACnet requests */
+static void MySubscribeCOVSimpleAckHandler (
+  BACNET_ADDRESS *src,
+  uint8_t invoke_id)
+{
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, invoke_id);
+  if (ret != NULL)
+  {
+    iot_log_debug (lc, "SubscribeCOV Acknowledged!");
+    return_data_complete (ret);
+  }
+}
+
+/* AddListElement handler for BACnet requests */
+static void MyAddListElementSimpleAckHandler (
+  BACNET_ADDRESS *src,
+  uint8_t invoke_id)
+{
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, invoke_id);
+  if (ret != NULL)
+  {
+    iot_log_debug (lc, "AddListElement Acknowledged!");
+    return_data_complete (ret);
+  }
+}
+
+/* Event summaries of a GetEventInformation request, decoded by its ACK handler */
+typedef struct event_information_t
+{
+  BACNET_GET_EVENT_INFORMATION_DATA *summaries;
+  bool more;
+} event_information_t;
+
+/** Handler for a GetEventInformation ACK, decoding the summaries into the
+ * context of the request waiting for them.
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ * @param src [in] BACNET_ADDRESS of the source of the message
+ * @param service_data [in] The BACNET_CONFIRMED_SERVICE_DATA information
+ *                          decoded from the APDU header of this message.
+ */
+static void My_Get_Event_Information_Ack_Handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_ACK_DATA *service_data)
+{
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, service_data->invoke_id);
+  if (ret != NULL)
+  {
+    /* Only a request waited for has summaries to decode into */
+    event_information_t *info = ret->callback ? NULL : (event_information_t *) ret->context;
+    if (info == NULL ||
+        getevent_ack_decode_service_request (service_request, service_len, info->summaries,
+                                             &info->more) <= 0)
+    {
+      iot_log_error (lc, "Received GetEventInformation ACK, but unable to decode it.");
+      ret->errorDetected = true;
+    }
+    return_data_complete (ret);
+  }
+}
+
+/* Log records of a ReadRange request, decoded by its ACK handler */
+typedef struct read_range_t
+{
+  bacnet_log_record_t *records;
+  unsigned count;
+  unsigned found;
+  bool more;
+} read_range_t;
+
+/* Decode the tag at the start of a buffer, returning the length of the tag or
+ * -1 if it does not fit. The value is not checked.
+ */
+static int decode_tag_within (uint8_t *apdu, int apdu_len, uint8_t *tag, uint32_t *lvt)
+{
+  int len = 1;
+  if (apdu_len < 1)
+  {
+    return -1;
+  }
+  /* Extended tag number */
+  if ((apdu[0] & 0xF0) == 0xF0)
+  {
+    len++;
+  }
+  /* Extended length, except for opening and closing tags */
+  if ((apdu[0] & 0x07) == 5)
+  {
+    if (len >= apdu_len)
+    {
+      return -1;
+    }
+    len += (apdu[len] == 254) ? 3 : (apdu[len] == 255) ? 5 : 1;
+  }
+  if (len > apdu_len)
+  {
+    return -1;
+  }
+  return decode_tag_number_and_value (apdu, tag, lvt);
+}
+
+/* Check for an application tag of a type and the 4 byte value following it,
+ * returning the length of the tag or -1
+ */
+static int decode_application_tag_within (uint8_t *apdu, int apdu_len, uint8_t type)
+{
+  uint8_t tag;
+  uint32_t lvt;
+  int len = decode_tag_within (apdu, apdu_len, &tag, &lvt);
+  if (len < 0 || IS_CONTEXT_SPECIFIC (apdu[0]) || tag != type || lvt != 4 || len + 4 > apdu_len)
+  {
+    return -1;
+  }
+  return len;
+}
+
+/* Return the length of a constructed value starting at its opening tag, or -1 */
+static int skip_constructed (uint8_t *apdu, int apdu_len)
+{
+  int len = 0;
+  int depth = 0;
+  do
+  {
+    uint8_t tag;
+    uint32_t lvt;
+    if (len >= apdu_len)
+    {
+      return -1;
+    }
+    bool context = IS_CONTEXT_SPECIFIC (apdu[len]);
+    bool opening = decode_is_opening_tag (&apdu[len]);
+    bool closing = decode_is_closing_tag (&apdu[len]);
+    int header = decode_tag_within (&apdu[len], apdu_len - len, &tag, &lvt);
+    if (header < 0)
+    {
+      return -1;
+    }
+    len += header;
+    if (opening)
+    {
+      depth++;
+    }
+    else if (closing)
+    {
+      depth--;
+    }
+    /* An application boolean holds its value in the tag */
+    else if (context || tag != BACNET_APPLICATION_TAG_BOOLEAN)
+    {
+      if (lvt > (uint32_t) (apdu_len - len))
+      {
+        return -1;
+      }
+      len += (int) lvt;
+    }
+  } while (depth > 0);
+  return (len <= apdu_len) ? len : -1;
+}
+
+/* Decode a BACnetLogRecord, returning its length or -1 */
+static int decode_log_record (uint8_t *apdu, int apdu_len, bacnet_log_record_t *record)
+{
+  uint8_t tag;
+  uint32_t lvt;
+  int len = 0;
+
+  memset (record, 0, sizeof (bacnet_log_record_t));
+
+  /* timestamp [0] BACnetDateTime */
+  if (apdu_len < 2 || !decode_is_opening_tag_number (&apdu[len], 0))
+  {
+    return -1;
+  }
+  len++;
+  int header = decode_application_tag_within (&apdu[len], apdu_len - len, BACNET_APPLICATION_TAG_DATE);
+  if (header < 0)
+  {
+    return -1;
+  }
+  len += header;
+  len += decode_date (&apdu[len], &record->timestamp.date);
+  header = decode_application_tag_within (&apdu[len], apdu_len - len, BACNET_APPLICATION_TAG_TIME);
+  if (header < 0)
+  {
+    return -1;
+  }
+  len += header;
+  len += decode_bacnet_time (&apdu[len], &record->timestamp.time);
+  if (len >= apdu_len || !decode_is_closing_tag_number (&apdu[len], 0))
+  {
+    return -1;
+  }
+  len++;
+
+  /* logDatum [1] CHOICE */
+  if (len >= apdu_len || !decode_is_opening_tag_number (&apdu[len], 1))
+  {
+    return -1;
+  }
+  len++;
+  if (len >= apdu_len)
+  {
+    return -1;
+  }
+  if (decode_is_opening_tag (&apdu[len]))
+  {
+    /* failure [8] and any-value [10] are not taken as values */
+    int skipped = skip_constructed (&apdu[len], apdu_len - len);
+    if (skipped < 0)
+    {
+      return -1;
+    }
+    len += skipped;
+  }
+  else
+  {
+    BACNET_APPLICATION_DATA_VALUE *value = &record->value;
+    header = decode_tag_within (&apdu[len], apdu_len - len, &tag, &lvt);
+    if (header < 0)
+    {
+      return -1;
+    }
+    len += header;
+    if (lvt > (uint32_t) (apdu_len - len))
+    {
+      return -1;
+    }
+    record->hasValue = true;
+    switch (tag)
+    {
+      case 1:
+        value->tag = BACNET_APPLICATION_TAG_BOOLEAN;
+        value->type.Boolean = lvt && apdu[len] != 0;
+        break;
+      case 2:
+        value->tag = BACNET_APPLICATION_TAG_REAL;
+        decode_real (&apdu[len], &value->type.Real);
+        break;
+      case 3:
+        value->tag = BACNET_APPLICATION_TAG_ENUMERATED;
+        decode_enumerated (&apdu[len], lvt, &value->type.Enumerated);
+        break;
+      case 4:
+        value->tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+        decode_unsigned (&apdu[len], lvt, &value->type.Unsigned_Int);
+        break;
+      case 5:
+        value->tag = BACNET_APPLICATION_TAG_SIGNED_INT;
+        decode_signed (&apdu[len], lvt, &value->type.Signed_Int);
+        break;
+      case 6:
+        value->tag = BACNET_APPLICATION_TAG_BIT_STRING;
+        decode_bitstring (&apdu[len], lvt, &value->type.Bit_String);
+        break;
+      default:
+        /* log-status [0], null [7] and time-change [9] */
+        record->hasValue = false;
+        break;
+    }
+    len += (int) lvt;
+  }
+  if (len >= apdu_len || !decode_is_closing_tag_number (&apdu[len], 1))
+  {
+    return -1;
+  }
+  len++;
+
+  /* statusFlags [2] OPTIONAL */
+  if (len < apdu_len && decode_is_context_tag (&apdu[len], 2) && !decode_is_closing_tag (&apdu[len]))
+  {
+    header = decode_tag_within (&apdu[len], apdu_len - len, &tag, &lvt);
+    if (header < 0)
+    {
+      return -1;
+    }
+    len += header;
+    if (lvt > (uint32_t) (apdu_len - len))
+    {
+      return -1;
+    }
+    decode_bitstring (&apdu[len], lvt, &record->status);
+    record->hasStatus = true;
+    len += (int) lvt;
+  }
+  return len;
+}
+
+/* Decode the log records of a ReadRange ACK. Returns false if they are not
+ * the records of a log buffer.
+ */
+static bool decode_log_records (BACNET_READ_RANGE_DATA *data, read_range_t *range)
+{
+  int len = 0;
+
+  range->found = 0;
+  range->more = bitstring_bit (&data->ResultFlags, RESULT_FLAG_MORE_ITEMS);
+  /* Only lists with sequence numbers have a first sequence number */
+  if (data->ItemCount && data->FirstSequence == 0)
+  {
+    return false;
+  }
+  while (range->found < data->ItemCount && range->found < range->count)
+  {
+    int record_len = decode_log_record (&data->application_data[len], data->application_data_len - len,
+                                        &range->records[range->found]);
+    if (record_len < 0)
+    {
+      return false;
+    }
+    range->records[range->found].sequence = data->FirstSequence + range->found;
+    range->found++;
+    len += record_len;
+  }
+  /* Records that did not fit are read again by the next request */
+  if (range->found < data->ItemCount)
+  {
+    range->more = true;
+  }
+  return true;
+}
+
+/** Handler for a ReadRange ACK, decoding the log records into the context of
+ * the request waiting for them.
+ * @param service_request [in] The contents of the service request.
+ * @param service_len [in] The length of the service_request.
+ * @param src [in] BACNET_ADDRESS of the source of the message
+ * @param service_data [in] The BACNET_CONFIRMED_SERVICE_DATA information
+ *                          decoded from the APDU header of this message.
+ */
+static void My_Read_Range_Ack_Handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_ACK_DATA *service_data)
+{
+  BACNET_READ_RANGE_DATA data;
 
+  /* Find the return data struct matching the given device and invoke id */
+  return_data_t *ret = claim_response (src, service_data->invoke_id);
   if (ret != NULL)
   {
-    pthread_mutex_lock (&ret->mutex);
-    /* Check that the addresses match */
-    if (src && address_match (&ret->targetAddress, src))
+    /* Only a request waited for has records to decode into */
+    read_range_t *range = ret->callback ? NULL : (read_range_t *) ret->context;
+    memset (&data, 0, sizeof (data));
+    if (range == NULL ||
+        rr_ack_decode_service_request (service_request, service_len, &data) <= 0 ||
+        !decode_log_records (&data, range))
     {
-      iot_log_debug (lc, "WriteProperty Acknowledged!");
+      iot_log_error (lc, "Received ReadRange ACK, but unable to decode it.");
+      ret->errorDetected = true;
     }
-    pthread_cond_signal (&ret->condition);
-    pthread_mutex_unlock (&ret->mutex);
+    return_data_complete (ret);
   }
 }
 
@@ -423,17 +958,27 @@ bacnet_write_access_data_add (BACNET_WRITE_ACCESS_DATA *head,
   return data;
 }
 
-/* Populates the BACNET_READ_ACCESS_DATA structure to be used for reading */
+/* Populates the BACNET_READ_ACCESS_DATA structure to be used for reading,
+ * resolving object names before the deadline if it is not NULL
+ */
 bool
 read_access_data_populate (BACNET_READ_ACCESS_DATA **head, uint32_t nreadings,
                            const devsdk_commandrequest *requests,
-                           bacnet_driver *driver)
+                           const bacnet_address_t *addr,
+                           bacnet_driver *driver, const struct timespec *deadline)
 {
   /* Traverse the requested readings */
   for (uint32_t i = 0; i < nreadings; i++)
   {
     bacnet_attributes_t *attrs = (bacnet_attributes_t *)requests[i].resource->attrs;
-    *head = bacnet_read_access_data_add (*head, attrs->type, attrs->property, attrs->instance, attrs->index);
+    uint32_t instance = attrs->instance;
+    /* Objects referenced by name are resolved to their instance */
+    if (attrs->name && !bacnet_resolve_object_name_within (addr, attrs->type, attrs->name, &instance, deadline))
+    {
+      read_access_data_free (*head);
+      return false;
+    }
+    *head = bacnet_read_access_data_add (*head, attrs->type, attrs->property, instance, attrs->index);
   }
   return true;
 }
@@ -483,6 +1028,24 @@ void devsdk_commandresult_populate (devsdk_commandresult *readings,
       case BACNET_APPLICATION_TAG_DOUBLE:
         readings[i].value = iot_data_alloc_f64 (deviceReading->type.Double);
         break;
+      case BACNET_APPLICATION_TAG_ENUMERATED:
+        readings[i].value = iot_data_alloc_ui32 (deviceReading->type.Enumerated);
+        break;
+      case BACNET_APPLICATION_TAG_BIT_STRING:
+      {
+        /* Bits from the first, as the least significant */
+        uint32_t bits = 0;
+        uint8_t used = bitstring_bits_used (&deviceReading->type.Bit_String);
+        for (uint8_t bit = 0; bit < used && bit < 32; bit++)
+        {
+          if (bitstring_bit (&deviceReading->type.Bit_String, bit))
+          {
+            bits |= 1u << bit;
+          }
+        }
+        readings[i].value = iot_data_alloc_ui32 (bits);
+        break;
+      }
       default:
         break;
     }
@@ -492,10 +1055,154 @@ void devsdk_commandresult_populate (devsdk_commandresult *readings,
   }
 }
 
-bool
-write_access_data_populate (BACNET_WRITE_ACCESS_DATA **head, uint32_t nvalues,
-                            const devsdk_commandrequest *requests,
-                            const iot_data_t *values[],
+/* Value of a number in a map, or dfl if absent or not a number */
+static double map_number (const iot_data_t *map, const char *name, double dfl)
+{
+  const iot_data_t *elem = iot_data_string_map_get (map, name);
+  if (elem && iot_data_type (elem) == IOT_DATA_FLOAT64)
+  {
+    return iot_data_f64 (elem);
+  }
+  if (elem && iot_data_type (elem) == IOT_DATA_INT64)
+  {
+    return (double) iot_data_i64 (elem);
+  }
+  return dfl;
+}
+
+/* Convert a map with an operation, and optionally a level, rampRate,
+ * stepIncrement, fadeTime and priority, to a lighting command
+ */
+static bool lighting_command_from_data (const iot_data_t *data, BACNET_LIGHTING_COMMAND *command,
+                                        iot_logger_t *lc)
+{
+  static const char *operations[] =
+  {
+    "none", "fade-to", "ramp-to", "step-up", "step-down", "step-on", "step-off",
+    "warn", "warn-off", "warn-relinquish", "stop"
+  };
+  const iot_data_t *operation = iot_data_string_map_get (data, "operation");
+  int op = -1;
+
+  if (operation && iot_data_type (operation) == IOT_DATA_STRING)
+  {
+    for (int i = 0; i < (int) (sizeof (operations) / sizeof (operations[0])); i++)
+    {
+      if (strcmp (iot_data_string (operation), operations[i]) == 0)
+      {
+        op = i;
+      }
+    }
+  }
+  else if (operation && iot_data_type (operation) == IOT_DATA_INT64)
+  {
+    op = (int) iot_data_i64 (operation);
+  }
+  if (op < 0)
+  {
+    iot_log_error (lc, "A lighting command requires a valid operation");
+    return false;
+  }
+
+  memset (command, 0, sizeof (BACNET_LIGHTING_COMMAND));
+  command->operation = op;
+  command->use_target_level = iot_data_string_map_get (data, "level") != NULL;
+  command->target_level = (float) map_number (data, "level", 0);
+  command->use_ramp_rate = iot_data_string_map_get (data, "rampRate") != NULL;
+  command->ramp_rate = (float) map_number (data, "rampRate", 0);
+  command->use_step_increment = iot_data_string_map_get (data, "stepIncrement") != NULL;
+  command->step_increment = (float) map_number (data, "stepIncrement", 0);
+  command->use_fade_time = iot_data_string_map_get (data, "fadeTime") != NULL;
+  command->fade_time = (uint32_t) map_number (data, "fadeTime", 0);
+  command->use_priority = iot_data_string_map_get (data, "priority") != NULL;
+  command->priority = (uint8_t) map_number (data, "priority", 0);
+  return true;
+}
+
+/* Convert a value to be written to BACnet application data. Returns false if
+ * its type is not accepted.
+ */
+bool bacnet_value_from_data (const iot_data_t *data, BACNET_APPLICATION_DATA_VALUE *value, iot_logger_t *lc)
+{
+  memset (value, 0, sizeof (BACNET_APPLICATION_DATA_VALUE));
+  /* Set the application tag to be the correct type */
+  switch (iot_data_type(data))
+  {
+    case IOT_DATA_BOOL:
+      iot_log_debug (lc, "Bool");
+      value->tag = BACNET_APPLICATION_TAG_BOOLEAN;
+      value->type.Boolean = iot_data_bool (data);
+      break;
+    case IOT_DATA_STRING:
+      iot_log_debug (lc, "String");
+      value->tag = BACNET_APPLICATION_TAG_CHARACTER_STRING;
+      characterstring_init_ansi (
+        &value->type.Character_String,
+        iot_data_string (data));
+      break;
+    case IOT_DATA_UINT8:
+      iot_log_debug (lc, "Uint8");
+      value->tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+      value->type.Unsigned_Int = iot_data_ui8 (data);
+      break;
+    case IOT_DATA_UINT16:
+      iot_log_debug (lc, "Uint16");
+      value->tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+      value->type.Unsigned_Int = iot_data_ui16 (data);
+      break;
+    case IOT_DATA_UINT32:
+      iot_log_debug (lc, "Uint32");
+      value->tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+      value->type.Unsigned_Int = iot_data_ui32 (data);
+      break;
+    case IOT_DATA_UINT64:
+      iot_log_debug (lc, "Uint64 is not supported");
+      break;
+    case IOT_DATA_INT8:
+      iot_log_debug (lc, "Int8");
+      value->tag = BACNET_APPLICATION_TAG_SIGNED_INT;
+      value->type.Signed_Int = iot_data_i8 (data);
+      break;
+    case IOT_DATA_INT16:
+      iot_log_debug (lc, "Int16");
+      value->tag = BACNET_APPLICATION_TAG_SIGNED_INT;
+      value->type.Signed_Int = iot_data_i16 (data);
+      break;
+    case IOT_DATA_INT32:
+      iot_log_debug (lc, "Int32");
+      value->tag = BACNET_APPLICATION_TAG_SIGNED_INT;
+      value->type.Signed_Int = iot_data_i32 (data);
+      break;
+    case IOT_DATA_INT64:
+      iot_log_debug (lc, "Int64 is not supported");
+      break;
+    case IOT_DATA_FLOAT32:
+      iot_log_debug (lc, "Float32");
+      value->tag = BACNET_APPLICATION_TAG_REAL;
+      value->type.Real = iot_data_f32 (data);
+      break;
+    case IOT_DATA_FLOAT64:
+      iot_log_debug (lc, "Float64");
+      value->tag = BACNET_APPLICATION_TAG_DOUBLE;
+      value->type.Double = iot_data_f64 (data);
+      break;
+    case IOT_DATA_MAP:
+      iot_log_debug (lc, "Lighting command");
+      value->tag = BACNET_APPLICATION_TAG_LIGHTING_COMMAND;
+      return lighting_command_from_data (data, &value->type.Lighting_Command, lc);
+    default:
+      iot_log_error (lc,
+                     "The value type %s is not accepted", iot_data_type_name(data));
+      return false;
+  }
+  return true;
+}
+
+bool
+write_access_data_populate (BACNET_WRITE_ACCESS_DATA **head, uint32_t nvalues,
+                            const devsdk_commandrequest *requests,
+                            const iot_data_t *values[],
+                            const bacnet_address_t *addr,
                             bacnet_driver *driver)
 {
   uint8_t priority = 1;
@@ -505,76 +1212,21 @@ write_access_data_populate (BACNET_WRITE_ACCESS_DATA **head, uint32_t nvalues,
     /* Get attributes from profile */
     bacnet_attributes_t *attrs = (bacnet_attributes_t *)requests[i].resource->attrs;
 
-    BACNET_APPLICATION_DATA_VALUE value = {0};
-    /* Convert the value to a string, and set application tag to be the correct type */
-    switch (iot_data_type(values[i]))
+    BACNET_APPLICATION_DATA_VALUE value;
+    if (!bacnet_value_from_data (values[i], &value, driver->lc))
     {
-      case IOT_DATA_BOOL:
-        iot_log_debug (driver->lc, "Bool");
-        value.tag = BACNET_APPLICATION_TAG_BOOLEAN;
-        value.type.Boolean = iot_data_bool (values[i]);
-        break;
-      case IOT_DATA_STRING:
-        iot_log_debug (driver->lc, "String");
-        value.tag = BACNET_APPLICATION_TAG_CHARACTER_STRING;
-        characterstring_init_ansi (
-          &value.type.Character_String,
-          iot_data_string (values[i]));
-        break;
-      case IOT_DATA_UINT8:
-        iot_log_debug (driver->lc, "Uint8");
-        value.tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
-        value.type.Unsigned_Int = iot_data_ui8 (values[i]);
-        break;
-      case IOT_DATA_UINT16:
-        iot_log_debug (driver->lc, "Uint16");
-        value.tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
-        value.type.Unsigned_Int = iot_data_ui16 (values[i]);
-        break;
-      case IOT_DATA_UINT32:
-        iot_log_debug (driver->lc, "Uint32");
-        value.tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
-        value.type.Unsigned_Int = iot_data_ui32 (values[i]);
-        break;
-      case IOT_DATA_UINT64:
-        iot_log_debug (driver->lc, "Uint64 is not supported");
-        break;
-      case IOT_DATA_INT8:
-        iot_log_debug (driver->lc, "Int8");
-        value.tag = BACNET_APPLICATION_TAG_SIGNED_INT;
-        value.type.Signed_Int = iot_data_i8 (values[i]);
-        break;
-      case IOT_DATA_INT16:
-        iot_log_debug (driver->lc, "Int16");
-        value.tag = BACNET_APPLICATION_TAG_SIGNED_INT;
-        value.type.Signed_Int = iot_data_i16 (values[i]);
-        break;
-      case IOT_DATA_INT32:
-        iot_log_debug (driver->lc, "Int32");
-        value.tag = BACNET_APPLICATION_TAG_SIGNED_INT;
-        value.type.Signed_Int = iot_data_i32 (values[i]);
-        break;
-      case IOT_DATA_INT64:
-        iot_log_debug (driver->lc, "Int64 is not supported");
-        break;
-      case IOT_DATA_FLOAT32:
-        iot_log_debug (driver->lc, "Float32");
-        value.tag = BACNET_APPLICATION_TAG_REAL;
-        value.type.Real = iot_data_f32 (values[i]);
-        break;
-      case IOT_DATA_FLOAT64:
-        iot_log_debug (driver->lc, "Float64");
-        value.tag = BACNET_APPLICATION_TAG_DOUBLE;
-        value.type.Double = iot_data_f64 (values[i]);
-        break;
-      default:
-        iot_log_error (driver->lc,
-                       "The value type %s is not accepted", iot_data_type_name(values[i]));
-        write_access_data_free (*head);
-        return false;
+      write_access_data_free (*head);
+      return false;
+    }
+    uint32_t instance = attrs->instance;
+    /* Objects referenced by name are resolved to their instance */
+    if (attrs->name && !bacnet_resolve_object_name (addr, attrs->type, attrs->name, &instance))
+    {
+      write_access_data_free (*head);
+      return false;
     }
     *head = bacnet_write_access_data_add (*head,
-                                         attrs->type, attrs->property, attrs->instance,
+                                         attrs->type, attrs->property, instance,
                                          attrs->index, value, priority);
   }
   return true;
@@ -592,14 +1244,13 @@ void write_access_data_free (BACNET_WRITE_ACCESS_DATA *head)
 }
 
 bool
-get_device_properties (address_entry_t *device, uint16_t port, iot_logger_t *lc,
+get_device_properties (address_entry_t *device, const bacnet_address_t *addr, iot_logger_t *lc,
                        char **name, char **description, devsdk_strings *labels,
                        char **profile_name)
 {
 /* Get the device name for the discovered device */
   BACNET_APPLICATION_DATA_VALUE *name_value = bacnetReadProperty (
-    device->device_id, OBJECT_DEVICE, UINT32_MAX, PROP_OBJECT_NAME,
-    UINT32_MAX, port);
+    addr, OBJECT_DEVICE, UINT32_MAX, PROP_OBJECT_NAME, UINT32_MAX, REQUEST_PRIORITY_BACKGROUND);
 
   if (!name_value)
   {
@@ -663,299 +1314,1400 @@ void bacnet_protocol_populate (address_entry_t *device, iot_data_t *properties,
 
   /* Add the Port to the list of protocol properties */
   iot_data_string_map_add (properties, "Port", iot_data_alloc_string (portstring, IOT_DATA_TAKE));
-#endif
-}
 
-static void *receive_data (void *running)
-{
-  BACNET_ADDRESS src = {0};
-  uint8_t Rx_Buf[MAX_MPDU] = {0};
-  unsigned timeout = 100;
-  /* Run thread until device service stops */
-  while (*(bool *) running)
+  /* For a device behind a router, add its remote network number and address */
+  if (device->address.net != 0 && device->address.len > 0)
   {
-    /* Receive data */
-    uint16_t pdu_len = datalink_receive (&src, &Rx_Buf[0], MAX_MPDU, timeout);
-
-    /* If there is any data */
-    if (pdu_len)
+    char *network = malloc (MAX_NETWORK_LENGTH);
+    memset (network, 0, MAX_NETWORK_LENGTH);
+    sprintf (network, "%u", device->address.net);
+    iot_data_string_map_add (properties, "Network", iot_data_alloc_string (network, IOT_DATA_TAKE));
+
+    char *mac = malloc (MAX_MAC_STRING_LENGTH);
+    memset (mac, 0, MAX_MAC_STRING_LENGTH);
+    if (device->address.len == 1)
+    {
+      /* A single byte address, e.g. an MS/TP station, is given as a number */
+      sprintf (mac, "%u", device->address.adr[0]);
+    }
+    else
     {
-      /* Handle the collected data */
-      npdu_handler (&src, &Rx_Buf[0], pdu_len);
+      for (int i = 0; i < device->address.len; i++)
+      {
+        sprintf (mac + 3 * i, i ? ":%02X" : "%02X", device->address.adr[i]);
+      }
     }
+    iot_data_string_map_add (properties, "MAC", iot_data_alloc_string (mac, IOT_DATA_TAKE));
   }
-  return NULL;
+#endif
 }
 
-/* Initialize BACnet handlers */
-static void init_service_handlers (void)
+/* Get the addressing information of a discovered device */
+void bacnet_address_from_entry (address_entry_t *device, bacnet_address_t *addr)
 {
-  Device_Init (NULL);
-  /* set the handler for all the services we don't implement
-   It is required to send the proper reject message... */
-  apdu_set_unrecognized_service_handler_handler
-    (handler_unrecognized_service);
-  /* handle the reply (request) coming back */
-  apdu_set_unconfirmed_handler (SERVICE_UNCONFIRMED_I_AM, my_i_am_handler);
-  /* we must implement read property - it's required! */
-  apdu_set_confirmed_handler (SERVICE_CONFIRMED_READ_PROPERTY,
-                              handler_read_property);
-  apdu_set_confirmed_ack_handler (SERVICE_CONFIRMED_READ_PROPERTY,
-                                  My_Read_Property_Ack_Handler);
-  /* handle the ack coming back */
-  apdu_set_confirmed_simple_ack_handler (SERVICE_CONFIRMED_WRITE_PROPERTY,
-                                         MyWritePropertySimpleAckHandler);
-  /* handle any errors coming back */
-  apdu_set_error_handler (SERVICE_CONFIRMED_READ_PROPERTY, MyErrorHandler);
-  apdu_set_error_handler (SERVICE_CONFIRMED_WRITE_PROPERTY, MyErrorHandler);
-  apdu_set_abort_handler (MyAbortHandler);
-  apdu_set_reject_handler (MyRejectHandler);
+  memset (addr, 0, sizeof (bacnet_address_t));
+  addr->deviceInstance = device->device_id;
+  addr->apduRetries = -1;
+  addr->notificationClass = UINT32_MAX;
+  addr->port = (uint16_t) (device->address.mac[4] * 0x100u +
+                           device->address.mac[5]);
+  if (device->address.net != 0 && device->address.len > 0)
+  {
+    addr->network = device->address.net;
+    addr->mac_len = device->address.len;
+    memcpy (addr->mac, device->address.adr, device->address.len);
+  }
 }
 
-/* Initialize the BACnet driver */
-int init_bacnet_driver (pthread_t *datalink_thread, bool *running,
-                        iot_logger_t *logging_client)
+/* Learn routes from I-Am-Router-To-Network messages, which are not handled by the stack */
+static void router_message_handler (BACNET_ADDRESS *src, uint8_t *pdu,
+                                    uint16_t pdu_len)
 {
-  /* Initialize the service handlers */
-  init_service_handlers ();
-  /* Set the BACnet instance number of the device service the maximum BACnet instance */
-  Device_Set_Object_Instance_Number (BACNET_MAX_INSTANCE);
-  /* Initialize address binding table */
-  address_init ();
-  /* Setup device service info */
-  if (dlenv_init () != 0)
+  BACNET_ADDRESS dest = {0};
+  BACNET_ADDRESS npdu_src = *src;
+  BACNET_NPDU_DATA npdu_data = {0};
+
+  if (pdu[0] != BACNET_PROTOCOL_VERSION)
   {
-#ifdef BACDL_MSTP
-    iot_log_error (lc, "Could not initialize %s", RS485_Interface ());
-#endif
-    return 1;
+    return;
+  }
+  int offset = npdu_decode (pdu, &dest, &npdu_src, &npdu_data);
+  if (offset <= 0 || !npdu_data.network_layer_message)
+  {
+    return;
   }
 
-  /* Setup logging */
-  lc = logging_client;
-  deviceCondtionMapHead = device_condition_map_alloc ();
-  returnDataHead = return_data_alloc ();
-  addressEntryHead = address_entry_alloc ();
-  /* Create and run thread for getting data */
-  pthread_create (datalink_thread, NULL, receive_data, (void *) running);
-  return 0;
+  /* A router that cannot reach a network rejects messages to it with the
+   * reason and the network, so the route is forgotten and found again
+   */
+  if (npdu_data.network_message_type == NETWORK_MESSAGE_REJECT_MESSAGE_TO_NETWORK)
+  {
+    uint16_t network = 0;
+    if (offset + 3 <= pdu_len)
+    {
+      decode_unsigned16 (&pdu[offset + 1], &network);
+      iot_log_warn (lc, "Router rejected a message to network %u, reason %u", network, pdu[offset]);
+      router_table_remove (routerTable, network);
+    }
+    return;
+  }
+  if (npdu_data.network_message_type != NETWORK_MESSAGE_I_AM_ROUTER_TO_NETWORK)
+  {
+    return;
+  }
+
+  /* The message carries the list of networks reachable through the sender */
+  while (offset + 2 <= pdu_len)
+  {
+    uint16_t network = 0;
+    offset += decode_unsigned16 (&pdu[offset], &network);
+    iot_log_debug (lc, "Network %u is reachable through a router", network);
+    router_table_set (routerTable, network, src);
+  }
 }
 
-/* Deinitialize BACnet driver */
-void deinit_bacnet_driver (pthread_t *datalink_thread, bool *running)
+/* Handle a received NPDU */
+static void handle_received_pdu (BACNET_ADDRESS *src, uint8_t *pdu, uint16_t pdu_len)
 {
-  /* Stop the loop in datalink thread */
-  *running = false;
-
-  /* Join datalink thread with current thread */
-  pthread_join (*datalink_thread, NULL);
-
-  /* Cleanup datalink */
-  datalink_cleanup ();
-
-  /* Free memory for returnData */
-  address_entry_free (addressEntryHead);
-  device_condition_map_free (deviceCondtionMapHead);
-  return_data_free (returnDataHead);
+  /* Update the router table from any routing messages */
+  router_message_handler (src, pdu, pdu_len);
+  /* Handle the collected data */
+  npdu_handler (src, pdu, pdu_len);
 }
 
-/* Send Who-Is request to a device */
-bool
-find_and_bind (return_data_t *data, uint16_t port, uint32_t deviceInstance)
+/* Pick the decode worker for frames from a source address */
+static decode_worker_t *decode_worker_for (const BACNET_ADDRESS *src)
 {
-  BACNET_ADDRESS src = {0};
-  time_t last_seconds = time (NULL);
-  time_t current_seconds = 0;
-  time_t timeout_seconds = (apdu_timeout () / 1000) * apdu_retries ();
-  unsigned max_apdu = 0;
-  struct timeval now;
-  struct timespec timeout;
+  return &decodeWorkers[hash_address (HASH_INIT, src) % decodeWorkerCount];
+}
 
-  /* Check for valid device instance */
-  if (deviceInstance > BACNET_MAX_INSTANCE)
+/* Hand a received frame to its decode worker, or decode it here if there are no workers */
+static void dispatch_received_pdu (BACNET_ADDRESS *src, uint8_t *pdu, uint16_t pdu_len)
+{
+  if (decodeWorkerCount == 0)
   {
-    iot_log_error (lc, "device-instance=%u - it must be less than %u",
-                   deviceInstance, BACNET_MAX_INSTANCE);
-    return false;
+    handle_received_pdu (src, pdu, pdu_len);
+    return;
   }
-
-#ifdef BACDL_BIP
-  /* Set BACnet port */
-  bip_set_port (htons ((uint16_t) port));
-#endif
-
-  /* Try to bind */
-  bool found = address_bind_request (deviceInstance, &max_apdu,
-                                     &data->targetAddress);
-  device_condition_map_t *map;
-  /* Binding was successful */
-  if (found == true)
+  if (!frame_queue_push (decode_worker_for (src)->queue, src, pdu, pdu_len, stats_now ()))
   {
-    return true;
+    iot_log_debug (lc, "Decode queue full, dropping frame");
   }
+}
 
-  device_condition_map_set (deviceCondtionMapHead, deviceInstance, &src);
-  map = device_condition_map_get (deviceCondtionMapHead, deviceInstance);
-  /* Send Who-Is call */
-  pthread_mutex_lock (&map->mutex);
-  Send_WhoIs (deviceInstance,
-              deviceInstance);
-  /* Get the current time */
-  current_seconds = time (NULL);
-  gettimeofday (&now, NULL);
-  timeout.tv_sec = now.tv_sec + timeout_seconds;
-  timeout.tv_nsec = 0;
-
-  /* Wait for devices to respond */
-  pthread_cond_timedwait (&map->condition, &map->mutex, &timeout);
-  pthread_mutex_unlock (&map->mutex);
-  device_condition_map_remove (deviceCondtionMapHead, deviceInstance);
-
-  /* Break if an error has been detected */
-  if (data->errorDetected)
+/* Decode the frames queued for a worker until the driver stops */
+static void *decode_frames (void *arg)
+{
+  decode_worker_t *worker = (decode_worker_t *) arg;
+  while (true)
   {
-    return false;
+    frame_queue_wait (worker->queue);
+    frame_t *frame = frame_queue_peek (worker->queue);
+    if (frame == NULL)
+    {
+      if (!__atomic_load_n (&decodeRunning, __ATOMIC_ACQUIRE))
+      {
+        break;
+      }
+      continue;
+    }
+    stats_record_latency (bacnetStats.decode_latency, frame->received);
+    handle_received_pdu (&frame->src, frame->pdu, frame->pdu_len);
+    frame_queue_release (worker->queue);
   }
+  return NULL;
+}
 
-  /* Try to bind */
-  found =
-    address_bind_request (deviceInstance, &max_apdu,
-                          &data->targetAddress);
-
-  /* Bind request has returned successfully */
-  if (found)
+/* Create a driver thread, pinned to a CPU if cpu is not negative and with
+ * SCHED_FIFO scheduling if priority is not 0. If the system refuses the
+ * attributes, for instance without CAP_SYS_NICE, the thread is created with
+ * the default attributes instead.
+ */
+static void create_driver_thread (pthread_t *thread, void *(*run) (void *), void *arg,
+                                  int cpu, int priority, const char *name)
+{
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  if (cpu >= 0)
   {
-    /* Make sure that a call has not already been executed with the return value struct */
-    if (data->requestInvokeID == 0)
-    {
-      return true;
-    }
-    else if (tsm_invoke_id_free (data->requestInvokeID))
-    {
-      return false;
-    }
-    else if (tsm_invoke_id_failed (data->requestInvokeID))
-    {
-      iot_log_error (lc, "Error: TSM Timeout!");
-      tsm_free_invoke_id (data->requestInvokeID);
-      data->errorDetected = true;
-      return false;
-    }
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (cpu, &cpus);
+    pthread_attr_setaffinity_np (&attr, sizeof (cpus), &cpus);
   }
-  else
+  if (priority > 0)
   {
-    /* Increment timer - return if timed out */
-    time_t elapsed_seconds = (current_seconds - last_seconds);
-    if (elapsed_seconds > timeout_seconds)
-    {
-      iot_log_error (lc, "Error: APDU Timeout!");
-      data->errorDetected = true;
-      return false;
-    }
+    struct sched_param param = {0};
+    param.sched_priority = priority;
+    pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+    pthread_attr_setschedparam (&attr, &param);
   }
-  return false;
+  int err = pthread_create (thread, &attr, run, arg);
+  if (err != 0 && priority > 0)
+  {
+    /* Real-time scheduling usually needs privileges, so retry with the inherited policy and keep the CPU */
+    iot_log_warn (lc, "Could not set the priority of the %s thread: %s", name, strerror (err));
+    pthread_attr_setinheritsched (&attr, PTHREAD_INHERIT_SCHED);
+    err = pthread_create (thread, &attr, run, arg);
+  }
+  if (err != 0)
+  {
+    iot_log_warn (lc, "Could not set the CPU of the %s thread: %s", name, strerror (err));
+    pthread_create (thread, NULL, run, arg);
+  }
+  pthread_attr_destroy (&attr);
 }
 
-/* Wait for the data to be returned */
-bool wait_for_data (return_data_t *data)
+/* Get the CPU for a decode worker from a comma separated list, in turn, or -1 if there is no list */
+static int decode_worker_cpu (const char *cpus, uint32_t worker)
 {
-
-  /* Setup timers */
-  time_t current_seconds = 0;
-  time_t elapsed_seconds = 0;
-  time_t timeout_seconds = (apdu_timeout () / 1000) * apdu_retries ();
-  time_t last_seconds = 0;
-  struct timeval now;
-  struct timespec timeout;
-  gettimeofday (&now, NULL);
-  timeout.tv_sec = now.tv_sec + timeout_seconds;
-  timeout.tv_nsec = 0;
-
-  /* Wait until data is set */
-  pthread_cond_timedwait (&data->condition, &data->mutex, &timeout);
-  pthread_mutex_unlock (&data->mutex);
-  if (data->errorDetected)
+  uint32_t count = 0;
+  const char *entry = cpus;
+  while (entry && *entry)
   {
-    return false;
+    count++;
+    entry = strchr (entry, ',');
+    entry = entry ? entry + 1 : NULL;
   }
-  /* Increment timer - return if timed out */
-  elapsed_seconds += (current_seconds - last_seconds);
-  if (elapsed_seconds > timeout_seconds)
+  if (count == 0)
   {
-    iot_log_error (lc, "Error: APDU Timeout!");
-    data->errorDetected = true;
-    return false;
+    return -1;
   }
-  return true;
+  entry = cpus;
+  for (uint32_t i = 0; i < worker % count; i++)
+  {
+    entry = strchr (entry, ',') + 1;
+  }
+  return atoi (entry);
 }
 
-/* Read Property BACnet call */
-BACNET_APPLICATION_DATA_VALUE *bacnetReadProperty (
-  uint32_t deviceInstance, int type, uint32_t instance, int property,
-  uint32_t index, uint16_t port)
+static void start_decode_workers (const bacnet_config_t *config)
 {
-  /* Insert return_data structure with invoke id 0 and get pointer */
-  return_data_t *data = return_data_set (returnDataHead, 0);
-  /* Try to bind to device */
-  if (!find_and_bind (data, port, deviceInstance))
+  uint32_t count = config->decode_workers;
+  decodeWorkerCount = count;
+  if (count == 0)
   {
-    return_data_remove_by_ptr (returnDataHead, data);
-    return NULL;
+    return;
+  }
+  __atomic_store_n (&decodeRunning, true, __ATOMIC_RELEASE);
+  decodeWorkers = calloc (count, sizeof (decode_worker_t));
+  for (uint32_t i = 0; i < count; i++)
+  {
+    decodeWorkers[i].queue = frame_queue_alloc (FRAME_QUEUE_DEPTH);
+    create_driver_thread (&decodeWorkers[i].thread, decode_frames, &decodeWorkers[i],
+                          decode_worker_cpu (config->decode_cpus, i), config->decode_priority, "decode");
   }
-  /* Send read property request */
-  pthread_mutex_lock (&data->mutex);
-  pthread_mutex_lock (&returnDataHead->mutex);
-  data->requestInvokeID =
-    Send_Read_Property_Request (deviceInstance,
-                                type,
-                                instance,
-                                property,
-                                index);
-  pthread_mutex_unlock (&returnDataHead->mutex);
-  /* Wait for data to be set */
-  wait_for_data (data);
-  /* Get copy of value pointer */
-  BACNET_APPLICATION_DATA_VALUE *ret = data->value;
-
-  return_data_remove_by_ptr (returnDataHead, data);
-
-  return ret;
 }
 
-/* Issue Who-Is BACnet call to all devices */
-address_entry_ll *bacnetWhoIs ()
+/* Stop the decode workers once the remaining frames are decoded. The datalink thread must have stopped. */
+static void stop_decode_workers (void)
 {
-  time_t timeout_seconds = (apdu_timeout () / 1000) * apdu_retries ();
-  BACNET_ADDRESS dest;
-  static int32_t Target_Object_Instance_Min = -1;
-  static int32_t Target_Object_Instance_Max = -1;
-  struct timeval now;
-  struct timespec timeout;
-  gettimeofday (&now, NULL);
-  timeout.tv_sec = now.tv_sec + timeout_seconds;
-  timeout.tv_nsec = 0;
+  __atomic_store_n (&decodeRunning, false, __ATOMIC_RELEASE);
+  for (uint32_t i = 0; i < decodeWorkerCount; i++)
+  {
+    frame_queue_wake (decodeWorkers[i].queue);
+    pthread_join (decodeWorkers[i].thread, NULL);
+    if (decodeWorkers[i].queue->dropped)
+    {
+      iot_log_info (lc, "Decode worker %u dropped %llu frames", i,
+                    (unsigned long long) decodeWorkers[i].queue->dropped);
+    }
+    frame_queue_free (decodeWorkers[i].queue);
+  }
+  free (decodeWorkers);
+  decodeWorkers = NULL;
+  decodeWorkerCount = 0;
+}
 
-  /* Setup returnData to allow for error handling */
-  return_data_t *data = return_data_set (returnDataHead, UINT8_MAX);
-  data->errorDetected = false;
+static void *receive_data (void *running)
+{
+  BACNET_ADDRESS src = {0};
+  uint8_t Rx_Buf[MAX_MPDU] = {0};
+#ifdef BACDL_BIP
+  struct epoll_event events[MAX_DATALINK_EVENTS];
 
-  /* Get address for broadcasting */
-  datalink_get_broadcast_address (&dest);
+  /* Run thread until device service stops */
+  while (__atomic_load_n ((bool *) running, __ATOMIC_ACQUIRE))
+  {
+    /* Block until data arrives on an endpoint or the thread is woken */
+    int nevents = epoll_wait (datalinkEpoll, events, MAX_DATALINK_EVENTS, -1);
+    for (int i = 0; i < nevents; i++)
+    {
+      bip_endpoint_t *endpoint = events[i].data.ptr;
+      if (endpoint == NULL)
+      {
+        uint64_t count;
+        if (read (datalinkEvent, &count, sizeof (count)) < 0)
+        {
+          iot_log_debug (lc, "Error reading datalink eventfd: %s", strerror (errno));
+        }
+        continue;
+      }
+      /* With a BBMD, the stack's own socket is read by the stack, which handles BBMD messages */
+      if (!endpoint->owned && bbmdActive)
+      {
+        uint16_t pdu_len = datalink_receive (&src, &Rx_Buf[0], MAX_MPDU, 0);
+        if (pdu_len)
+        {
+          dispatch_received_pdu (&src, &Rx_Buf[0], pdu_len);
+        }
+        continue;
+      }
+      unsigned count = bip_endpoint_receive_batch (endpoint, rxFrames, BIP_RECEIVE_BATCH);
+      for (unsigned j = 0; j < count; j++)
+      {
+        if (rxFrames[j].pdu_len)
+        {
+          dispatch_received_pdu (&rxFrames[j].src, rxFrames[j].pdu, rxFrames[j].pdu_len);
+        }
+      }
+    }
+    /* Send the requests queued while waiting */
+    bip_endpoint_flush (bipEndpoints);
+  }
+#else
+  /* The MS/TP datalink gives no descriptor to wait on, so wait in the stack with a timeout */
+  /* Run thread until device service stops */
+  while (__atomic_load_n ((bool *) running, __ATOMIC_ACQUIRE))
+  {
+    /* Receive data */
+    unsigned timeout = __atomic_load_n (&receiveTimeout, __ATOMIC_RELAXED);
+    uint16_t pdu_len = datalink_receive (&src, &Rx_Buf[0], MAX_MPDU, timeout ? timeout : 1);
+
+    /* If there is any data */
+    if (pdu_len)
+    {
+      dispatch_received_pdu (&src, &Rx_Buf[0], pdu_len);
+    }
+  }
+#endif
+  return NULL;
+}
+
+/* I-Have handler, caching the object identifier for an object name */
+static void my_i_have_handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src)
+{
+  BACNET_I_HAVE_DATA data;
+  (void) src;
+
+  if (ihave_decode_service_request (service_request, service_len, &data) <= 0)
+  {
+    return;
+  }
+  char name[MAX_CHARACTER_STRING_BYTES + 1] = {0};
+  size_t length = characterstring_length (&data.object_name);
+  if (length > MAX_CHARACTER_STRING_BYTES)
+  {
+    length = MAX_CHARACTER_STRING_BYTES;
+  }
+  memcpy (name, characterstring_value (&data.object_name), length);
+  iot_log_debug (lc, "Processing I-Have from %lu for object %s",
+                 (unsigned long) data.device_id.instance, name);
+  object_name_map_set (objectNameMap, data.device_id.instance, name,
+                       (BACNET_OBJECT_TYPE) data.object_id.type,
+                       data.object_id.instance);
+}
+
+/* Decode a COV notification, keeping its values as the last known good
+ * values and passing them to the COV handler. Returns false if it could not
+ * be decoded.
+ */
+static bool handle_cov_notification (uint8_t *service_request, uint16_t service_len)
+{
+  BACNET_COV_DATA data;
+  BACNET_PROPERTY_VALUE values[MAX_COV_PROPERTIES];
+
+  /* The values are decoded into a list linked through the array */
+  for (int i = 0; i < MAX_COV_PROPERTIES; i++)
+  {
+    values[i].next = (i + 1 < MAX_COV_PROPERTIES) ? &values[i + 1] : NULL;
+  }
+  data.listOfValues = &values[0];
+  if (cov_notify_decode_service_request (service_request, service_len, &data) <= 0)
+  {
+    iot_log_error (lc, "Received COV notification, but unable to decode it.");
+    return false;
+  }
+  iot_log_debug (lc, "Processing COV notification from %lu for process %lu",
+                 (unsigned long) data.initiatingDeviceIdentifier,
+                 (unsigned long) data.subscriberProcessIdentifier);
+  rtt_table_heard (rttTable, data.initiatingDeviceIdentifier, stats_now ());
+  for (BACNET_PROPERTY_VALUE *value = data.listOfValues; value; value = value->next)
+  {
+    value_cache_put (valueCache, data.initiatingDeviceIdentifier,
+                     (BACNET_OBJECT_TYPE) data.monitoredObjectIdentifier.type,
+                     data.monitoredObjectIdentifier.instance, value->propertyIdentifier,
+                     value->propertyArrayIndex, &value->value);
+  }
+  bacnet_cov_handler_t handler = __atomic_load_n (&covHandler, __ATOMIC_ACQUIRE);
+  if (handler)
+  {
+    handler (covContext, data.initiatingDeviceIdentifier, data.subscriberProcessIdentifier,
+             (BACNET_OBJECT_TYPE) data.monitoredObjectIdentifier.type,
+             data.monitoredObjectIdentifier.instance, data.listOfValues);
+  }
+  return true;
+}
+
+/* UnconfirmedCOVNotification handler */
+static void my_ucov_notification_handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src)
+{
+  (void) src;
+  handle_cov_notification (service_request, service_len);
+}
+
+/* Acknowledge a confirmed notification. The acknowledgement is sent from its
+ * own buffer rather than the stack's transmit buffer, so that decode workers
+ * may send them concurrently.
+ */
+static void send_simple_ack (BACNET_ADDRESS *src, uint8_t invoke_id, uint8_t service)
+{
+  uint8_t pdu[MAX_PDU];
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+  int pdu_len = npdu_encode_pdu (&pdu[0], src, &my_address, &npdu_data);
+  pdu_len += encode_simple_ack (&pdu[pdu_len], invoke_id, service);
+  if (!send_pdu (src, &npdu_data, &pdu[0], (unsigned) pdu_len))
+  {
+    iot_log_error (lc, "Failed to acknowledge notification");
+  }
+}
+
+/* ConfirmedCOVNotification handler, acknowledging the notifications decoded */
+static void my_ccov_notification_handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_DATA *service_data)
+{
+  if (handle_cov_notification (service_request, service_len))
+  {
+    send_simple_ack (src, service_data->invoke_id, SERVICE_CONFIRMED_COV_NOTIFICATION);
+  }
+}
+
+/* Set the handler of the COV notifications received */
+void bacnet_set_cov_handler (bacnet_cov_handler_t handler, void *context)
+{
+  __atomic_store_n (&covContext, context, __ATOMIC_RELAXED);
+  __atomic_store_n (&covHandler, handler, __ATOMIC_RELEASE);
+}
+
+/* Decode an event notification and pass it to the event handler. Returns
+ * false if it could not be decoded.
+ */
+static bool handle_event_notification (uint8_t *service_request, uint16_t service_len)
+{
+  BACNET_EVENT_NOTIFICATION_DATA data;
+  BACNET_CHARACTER_STRING message;
+
+  memset (&data, 0, sizeof (data));
+  characterstring_init_ansi (&message, "");
+  data.messageText = &message;
+  if (event_notify_decode_service_request (service_request, service_len, &data) <= 0)
+  {
+    iot_log_error (lc, "Received event notification, but unable to decode it.");
+    return false;
+  }
+  iot_log_debug (lc, "Processing event notification from %lu for %s %lu: %s",
+                 (unsigned long) data.initiatingObjectIdentifier.instance,
+                 bactext_object_type_name (data.eventObjectIdentifier.type),
+                 (unsigned long) data.eventObjectIdentifier.instance,
+                 bactext_event_state_name (data.toState));
+  rtt_table_heard (rttTable, data.initiatingObjectIdentifier.instance, stats_now ());
+  bacnet_event_handler_t handler = __atomic_load_n (&eventHandler, __ATOMIC_ACQUIRE);
+  if (handler)
+  {
+    handler (eventContext, &data);
+  }
+  return true;
+}
+
+/* UnconfirmedEventNotification handler */
+static void my_uevent_notification_handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src)
+{
+  (void) src;
+  handle_event_notification (service_request, service_len);
+}
+
+/* ConfirmedEventNotification handler, acknowledging the notifications decoded */
+static void my_cevent_notification_handler (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_DATA *service_data)
+{
+  if (handle_event_notification (service_request, service_len))
+  {
+    send_simple_ack (src, service_data->invoke_id, SERVICE_CONFIRMED_EVENT_NOTIFICATION);
+  }
+}
+
+/* Set the handler of the event notifications received */
+void bacnet_set_event_handler (bacnet_event_handler_t handler, void *context)
+{
+  __atomic_store_n (&eventContext, context, __ATOMIC_RELAXED);
+  __atomic_store_n (&eventHandler, handler, __ATOMIC_RELEASE);
+}
+
+/* ReadProperty server handler, serialized as decode workers may run it concurrently */
+static void locked_handler_read_property (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_DATA *service_data)
+{
+  pthread_mutex_lock (&stackMutex);
+  handler_read_property (service_request, service_len, src, service_data);
+  pthread_mutex_unlock (&stackMutex);
+}
+
+/* Reject handler for unimplemented services, serialized as above */
+static void locked_handler_unrecognized_service (
+  uint8_t *service_request,
+  uint16_t service_len,
+  BACNET_ADDRESS *src,
+  BACNET_CONFIRMED_SERVICE_DATA *service_data)
+{
+  pthread_mutex_lock (&stackMutex);
+  handler_unrecognized_service (service_request, service_len, src, service_data);
+  pthread_mutex_unlock (&stackMutex);
+}
+
+/* Initialize BACnet handlers */
+static void init_service_handlers (void)
+{
+  Device_Init (NULL);
+  /* set the handler for all the services we don't implement
+   It is required to send the proper reject message... */
+  apdu_set_unrecognized_service_handler_handler
+    (locked_handler_unrecognized_service);
+  /* handle the reply (request) coming back */
+  apdu_set_unconfirmed_handler (SERVICE_UNCONFIRMED_I_AM, my_i_am_handler);
+  apdu_set_unconfirmed_handler (SERVICE_UNCONFIRMED_I_HAVE, my_i_have_handler);
+  apdu_set_unconfirmed_handler (SERVICE_UNCONFIRMED_COV_NOTIFICATION,
+                                my_ucov_notification_handler);
+  apdu_set_confirmed_handler (SERVICE_CONFIRMED_COV_NOTIFICATION,
+                              my_ccov_notification_handler);
+  apdu_set_unconfirmed_handler (SERVICE_UNCONFIRMED_EVENT_NOTIFICATION,
+                                my_uevent_notification_handler);
+  apdu_set_confirmed_handler (SERVICE_CONFIRMED_EVENT_NOTIFICATION,
+                              my_cevent_notification_handler);
+  /* we must implement read property - it's required! */
+  apdu_set_confirmed_handler (SERVICE_CONFIRMED_READ_PROPERTY,
+                              locked_handler_read_property);
+  apdu_set_confirmed_ack_handler (SERVICE_CONFIRMED_READ_PROPERTY,
+                                  My_Read_Property_Ack_Handler);
+  apdu_set_confirmed_ack_handler (SERVICE_CONFIRMED_GET_EVENT_INFORMATION,
+                                  My_Get_Event_Information_Ack_Handler);
+  apdu_set_confirmed_ack_handler (SERVICE_CONFIRMED_READ_RANGE,
+                                  My_Read_Range_Ack_Handler);
+  /* handle the ack coming back */
+  apdu_set_confirmed_simple_ack_handler (SERVICE_CONFIRMED_WRITE_PROPERTY,
+                                         MyWritePropertySimpleAckHandler);
+  apdu_set_confirmed_simple_ack_handler (SERVICE_CONFIRMED_SUBSCRIBE_COV,
+                                         MySubscribeCOVSimpleAckHandler);
+  apdu_set_confirmed_simple_ack_handler (SERVICE_CONFIRMED_ADD_LIST_ELEMENT,
+                                         MyAddListElementSimpleAckHandler);
+  /* handle any errors coming back */
+  apdu_set_error_handler (SERVICE_CONFIRMED_READ_PROPERTY, MyErrorHandler);
+  apdu_set_error_handler (SERVICE_CONFIRMED_WRITE_PROPERTY, MyErrorHandler);
+  apdu_set_error_handler (SERVICE_CONFIRMED_SUBSCRIBE_COV, MyErrorHandler);
+  apdu_set_error_handler (SERVICE_CONFIRMED_ADD_LIST_ELEMENT, MyErrorHandler);
+  apdu_set_error_handler (SERVICE_CONFIRMED_GET_EVENT_INFORMATION, MyErrorHandler);
+  apdu_set_error_handler (SERVICE_CONFIRMED_READ_RANGE, MyErrorHandler);
+  apdu_set_abort_handler (MyAbortHandler);
+  apdu_set_reject_handler (MyRejectHandler);
+}
+
+/* Set the budgets of the networks, from the default rates and a list of
+ * "network:packets:bytes" entries separated by commas
+ */
+static void set_network_rates (const bacnet_config_t *config)
+{
+  request_executor_set_rate (requestExecutors, true, 0, config->network_packet_rate,
+                             config->network_byte_rate);
+  const char *entry = config->network_rates;
+  while (entry && *entry)
+  {
+    char *end;
+    unsigned long network = strtoul (entry, &end, 0);
+    unsigned long packet_rate = 0;
+    unsigned long byte_rate = 0;
+    if (*end == ':')
+    {
+      packet_rate = strtoul (end + 1, &end, 0);
+      if (*end == ':')
+      {
+        byte_rate = strtoul (end + 1, &end, 0);
+      }
+    }
+    if (end == entry || network > UINT16_MAX || (*end && *end != ',' && *end != ' '))
+    {
+      iot_log_error (lc, "Error: Invalid network rate \"%s\"", entry);
+      break;
+    }
+    request_executor_set_rate (requestExecutors, false, (uint16_t) network, (uint32_t) packet_rate,
+                               (uint32_t) byte_rate);
+    entry = end;
+    while (*entry == ',' || *entry == ' ')
+    {
+      entry++;
+    }
+  }
+}
+
+/* Initialize the BACnet driver */
+int init_bacnet_driver (pthread_t *datalink_thread, bool *running,
+                        iot_logger_t *logging_client,
+                        const bacnet_config_t *config)
+{
+  /* Initialize the service handlers */
+  init_service_handlers ();
+  /* Set the BACnet instance number of the device service the maximum BACnet instance */
+  Device_Set_Object_Instance_Number (BACNET_MAX_INSTANCE);
+  /* Initialize address binding table */
+  address_init ();
+  /* Setup device service info */
+  if (dlenv_init () != 0)
+  {
+#ifdef BACDL_MSTP
+    iot_log_error (lc, "Could not initialize %s", RS485_Interface ());
+#endif
+    return 1;
+  }
+
+#ifdef BACDL_BIP
+  /* Setup the epoll instance with the eventfd, which has no endpoint as its data */
+  struct epoll_event event = {0};
+  datalinkEpoll = epoll_create1 (EPOLL_CLOEXEC);
+  datalinkEvent = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (datalinkEpoll < 0 || datalinkEvent < 0 ||
+      epoll_ctl (datalinkEpoll, EPOLL_CTL_ADD, datalinkEvent, &event) < 0)
+  {
+    iot_log_error (logging_client, "Could not setup datalink events: %s", strerror (errno));
+    return 1;
+  }
+  /* Setup the endpoints, starting with the socket opened by the stack */
+  bipEndpoints = bip_endpoint_alloc (bip_socket (), ntohs (bip_get_port ()), datalinkEpoll);
+  bbmdActive = getenv ("BACNET_BBMD_ADDRESS") && getenv ("BACNET_BBMD_PORT");
+#endif
+
+  /* Setup logging */
+  lc = logging_client;
+  deviceCondtionMapHead = device_condition_map_alloc ();
+  returnDataHead = return_data_alloc (config->max_transactions);
+  token_bucket_init (&datalinkBucket, config->datalink_packet_rate, config->datalink_byte_rate,
+                     &bacnetStats.datalink_throttled_ns);
+  token_bucket_init (&bbmdBucket, config->bbmd_packet_rate, config->bbmd_byte_rate,
+                     &bacnetStats.bbmd_throttled_ns);
+  requestExecutors = request_executor_alloc (config->network_window, send_request, &datalinkBucket);
+  set_network_rates (config);
+  addressEntryHead = address_entry_alloc ();
+  routerTable = router_table_alloc ();
+  bindingTable = binding_table_alloc (config->binding_table_size);
+  pendingBinds = binding_table_alloc (config->binding_table_size);
+  objectNameMap = object_name_map_alloc ();
+  deviceQueues = device_queue_alloc (config->device_queue_depth);
+  rttTable = rtt_table_alloc ();
+  circuitBreakers = circuit_breaker_alloc (config->breaker_threshold, config->breaker_probe_interval);
+  valueCache = config->serve_stale ? value_cache_alloc () : NULL;
+  reconfigure_bacnet_driver (config);
+  /* Start the decode workers before any frames are received */
+  start_decode_workers (config);
+  /* Create and run thread for getting data */
+  create_driver_thread (datalink_thread, receive_data, (void *) running, config->datalink_cpu,
+                        config->datalink_priority, "datalink");
+  datalinkStarted = true;
+  return 0;
+}
+
+/* Apply the driver options that may change while the driver runs */
+void reconfigure_bacnet_driver (const bacnet_config_t *config)
+{
+  if (config->apdu_timeout)
+  {
+    apdu_timeout_set ((uint16_t) (config->apdu_timeout > UINT16_MAX ? UINT16_MAX : config->apdu_timeout));
+  }
+  if (config->apdu_retries >= 0)
+  {
+    apdu_retries_set ((uint8_t) (config->apdu_retries > UINT8_MAX ? UINT8_MAX : config->apdu_retries));
+  }
+  __atomic_store_n (&whoIsTimeout, config->who_is_timeout, __ATOMIC_RELAXED);
+  __atomic_store_n (&discoveryTimeout, config->discovery_timeout, __ATOMIC_RELAXED);
+  __atomic_store_n (&receiveTimeout, config->receive_timeout, __ATOMIC_RELAXED);
+  request_executor_set_window (requestExecutors, config->network_window);
+  device_queue_set_depth (deviceQueues, config->device_queue_depth);
+  circuit_breaker_configure (circuitBreakers, config->breaker_threshold, config->breaker_probe_interval);
+  token_bucket_set_rate (&datalinkBucket, config->datalink_packet_rate, config->datalink_byte_rate);
+  token_bucket_set_rate (&bbmdBucket, config->bbmd_packet_rate, config->bbmd_byte_rate);
+  request_executor_set_rate (requestExecutors, true, 0, config->network_packet_rate,
+                             config->network_byte_rate);
+}
+
+/* Wake the datalink thread from its wait */
+static void wake_datalink_thread (void)
+{
+#ifdef BACDL_BIP
+  uint64_t count = 1;
+  if (datalinkEvent >= 0 && write (datalinkEvent, &count, sizeof (count)) < 0)
+  {
+    iot_log_debug (lc, "Error waking datalink thread: %s", strerror (errno));
+  }
+#endif
+}
+
+/* Deinitialize BACnet driver */
+void deinit_bacnet_driver (pthread_t *datalink_thread, bool *running)
+{
+  /* Stop the executors, failing any requests still in progress */
+  if (requestExecutors)
+  {
+    request_executor_free (requestExecutors);
+    requestExecutors = NULL;
+  }
+
+  /* Stop the loop in datalink thread */
+  __atomic_store_n (running, false, __ATOMIC_RELEASE);
+  wake_datalink_thread ();
+
+  /* Join datalink thread with current thread, unless initialization failed before it was created */
+  if (datalinkStarted)
+  {
+    pthread_join (*datalink_thread, NULL);
+  }
+
+  /* Finish decoding the frames already received */
+  stop_decode_workers ();
+  stats_log (lc);
+
+#ifdef BACDL_BIP
+  /* Close the endpoints opened by the driver */
+  if (bipEndpoints)
+  {
+    bip_endpoint_free (bipEndpoints);
+    bipEndpoints = NULL;
+  }
+  if (datalinkEvent >= 0)
+  {
+    close (datalinkEvent);
+    datalinkEvent = -1;
+  }
+  if (datalinkEpoll >= 0)
+  {
+    close (datalinkEpoll);
+    datalinkEpoll = -1;
+  }
+#endif
+
+  /* Cleanup datalink */
+  datalink_cleanup ();
+
+  /* Free memory for returnData, which is allocated only once initialization passes the datalink setup */
+  if (datalinkStarted)
+  {
+    address_entry_free (addressEntryHead);
+    device_condition_map_free (deviceCondtionMapHead);
+    return_data_free (returnDataHead);
+    router_table_free (routerTable);
+    binding_table_free (bindingTable);
+    binding_table_free (pendingBinds);
+    object_name_map_free (objectNameMap);
+    device_queue_free (deviceQueues);
+    rtt_table_free (rttTable);
+    circuit_breaker_free (circuitBreakers);
+    value_cache_free (valueCache);
+    valueCache = NULL;
+    token_bucket_fini (&datalinkBucket);
+    token_bucket_fini (&bbmdBucket);
+    datalinkStarted = false;
+  }
+}
+
+/* Wait until a broadcast is within the budgets. With a BBMD, the BBMD
+ * forwards every broadcast, so it has its own budget.
+ */
+static void pace_broadcast (unsigned pdu_len)
+{
+#ifdef BACDL_BIP
+  if (bbmdActive)
+  {
+    token_bucket_wait (&bbmdBucket, pdu_len);
+  }
+#endif
+  token_bucket_wait (&datalinkBucket, pdu_len);
+}
+
+/* Broadcast an NPDU to devices on a UDP port, without changing the port used by the stack */
+static void broadcast_pdu (uint16_t port, BACNET_ADDRESS *dest,
+                           BACNET_NPDU_DATA *npdu_data, uint8_t *pdu,
+                           unsigned pdu_len)
+{
+  pace_broadcast (pdu_len);
+#ifdef BACDL_BIP
+  /* With a BBMD, broadcasts are distributed by the stack through the BBMD */
+  if (!bbmdActive)
+  {
+    bip_endpoint_t *endpoint = bip_endpoint_get (bipEndpoints, port);
+    if (endpoint == NULL || bip_endpoint_send_broadcast (endpoint, port, pdu, pdu_len) <= 0)
+    {
+      iot_log_error (lc, "Error: Failed to broadcast to port %u", port);
+    }
+    return;
+  }
+#endif
+  datalink_send_pdu (dest, npdu_data, pdu, pdu_len);
+}
+
+/* Broadcast a Who-Is request to devices on a UDP port */
+static void send_who_is (uint16_t port, int32_t low_limit, int32_t high_limit)
+{
+  uint8_t pdu[MAX_PDU];
+  BACNET_ADDRESS dest;
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+
+  datalink_get_broadcast_address (&dest);
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+  int pdu_len = npdu_encode_pdu (&pdu[0], &dest, &my_address, &npdu_data);
+  pdu_len += whois_encode_apdu (&pdu[pdu_len], low_limit, high_limit);
+  broadcast_pdu (port, &dest, &npdu_data, &pdu[0], pdu_len);
+}
+
+/* Broadcast a Who-Is-Router-To-Network request for a network on a UDP port */
+static void send_who_is_router_to_network (uint16_t port, uint16_t network)
+{
+  uint8_t pdu[MAX_PDU];
+  BACNET_ADDRESS dest;
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+
+  /* Routers on the local network answer, so the broadcast is not forwarded */
+  datalink_get_broadcast_address (&dest);
+  dest.net = 0;
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+  npdu_data.network_layer_message = true;
+  npdu_data.network_message_type = NETWORK_MESSAGE_WHO_IS_ROUTER_TO_NETWORK;
+  int pdu_len = npdu_encode_pdu (&pdu[0], &dest, &my_address, &npdu_data);
+  pdu_len += encode_unsigned16 (&pdu[pdu_len], network);
+  broadcast_pdu (port, &dest, &npdu_data, &pdu[0], pdu_len);
+}
+
+/* Send Who-Has request for an object name on a device */
+static void send_who_has (const bacnet_address_t *addr, const char *name)
+{
+  uint8_t pdu[MAX_PDU];
+  BACNET_ADDRESS dest;
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+  BACNET_WHO_HAS_DATA data;
+
+  data.low_limit = addr->deviceInstance;
+  data.high_limit = addr->deviceInstance;
+  data.is_object_name = true;
+  characterstring_init_ansi (&data.object.name, name);
+
+  /* Routers forward the request as a broadcast on the device's network, and
+   * a device on the local network gets a local broadcast, which is not forwarded
+   */
+  datalink_get_broadcast_address (&dest);
+  dest.net = addr->network;
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+  int pdu_len = npdu_encode_pdu (&pdu[0], &dest, &my_address, &npdu_data);
+  pdu_len += whohas_encode_apdu (&pdu[pdu_len], &data);
+  broadcast_pdu (addr->port, &dest, &npdu_data, &pdu[0], pdu_len);
+}
+
+/* Write values to channels of a control group with one unconfirmed
+ * WriteGroup request, broadcast on the network of a device, so that every
+ * member of the group applies them. Returns 0 on success.
+ */
+int bacnetWriteGroup (const bacnet_address_t *addr, uint32_t group, uint8_t priority,
+                      const bacnet_channel_value_t *values, unsigned count)
+{
+  uint8_t pdu[MAX_PDU];
+  uint8_t entry[MAX_APDU];
+  BACNET_ADDRESS dest;
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+
+  /* Routers forward the request as a broadcast on the device's network, and
+   * a device on the local network gets a local broadcast, which is not forwarded
+   */
+  datalink_get_broadcast_address (&dest);
+  dest.net = addr->network;
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_URGENT);
+  int pdu_len = npdu_encode_pdu (&pdu[0], &dest, &my_address, &npdu_data);
+  int apdu_start = pdu_len;
+
+  pdu[pdu_len++] = PDU_TYPE_UNCONFIRMED_SERVICE_REQUEST;
+  pdu[pdu_len++] = SERVICE_UNCONFIRMED_WRITE_GROUP;
+  pdu_len += encode_context_unsigned (&pdu[pdu_len], 0, group);
+  pdu_len += encode_context_unsigned (&pdu[pdu_len], 1, priority);
+  pdu_len += encode_opening_tag (&pdu[pdu_len], 2);
+  for (unsigned i = 0; i < count; i++)
+  {
+    /* BACnetGroupChannelValue, whose lighting command is context tagged */
+    BACNET_APPLICATION_DATA_VALUE value = values[i].value;
+    int len = encode_context_unsigned (&entry[0], 0, values[i].channel);
+    if (value.tag == BACNET_APPLICATION_TAG_LIGHTING_COMMAND)
+    {
+      len += encode_opening_tag (&entry[len], 0);
+      len += lighting_command_encode (&entry[len], &value.type.Lighting_Command);
+      len += encode_closing_tag (&entry[len], 0);
+    }
+    else
+    {
+      len += bacapp_encode_application_data (&entry[len], &value);
+    }
+    /* Leave room for the closing tag */
+    if (pdu_len - apdu_start + len + 1 > MAX_APDU)
+    {
+      iot_log_error (lc, "Error: WriteGroup request exceeds the maximum APDU");
+      return 1;
+    }
+    memcpy (&pdu[pdu_len], entry, len);
+    pdu_len += len;
+  }
+  pdu_len += encode_closing_tag (&pdu[pdu_len], 2);
+  broadcast_pdu (addr->port, &dest, &npdu_data, &pdu[0], pdu_len);
+  return 0;
+}
+
+/* Time in milliseconds to wait for a transaction, including retries */
+static uint64_t transaction_timeout (void)
+{
+  return (uint64_t) apdu_timeout () * (apdu_retries () ? apdu_retries () : 1);
+}
+
+/* Time in milliseconds to wait for the I-Am of a device being bound */
+static uint64_t who_is_timeout (void)
+{
+  uint32_t timeout = __atomic_load_n (&whoIsTimeout, __ATOMIC_RELAXED);
+  return timeout ? timeout : transaction_timeout ();
+}
+
+/* Bind to a device on a remote network, using the router table rather than a Who-Is broadcast */
+static bool bind_routed_device (return_data_t *data, const bacnet_address_t *addr,
+                                const struct timespec *deadline)
+{
+  BACNET_ADDRESS router;
+  struct timespec timeout;
+
+  /* Ask for the router to the network if it is not already known */
+  if (!router_table_get (routerTable, addr->network, &router))
+  {
+    send_who_is_router_to_network (addr->port, addr->network);
+    deadline_set (&timeout, who_is_timeout ());
+    bool limited = deadline_limit (&timeout, deadline);
+    if (!router_table_wait (routerTable, addr->network, &router, &timeout))
+    {
+      iot_log_error (lc, "Error: No router found for network %u", addr->network);
+      /* Giving up at the caller's deadline is not a failure of the device */
+      data->errorDetected = true;
+      data->timedOut = !limited;
+      return false;
+    }
+  }
+
+  /* Send to the router, with the device's network and address as the NPDU destination */
+  data->targetAddress = router;
+  data->targetAddress.net = addr->network;
+  data->targetAddress.len = addr->mac_len;
+  memcpy (data->targetAddress.adr, addr->mac, addr->mac_len);
+  data->maxApdu = MAX_APDU;
+  return true;
+}
+
+/* Send Who-Is request to a device, waiting for its I-Am until the deadline
+ * if it is not NULL and is earlier than the Who-Is timeout
+ */
+static bool bind_device (return_data_t *data, const bacnet_address_t *addr, const struct timespec *deadline)
+{
+  uint32_t deviceInstance = addr->deviceInstance;
+  BACNET_ADDRESS src = {0};
+  unsigned max_apdu = 0;
+  struct timespec timeout;
+
+  /* Check for valid device instance */
+  if (deviceInstance > BACNET_MAX_INSTANCE)
+  {
+    iot_log_error (lc, "device-instance=%u - it must be less than %u",
+                   deviceInstance, BACNET_MAX_INSTANCE);
+    return false;
+  }
+
+  /* Devices behind a router with a configured network address are bound directly */
+  if (addr->network != 0 && addr->mac_len > 0)
+  {
+    return bind_routed_device (data, addr, deadline);
+  }
+
+  /* Try to bind */
+  bool found = binding_table_get (bindingTable, deviceInstance, &max_apdu,
+                                  &data->targetAddress);
+  device_condition_map_t *map;
+  /* Binding was successful */
+  if (found == true)
+  {
+    data->maxApdu = max_apdu;
+    return true;
+  }
+
+  device_condition_map_set (deviceCondtionMapHead, deviceInstance, &src);
+  map = device_condition_map_get (deviceCondtionMapHead, deviceInstance);
+  /* Send Who-Is call */
+  pthread_mutex_lock (&map->mutex);
+  send_who_is (addr->port, deviceInstance, deviceInstance);
+  deadline_set (&timeout, who_is_timeout ());
+  bool limited = deadline_limit (&timeout, deadline);
+
+  /* Wait for devices to respond */
+  pthread_cond_timedwait (&map->condition, &map->mutex, &timeout);
+  pthread_mutex_unlock (&map->mutex);
+  device_condition_map_remove (deviceCondtionMapHead, deviceInstance);
+
+  /* Break if an error has been detected */
+  if (data->errorDetected)
+  {
+    return false;
+  }
+
+  /* Try to bind */
+  found = binding_table_get (bindingTable, deviceInstance, &max_apdu,
+                             &data->targetAddress);
+
+  /* Bind request has returned successfully */
+  if (found)
+  {
+    data->maxApdu = max_apdu;
+    return true;
+  }
+  /* No I-Am was received before the deadline. Giving up at the caller's
+   * deadline is not a failure of the device.
+   */
+  data->errorDetected = true;
+  if (limited)
+  {
+    iot_log_debug (lc, "Device %u was not bound by the deadline", deviceInstance);
+    binding_table_set (pendingBinds, deviceInstance, 0, &src);
+    return false;
+  }
+  iot_log_error (lc, "Error: APDU Timeout!");
+  data->timedOut = true;
+  return false;
+}
+
+/* Send Who-Is request to a device */
+bool find_and_bind (return_data_t *data, const bacnet_address_t *addr)
+{
+  return bind_device (data, addr, NULL);
+}
+
+/* Wait for the executor to complete a request and its data to be returned,
+ * logging a timeout. Returns false if the request failed.
+ */
+bool wait_for_data (return_data_t *data)
+{
+  return_data_wait (data);
+  if (data->timedOut)
+  {
+    iot_log_error (lc, "Error: APDU Timeout!");
+  }
+  return !data->errorDetected;
+}
+
+/* Send an NPDU to a device. BACnet/IP unicasts are queued for the datalink
+ * thread, which sends all the requests queued since it last woke in one call.
+ */
+static bool send_pdu (BACNET_ADDRESS *dest, BACNET_NPDU_DATA *npdu_data,
+                      uint8_t *pdu, unsigned pdu_len)
+{
+#ifdef BACDL_BIP
+  if (dest->mac_len == 6 && dest->net != BACNET_BROADCAST_NETWORK)
+  {
+    unsigned queued = bip_endpoint_queue_unicast (bipEndpoints, bipEndpoints->stack, dest, pdu, pdu_len);
+    if (queued)
+    {
+      /* Only the first request queued needs to wake the thread */
+      if (queued == 1)
+      {
+        wake_datalink_thread ();
+      }
+      return true;
+    }
+  }
+#endif
+  return datalink_send_pdu (dest, npdu_data, pdu, pdu_len) > 0;
+}
+
+/* Transmit the encoded request of a return_data structure, called by its executor */
+static bool send_request (return_data_t *data)
+{
+  return send_pdu (&data->targetAddress, &data->npduData, &data->pdu[0], data->pduLen);
+}
+
+/* Encode a confirmed request APDU for the target of a return_data structure
+ * and submit it to the executor for the device's port and network, which
+ * transmits and retries it. The request is registered under an invoke ID
+ * unique for the target device, so that transactions to different devices do
+ * not share the stack's single invoke ID space. The encode function writes the
+ * APDU for the given invoke ID. The caller then waits with wait_for_data.
+ */
+static bool send_confirmed_request (return_data_t *data, const bacnet_address_t *addr, void *request,
+                                    int (*encode) (uint8_t *apdu, uint8_t invoke_id, void *request))
+{
+  BACNET_ADDRESS my_address;
+
+  if (!return_data_register (returnDataHead, data))
+  {
+    iot_log_error (lc, "Error: No free invoke ID for the device");
+    return false;
+  }
+
+  /* Encode the NPDU and APDU */
+  datalink_get_my_address (&my_address);
+  npdu_encode_npdu_data (&data->npduData, true, (data->priority == REQUEST_PRIORITY_COMMAND) ?
+                         MESSAGE_PRIORITY_URGENT : MESSAGE_PRIORITY_NORMAL);
+  int pdu_len = npdu_encode_pdu (&data->pdu[0], &data->targetAddress, &my_address, &data->npduData);
+  pdu_len += encode (&data->pdu[pdu_len], data->requestInvokeID, request);
+
+  if ((unsigned) pdu_len >= data->maxApdu)
+  {
+    iot_log_error (lc, "Error: Request exceeds the maximum APDU of the device");
+    return false;
+  }
+  data->pduLen = (uint16_t) pdu_len;
+
+  /* Time out after the device's configured timeout, or adaptively from its round trip time */
+  data->deviceInstance = addr->deviceInstance;
+  data->timeout = addr->apduTimeout ? addr->apduTimeout :
+                  rtt_table_timeout (rttTable, addr->deviceInstance, apdu_timeout ());
+  data->retriesLeft = (addr->apduRetries >= 0) ? (uint8_t) addr->apduRetries : apdu_retries ();
+  request_executor_submit (request_executor_get (requestExecutors, addr->port, addr->network), data);
+  return true;
+}
+
+static int encode_read_property (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  return rp_encode_apdu (apdu, invoke_id, (BACNET_READ_PROPERTY_DATA *) request);
+}
+
+static int encode_write_property (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  return wp_encode_apdu (apdu, invoke_id, (BACNET_WRITE_PROPERTY_DATA *) request);
+}
+
+static int encode_subscribe_cov (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  return cov_subscribe_encode_apdu (apdu, MAX_APDU, invoke_id, (BACNET_SUBSCRIBE_COV_DATA *) request);
+}
+
+/* Encode an AddListElement request adding the service to the Recipient_List
+ * of a notification class, as a recipient of confirmed notifications of all
+ * transitions at all times. The recipient is given by address, as the
+ * service's device instance is not configured.
+ */
+static int encode_add_event_recipient (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  uint32_t notification_class = *(uint32_t *) request;
+  BACNET_ADDRESS my_address;
+  BACNET_BIT_STRING bits;
+  BACNET_OCTET_STRING mac;
+  BACNET_TIME time = {0};
+  int len = 0;
+
+  datalink_get_my_address (&my_address);
+  apdu[len++] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST;
+  apdu[len++] = encode_max_segs_max_apdu (0, MAX_APDU);
+  apdu[len++] = invoke_id;
+  apdu[len++] = SERVICE_CONFIRMED_ADD_LIST_ELEMENT;
+  len += encode_context_object_id (&apdu[len], 0, OBJECT_NOTIFICATION_CLASS, notification_class);
+  len += encode_context_enumerated (&apdu[len], 1, PROP_RECIPIENT_LIST);
+  len += encode_opening_tag (&apdu[len], 3);
+  /* Valid days, from time and to time */
+  bitstring_init (&bits);
+  for (uint8_t day = 0; day < 7; day++)
+  {
+    bitstring_set_bit (&bits, day, true);
+  }
+  len += encode_application_bitstring (&apdu[len], &bits);
+  len += encode_application_time (&apdu[len], &time);
+  time.hour = 23;
+  time.min = 59;
+  time.sec = 59;
+  time.hundredths = 99;
+  len += encode_application_time (&apdu[len], &time);
+  /* Recipient address */
+  len += encode_opening_tag (&apdu[len], 1);
+  len += encode_application_unsigned (&apdu[len], my_address.net);
+  octetstring_init (&mac, my_address.mac, my_address.mac_len);
+  len += encode_application_octet_string (&apdu[len], &mac);
+  len += encode_closing_tag (&apdu[len], 1);
+  /* Process identifier, confirmed notifications, and the to-offnormal, to-fault and to-normal transitions */
+  len += encode_application_unsigned (&apdu[len], EVENT_PROCESS_ID);
+  len += encode_application_boolean (&apdu[len], true);
+  bitstring_init (&bits);
+  for (uint8_t transition = 0; transition < 3; transition++)
+  {
+    bitstring_set_bit (&bits, transition, true);
+  }
+  len += encode_application_bitstring (&apdu[len], &bits);
+  len += encode_closing_tag (&apdu[len], 3);
+  return len;
+}
+
+/* A GetEventInformation request, continuing after the last object received if set */
+typedef struct event_information_request_t
+{
+  bool continued;
+  BACNET_OBJECT_ID last;
+} event_information_request_t;
+
+static int encode_get_event_information (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  event_information_request_t *req = (event_information_request_t *) request;
+  return getevent_encode_apdu (apdu, invoke_id, req->continued ? &req->last : NULL);
+}
+
+static int encode_read_range (uint8_t *apdu, uint8_t invoke_id, void *request)
+{
+  return rr_encode_apdu (apdu, invoke_id, (BACNET_READ_RANGE_DATA *) request);
+}
+
+/* Check the circuit breaker of a device before making a request to it */
+static bool allow_request (const bacnet_address_t *addr)
+{
+  if (!circuit_breaker_allow (circuitBreakers, addr->deviceInstance))
+  {
+    iot_log_debug (lc, "Device %u is not responding, failing request", addr->deviceInstance);
+    return false;
+  }
+  return true;
+}
+
+/* Get when a device last answered a request or sent an I-Am, from
+ * stats_now, or 0 if it never has
+ */
+uint64_t bacnet_device_last_heard (uint32_t deviceInstance)
+{
+  return rtt_table_last_heard (rttTable, deviceInstance);
+}
+
+/* Check whether a device is bound, so that a request to it needs no Who-Is */
+bool bacnet_device_bound (uint32_t deviceInstance)
+{
+  BACNET_ADDRESS dest;
+  unsigned max_apdu;
+  return binding_table_get (bindingTable, deviceInstance, &max_apdu, &dest);
+}
+
+/* Record on a device's circuit breaker whether it answered a request, which
+ * may be NULL if the request was never sent
+ */
+static void record_outcome (uint32_t device_id, const return_data_t *data)
+{
+  if (data && data->responded)
+  {
+    circuit_breaker_success (circuitBreakers, device_id);
+  }
+  else if (data && data->timedOut)
+  {
+    circuit_breaker_failure (circuitBreakers, device_id);
+    /* The router to a remote network may have gone; it is found again by the next request */
+    if (data->targetAddress.net != 0 && data->targetAddress.net != BACNET_BROADCAST_NETWORK)
+    {
+      router_table_remove (routerTable, data->targetAddress.net);
+    }
+  }
+  else
+  {
+    circuit_breaker_cancel (circuitBreakers, device_id);
+  }
+}
+
+/* Return the return_data structure of a finished request to the pool,
+ * recording its outcome for the device
+ */
+static void finish_request (const bacnet_address_t *addr, return_data_t *data)
+{
+  record_outcome (addr->deviceInstance, data);
+  return_data_remove_by_ptr (returnDataHead, data);
+}
+
+/* Read Property BACnet call */
+BACNET_APPLICATION_DATA_VALUE *bacnetReadProperty (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority)
+{
+  BACNET_READ_PROPERTY_DATA request = {0};
+  BACNET_APPLICATION_DATA_VALUE *ret = NULL;
+  bool leader;
+
+  /* Share the result of an identical read already in progress */
+  device_read_t *read = device_queue_join_read (deviceQueues, addr->deviceInstance, type, instance,
+                                                property, index, &leader);
+  if (!leader)
+  {
+    return device_queue_wait_read (deviceQueues, addr->deviceInstance, read);
+  }
+  if (!allow_request (addr))
+  {
+    device_queue_finish_read (deviceQueues, addr->deviceInstance, read, NULL);
+    return NULL;
+  }
+  if (!device_queue_enter (deviceQueues, addr->deviceInstance))
+  {
+    iot_log_error (lc, "Error: Request queue for device %u is full", addr->deviceInstance);
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    device_queue_finish_read (deviceQueues, addr->deviceInstance, read, NULL);
+    return NULL;
+  }
+  /* Take a return_data structure from the pool */
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    goto done;
+  }
+  /* Try to bind to device */
+  if (!find_and_bind (data, addr))
+  {
+    finish_request (addr, data);
+    goto done;
+  }
+  /* Send read property request */
+  data->priority = priority;
+  request.object_type = type;
+  request.object_instance = instance;
+  request.object_property = property;
+  request.array_index = index;
+  if (!send_confirmed_request (data, addr, &request, encode_read_property))
+  {
+    finish_request (addr, data);
+    goto done;
+  }
+  /* Wait for data to be set */
+  wait_for_data (data);
+  /* Get copy of value pointer */
+  ret = data->value;
+  value_cache_put (valueCache, addr->deviceInstance, type, instance, property, index, ret);
+
+  finish_request (addr, data);
+
+done:
+  device_queue_leave (deviceQueues, addr->deviceInstance);
+  device_queue_finish_read (deviceQueues, addr->deviceInstance, read, ret);
+  return ret;
+}
+
+/* Issue Who-Is BACnet call to all devices */
+address_entry_ll *bacnetWhoIs ()
+{
+  uint8_t pdu[MAX_PDU];
+  BACNET_ADDRESS dest;
+  BACNET_ADDRESS my_address;
+  BACNET_NPDU_DATA npdu_data;
+  static int32_t Target_Object_Instance_Min = -1;
+  static int32_t Target_Object_Instance_Max = -1;
+  struct timespec timeout;
+  uint32_t wait = __atomic_load_n (&discoveryTimeout, __ATOMIC_RELAXED);
+  deadline_set (&timeout, wait ? wait : transaction_timeout ());
+
+  /* Setup returnData to allow for error handling */
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    return addressEntryHead;
+  }
 
-#ifdef BACDL_BIP
-  /* Setup port to be 0xBAC0 */
-  bip_set_port (htons (0xBAC0));
-#endif
+  /* Get address for broadcasting */
+  datalink_get_broadcast_address (&dest);
+  datalink_get_my_address (&my_address);
 
+  /* Encode Who-Is request */
+  npdu_encode_npdu_data (&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+  int pdu_len = npdu_encode_pdu (&pdu[0], &dest, &my_address, &npdu_data);
+  pdu_len += whois_encode_apdu (&pdu[pdu_len], Target_Object_Instance_Min,
+                                Target_Object_Instance_Max);
 
   /* Send Who-Is request */
-  pthread_mutex_lock (&data->mutex);
-  Send_WhoIs_To_Network (&dest, Target_Object_Instance_Min,
-                         Target_Object_Instance_Max);
+  pace_broadcast (pdu_len);
+#ifdef BACDL_BIP
+  /* Discovery uses its own endpoint, broadcasting to the standard port 0xBAC0 */
+  if (!bbmdActive && bipEndpoints->discovery)
+  {
+    bip_endpoint_send_broadcast (bipEndpoints->discovery, 0xBAC0, &pdu[0], pdu_len);
+  }
+  else
+#endif
+  {
+    datalink_send_pdu (&dest, &npdu_data, &pdu[0], pdu_len);
+  }
 
   /* Wait for until timeout or error is set */
-  pthread_cond_timedwait (&data->condition, &data->mutex, &timeout);
-  pthread_mutex_unlock (&data->mutex);
+  return_data_timedwait (data, &timeout);
 
   /* Free return data structure */
   return_data_remove_by_ptr (returnDataHead, data);
@@ -964,44 +2716,676 @@ address_entry_ll *bacnetWhoIs ()
   return addressEntryHead;
 }
 
+/* Completion of an asynchronous request, which removes it from the device's
+ * queue. The property is that read or subscribed to, whose value is kept when
+ * stale values are served.
+ */
+typedef struct async_request_t
+{
+  uint32_t device_id;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  BACNET_PROPERTY_ID property;
+  uint32_t index;
+  void (*callback) (return_data_t *data, void *context);
+  void *context;
+} async_request_t;
+
+static void async_request_complete (return_data_t *data, void *context)
+{
+  async_request_t *request = (async_request_t *) context;
+  record_outcome (request->device_id, data);
+  if (!data->errorDetected)
+  {
+    value_cache_put (valueCache, request->device_id, request->type, request->instance,
+                     request->property, request->index, data->value);
+  }
+  device_queue_leave (deviceQueues, request->device_id);
+  request->callback (data, request->context);
+  free (request);
+}
+
+/* Start a confirmed request without waiting for the response. The callback
+ * of the completion is run when the request completes, on the thread that
+ * completes it.
+ */
+static bool start_async_request (const bacnet_address_t *addr, uint8_t priority, void *request,
+                                 int (*encode) (uint8_t *apdu, uint8_t invoke_id, void *request),
+                                 const async_request_t *completion, const struct timespec *deadline)
+{
+  if (!allow_request (addr))
+  {
+    return false;
+  }
+  if (!device_queue_enter (deviceQueues, addr->deviceInstance))
+  {
+    iot_log_error (lc, "Error: Request queue for device %u is full", addr->deviceInstance);
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    return false;
+  }
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    device_queue_leave (deviceQueues, addr->deviceInstance);
+    return false;
+  }
+  if (!bind_device (data, addr, deadline))
+  {
+    finish_request (addr, data);
+    device_queue_leave (deviceQueues, addr->deviceInstance);
+    return false;
+  }
+  data->priority = priority;
+  async_request_t *context = malloc (sizeof (async_request_t));
+  *context = *completion;
+  context->device_id = addr->deviceInstance;
+  data->callback = async_request_complete;
+  data->context = context;
+  if (!send_confirmed_request (data, addr, request, encode))
+  {
+    free (context);
+    finish_request (addr, data);
+    device_queue_leave (deviceQueues, addr->deviceInstance);
+    return false;
+  }
+  return true;
+}
+
+/* Start reading a property, binding to the device before the deadline if it is not NULL */
+static bool start_read_property (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority,
+  void (*callback) (return_data_t *data, void *context), void *context,
+  const struct timespec *deadline)
+{
+  BACNET_READ_PROPERTY_DATA request = {0};
+  async_request_t completion = {0};
+  request.object_type = type;
+  request.object_instance = instance;
+  request.object_property = property;
+  request.array_index = index;
+  completion.type = type;
+  completion.instance = instance;
+  completion.property = property;
+  completion.index = index;
+  completion.callback = callback;
+  completion.context = context;
+  return start_async_request (addr, priority, &request, encode_read_property, &completion, deadline);
+}
+
+/* Start reading a property without waiting for the response, binding to the
+ * device before the deadline if it is not NULL. The callback is run when the
+ * request completes, on the thread that completes it.
+ */
+bool bacnetReadPropertyAsync (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority,
+  void (*callback) (return_data_t *data, void *context), void *context,
+  const struct timespec *deadline)
+{
+  return start_read_property (addr, type, instance, property, index, priority, callback, context, deadline);
+}
+
+/* Start subscribing to the COV notifications of an object for lifetime
+ * seconds, or cancel the subscription, without waiting for the response. The
+ * callback is run when the request completes, on the thread that completes it.
+ */
+bool bacnetSubscribeCOVAsync (
+  const bacnet_address_t *addr, int type, uint32_t instance, uint32_t process_id,
+  bool confirmed, uint32_t lifetime, bool cancel,
+  void (*callback) (return_data_t *data, void *context), void *context)
+{
+  BACNET_SUBSCRIBE_COV_DATA request = {0};
+  async_request_t completion = {0};
+  request.subscriberProcessIdentifier = process_id;
+  request.monitoredObjectIdentifier.type = (uint16_t) type;
+  request.monitoredObjectIdentifier.instance = instance;
+  request.cancellationRequest = cancel;
+  request.issueConfirmedNotifications = confirmed;
+  request.lifetime = lifetime;
+  completion.type = type;
+  completion.instance = instance;
+  completion.property = PROP_PRESENT_VALUE;
+  completion.index = BACNET_ARRAY_ALL;
+  completion.callback = callback;
+  completion.context = context;
+  return start_async_request (addr, REQUEST_PRIORITY_BACKGROUND, &request, encode_subscribe_cov,
+                              &completion, NULL);
+}
+
+/* A read waited for until a deadline, which may complete after its waiter
+ * has given up. The last of the waiter and the completion frees it.
+ */
+typedef struct deadline_read_t
+{
+  BACNET_APPLICATION_DATA_VALUE *value;
+  bool done;
+  uint32_t refs;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} deadline_read_t;
+
+static void deadline_read_unref_locked (deadline_read_t *read)
+{
+  if (--read->refs)
+  {
+    pthread_mutex_unlock (&read->mutex);
+    return;
+  }
+  pthread_mutex_unlock (&read->mutex);
+  free (read->value);
+  pthread_cond_destroy (&read->cond);
+  pthread_mutex_destroy (&read->mutex);
+  free (read);
+}
+
+static void deadline_read_complete (return_data_t *data, void *context)
+{
+  deadline_read_t *read = (deadline_read_t *) context;
+  BACNET_APPLICATION_DATA_VALUE *value = data->errorDetected ? NULL : data->value;
+  if (value == NULL && data->value)
+  {
+    free (data->value);
+  }
+  return_data_remove_by_ptr (returnDataHead, data);
+
+  pthread_mutex_lock (&read->mutex);
+  read->value = value;
+  read->done = true;
+  pthread_cond_signal (&read->cond);
+  deadline_read_unref_locked (read);
+}
+
+/* Read a property, giving up at the deadline, or waiting for as long as the
+ * request takes if the deadline is NULL. Binding to the device counts against
+ * the deadline. A response arriving after the deadline still updates the last
+ * known good value.
+ */
+BACNET_APPLICATION_DATA_VALUE *bacnetReadPropertyWithin (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority, const struct timespec *deadline)
+{
+  struct timespec now;
+  BACNET_APPLICATION_DATA_VALUE *ret = NULL;
+
+  if (deadline == NULL)
+  {
+    return bacnetReadProperty (addr, type, instance, property, index, priority);
+  }
+  deadline_now (&now);
+  if (deadline_expired (deadline, &now))
+  {
+    iot_log_debug (lc, "Read of device %u missed its deadline", addr->deviceInstance);
+    return NULL;
+  }
+  deadline_read_t *read = calloc (1, sizeof (deadline_read_t));
+  read->refs = 2;
+  pthread_mutex_init (&read->mutex, NULL);
+  deadline_cond_init (&read->cond);
+  if (!start_read_property (addr, type, instance, property, index, priority,
+                            deadline_read_complete, read, deadline))
+  {
+    pthread_cond_destroy (&read->cond);
+    pthread_mutex_destroy (&read->mutex);
+    free (read);
+    return NULL;
+  }
+
+  pthread_mutex_lock (&read->mutex);
+  while (!read->done)
+  {
+    if (pthread_cond_timedwait (&read->cond, &read->mutex, deadline) == ETIMEDOUT)
+    {
+      iot_log_debug (lc, "Read of device %u missed its deadline", addr->deviceInstance);
+      break;
+    }
+  }
+  ret = read->value;
+  read->value = NULL;
+  deadline_read_unref_locked (read);
+  return ret;
+}
+
+/* Get the last value successfully read from a property and when it was
+ * read, or NULL if stale values are not kept or it has not been read
+ */
+BACNET_APPLICATION_DATA_VALUE *bacnetCachedProperty (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint64_t *origin)
+{
+  return value_cache_get (valueCache, addr->deviceInstance, type, instance, property, index, origin);
+}
+
 /* Issue WriteProperty BACnet call */
 int bacnetWriteProperty (
-  uint32_t deviceInstance, int type, uint32_t instance, int property,
-  uint32_t index, uint16_t port, uint8_t priority,
-  BACNET_APPLICATION_DATA_VALUE *value)
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority, BACNET_APPLICATION_DATA_VALUE *value)
 {
-  return_data_t *data = return_data_set (returnDataHead, 0);
-  data->errorDetected = false;
+  BACNET_WRITE_PROPERTY_DATA request = {0};
+  int ret = 1;
+  if (!allow_request (addr))
+  {
+    return 1;
+  }
+  if (!device_queue_enter (deviceQueues, addr->deviceInstance))
+  {
+    iot_log_error (lc, "Error: Request queue for device %u is full", addr->deviceInstance);
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    return 1;
+  }
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    device_queue_leave (deviceQueues, addr->deviceInstance);
+    return 1;
+  }
+
+  /* Encode the application data for the value list */
+  for (BACNET_APPLICATION_DATA_VALUE *current = value; current; current = current->next)
+  {
+    int len = bacapp_encode_application_data (&request.application_data[request.application_data_len], current);
+    if (len < 0 || (request.application_data_len + len) >= MAX_APDU)
+    {
+      iot_log_error (lc, "Error: Value could not be encoded");
+      goto done;
+    }
+    request.application_data_len += len;
+  }
+  request.object_type = type;
+  request.object_instance = instance;
+  request.object_property = property;
+  request.array_index = index;
+  request.priority = priority;
+  /* Writes are commands, sent ahead of any queued reads */
+  data->priority = REQUEST_PRIORITY_COMMAND;
 
   /* Bind to device */
-  if (!find_and_bind (data, port, deviceInstance))
+  if (!find_and_bind (data, addr))
   {
-    return_data_remove_by_ptr (returnDataHead, data);
-    return 1;
+    goto done;
   }
 
   /* Send Write Property request */
-  pthread_mutex_lock (&data->mutex);
-  pthread_mutex_lock (&returnDataHead->mutex);
-  data->requestInvokeID =
-    Send_Write_Property_Request (deviceInstance,
-                                 type, instance,
-                                 property,
-                                 &value[0],
-                                 priority,
-                                 index);
-  pthread_mutex_unlock (&returnDataHead->mutex);
+  if (!send_confirmed_request (data, addr, &request, encode_write_property))
+  {
+    goto done;
+  }
 
   /* Wait for data to be set */
-  if (!wait_for_data (data))
+  if (wait_for_data (data))
   {
-    return 1;
+    ret = 0;
   }
 
+done:
   /* Free the returned data */
-  return_data_remove_by_ptr (returnDataHead, data);
+  finish_request (addr, data);
+  device_queue_leave (deviceQueues, addr->deviceInstance);
 
-  return 0;
+  return ret;
+}
+
+/* Make a confirmed request and wait for its response, which the ACK handler
+ * decodes into the context if it carries a result. Returns false if the
+ * request failed.
+ */
+static bool confirmed_request (const bacnet_address_t *addr, uint8_t priority, void *request,
+                               int (*encode) (uint8_t *apdu, uint8_t invoke_id, void *request),
+                               void *context)
+{
+  bool ret = false;
+  if (!allow_request (addr))
+  {
+    return false;
+  }
+  if (!device_queue_enter (deviceQueues, addr->deviceInstance))
+  {
+    iot_log_error (lc, "Error: Request queue for device %u is full", addr->deviceInstance);
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    return false;
+  }
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    circuit_breaker_cancel (circuitBreakers, addr->deviceInstance);
+    device_queue_leave (deviceQueues, addr->deviceInstance);
+    return false;
+  }
+  data->priority = priority;
+  data->context = context;
+  if (find_and_bind (data, addr) && send_confirmed_request (data, addr, request, encode))
+  {
+    ret = wait_for_data (data);
+  }
+  finish_request (addr, data);
+  device_queue_leave (deviceQueues, addr->deviceInstance);
+  return ret;
+}
+
+/* Bind to a device, returning the network it is on, 0 for the local network,
+ * or -1 if it could not be bound
+ */
+static int bound_network (const bacnet_address_t *addr)
+{
+  if (addr->network != 0)
+  {
+    return addr->network;
+  }
+  return_data_t *data = return_data_set (returnDataHead);
+  if (data == NULL)
+  {
+    iot_log_error (lc, "Error: Too many transactions in progress");
+    return -1;
+  }
+  int network = find_and_bind (data, addr) ? data->targetAddress.net : -1;
+  finish_request (addr, data);
+  return network;
+}
+
+/* Add the service to the recipients of a notification class of a device,
+ * so that the device sends it confirmed event notifications. Adding it again
+ * has no effect. Returns 0 on success, or -1 if the device is behind a
+ * router: the recipient address carries network 0, which such a device takes
+ * as its own network, and the service has no device instance by which it
+ * could be found instead.
+ */
+int bacnetAddEventRecipient (const bacnet_address_t *addr, uint32_t notification_class)
+{
+  int network = bound_network (addr);
+  if (network < 0)
+  {
+    return 1;
+  }
+  if (network != 0)
+  {
+    return -1;
+  }
+  return confirmed_request (addr, REQUEST_PRIORITY_BACKGROUND, &notification_class,
+                            encode_add_event_recipient, NULL) ? 0 : 1;
+}
+
+/* Read the summaries of the objects of a device with active or
+ * unacknowledged events, after the last object received if last is not NULL.
+ * The summaries are decoded into an array of count entries, and more is set
+ * if further objects remain. Returns the number of summaries, or -1 if the
+ * request failed.
+ */
+int bacnetGetEventInformation (
+  const bacnet_address_t *addr, const BACNET_OBJECT_ID *last,
+  BACNET_GET_EVENT_INFORMATION_DATA *summaries, unsigned count, bool *more)
+{
+  event_information_request_t request = {0};
+  event_information_t info;
+  int found = 0;
+
+  if (count == 0)
+  {
+    return -1;
+  }
+  /* The summaries are decoded into a list linked through the array */
+  memset (summaries, 0, count * sizeof (BACNET_GET_EVENT_INFORMATION_DATA));
+  for (unsigned i = 0; i + 1 < count; i++)
+  {
+    summaries[i].next = &summaries[i + 1];
+  }
+  if (last)
+  {
+    request.continued = true;
+    request.last = *last;
+  }
+  info.summaries = summaries;
+  info.more = false;
+  if (!confirmed_request (addr, REQUEST_PRIORITY_BACKGROUND, &request, encode_get_event_information,
+                          &info))
+  {
+    return -1;
+  }
+  for (BACNET_GET_EVENT_INFORMATION_DATA *summary = summaries; summary && found < (int) count;
+       summary = summary->next)
+  {
+    found++;
+  }
+  *more = info.more;
+  return found;
+}
+
+/* Get the largest APDU a device accepts, at most the largest we accept */
+static unsigned device_max_apdu (const bacnet_address_t *addr)
+{
+  BACNET_ADDRESS dest;
+  unsigned max_apdu = 0;
+  if (!binding_table_get (bindingTable, addr->deviceInstance, &max_apdu, &dest) || max_apdu > MAX_APDU)
+  {
+    max_apdu = MAX_APDU;
+  }
+  return max_apdu;
+}
+
+/* Read the records of a log buffer from a position, or from a sequence number
+ * if by_sequence is set, as many as fit in an APDU of the device and at most
+ * count. more is set if further records follow. Returns the number of
+ * records, or -1 if the request failed.
+ */
+int bacnetReadRange (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  bool by_sequence, uint32_t reference, bacnet_log_record_t *records, unsigned count, bool *more)
+{
+  BACNET_READ_RANGE_DATA request;
+  read_range_t range;
+
+  memset (&request, 0, sizeof (request));
+  request.object_type = (BACNET_OBJECT_TYPE) type;
+  request.object_instance = instance;
+  request.object_property = (BACNET_PROPERTY_ID) property;
+  request.array_index = BACNET_ARRAY_ALL;
+  if (by_sequence)
+  {
+    request.RequestType = RR_BY_SEQUENCE;
+    request.Range.RefSeqNum = reference;
+  }
+  else
+  {
+    request.RequestType = RR_BY_POSITION;
+    request.Range.RefIndex = reference;
+  }
+
+  /* Ask for no more records than fit unsegmented in the smaller APDU */
+  unsigned max_apdu = device_max_apdu (addr);
+  unsigned chunk = (max_apdu > READ_RANGE_ACK_OVERHEAD) ?
+                   (max_apdu - READ_RANGE_ACK_OVERHEAD) / LOG_RECORD_MAX_SIZE : 0;
+  if (chunk == 0)
+  {
+    chunk = 1;
+  }
+  request.Count = (int32_t) ((count < chunk) ? count : chunk);
+
+  range.records = records;
+  range.count = count;
+  range.found = 0;
+  range.more = false;
+  if (count == 0 ||
+      !confirmed_request (addr, REQUEST_PRIORITY_BACKGROUND, &request, encode_read_range, &range))
+  {
+    return -1;
+  }
+  *more = range.more;
+  return (int) range.found;
+}
+
+/* Discard the cached object names of a device if its database revision has changed */
+static void check_database_revision (const bacnet_address_t *addr, const struct timespec *deadline)
+{
+  if (!object_name_map_revision_due (objectNameMap, addr->deviceInstance, OBJECT_NAME_REVALIDATE_INTERVAL))
+  {
+    return;
+  }
+  BACNET_APPLICATION_DATA_VALUE *revision = bacnetReadPropertyWithin (
+    addr, OBJECT_DEVICE, UINT32_MAX, PROP_DATABASE_REVISION, UINT32_MAX, REQUEST_PRIORITY_INTERACTIVE, deadline);
+  if (revision)
+  {
+    if (revision->tag == BACNET_APPLICATION_TAG_UNSIGNED_INT)
+    {
+      object_name_map_set_revision (objectNameMap, addr->deviceInstance, revision->type.Unsigned_Int);
+    }
+    free (revision);
+  }
+}
+
+/* Read the name of an object into the object names of its device, stopping
+ * at the deadline if it is not NULL
+ */
+static bool read_object_name (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type, uint32_t instance,
+                              const struct timespec *deadline)
+{
+  BACNET_APPLICATION_DATA_VALUE *name = bacnetReadPropertyWithin (
+    addr, type, instance, PROP_OBJECT_NAME, UINT32_MAX, REQUEST_PRIORITY_INTERACTIVE, deadline);
+  if (name == NULL)
+  {
+    return false;
+  }
+  if (name->tag == BACNET_APPLICATION_TAG_CHARACTER_STRING)
+  {
+    object_name_map_set (objectNameMap, addr->deviceInstance, name->type.Character_String.value, type, instance);
+  }
+  free (name);
+  return true;
+}
+
+/* Read a device's whole object list in one request. This is only made if the
+ * response fits unsegmented, and, as a request waited for cannot be given up,
+ * if it would time out before the deadline if that is not NULL.
+ */
+static bool read_object_list (const bacnet_address_t *addr, object_list_t *list,
+                              const struct timespec *deadline)
+{
+  BACNET_READ_PROPERTY_DATA request = {0};
+  struct timespec latest;
+
+  if ((uint64_t) list->count * OBJECT_ID_SIZE + OBJECT_LIST_ACK_OVERHEAD > device_max_apdu (addr))
+  {
+    return false;
+  }
+  deadline_set (&latest, transaction_timeout ());
+  if (deadline_limit (&latest, deadline))
+  {
+    return false;
+  }
+  request.object_type = OBJECT_DEVICE;
+  request.object_instance = UINT32_MAX;
+  request.object_property = PROP_OBJECT_LIST;
+  request.array_index = BACNET_ARRAY_ALL;
+  return confirmed_request (addr, REQUEST_PRIORITY_INTERACTIVE, &request, encode_read_property, list);
+}
+
+/* Read the names of the objects of a type from a device's object list, for
+ * devices not answering Who-Has, stopping at the deadline if it is not NULL.
+ * The list is read whole, or an element at a time if the device would have
+ * to segment it. Returns false unless every name was read.
+ */
+static bool scan_object_list (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type,
+                              const struct timespec *deadline)
+{
+  BACNET_APPLICATION_DATA_VALUE *count = bacnetReadPropertyWithin (
+    addr, OBJECT_DEVICE, UINT32_MAX, PROP_OBJECT_LIST, 0, REQUEST_PRIORITY_INTERACTIVE, deadline);
+  if (count == NULL)
+  {
+    return false;
+  }
+  object_list_t list = {0};
+  list.count = (count->tag == BACNET_APPLICATION_TAG_UNSIGNED_INT) ? count->type.Unsigned_Int : 0;
+  free (count);
+
+  list.objects = calloc (list.count ? list.count : 1, sizeof (BACNET_OBJECT_ID));
+  bool whole = read_object_list (addr, &list, deadline);
+  bool complete = true;
+  for (uint32_t i = 0; i < (whole ? list.found : list.count); i++)
+  {
+    if (!whole)
+    {
+      BACNET_APPLICATION_DATA_VALUE *object = bacnetReadPropertyWithin (
+        addr, OBJECT_DEVICE, UINT32_MAX, PROP_OBJECT_LIST, i + 1, REQUEST_PRIORITY_INTERACTIVE, deadline);
+      if (object == NULL)
+      {
+        complete = false;
+        break;
+      }
+      bool valid = (object->tag == BACNET_APPLICATION_TAG_OBJECT_ID);
+      if (valid)
+      {
+        list.objects[i] = object->type.Object_Id;
+      }
+      free (object);
+      if (!valid)
+      {
+        continue;
+      }
+    }
+    if (list.objects[i].type == type && !read_object_name (addr, type, list.objects[i].instance, deadline))
+    {
+      complete = false;
+    }
+  }
+  free (list.objects);
+  return complete;
+}
+
+/* Find the instance of the object of a type with a given name on a device,
+ * giving up at the deadline if it is not NULL
+ */
+bool bacnet_resolve_object_name_within (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type,
+                                        const char *name, uint32_t *instance,
+                                        const struct timespec *deadline)
+{
+  BACNET_OBJECT_TYPE found_type;
+  struct timespec timeout;
+
+  check_database_revision (addr, deadline);
+  if (!object_name_map_get (objectNameMap, addr->deviceInstance, name, &found_type, instance))
+  {
+    /* A name already looked for is not searched for again until it is due */
+    if (object_name_map_missing (objectNameMap, addr->deviceInstance, name))
+    {
+      iot_log_debug (lc, "No object named %s on device %u", name, addr->deviceInstance);
+      return false;
+    }
+    /* Ask the device, then fall back to reading its object list */
+    send_who_has (addr, name);
+    deadline_set (&timeout, apdu_timeout ());
+    deadline_limit (&timeout, deadline);
+    if (!object_name_map_wait (objectNameMap, addr->deviceInstance, name, &found_type, instance, &timeout))
+    {
+      bool complete = scan_object_list (addr, type, deadline);
+      if (!object_name_map_get (objectNameMap, addr->deviceInstance, name, &found_type, instance))
+      {
+        /* Only a name not in a list read completely is known to be missing */
+        if (complete)
+        {
+          object_name_map_set_missing (objectNameMap, addr->deviceInstance, name, OBJECT_NAME_REVALIDATE_INTERVAL);
+        }
+        iot_log_error (lc, "No object named %s found on device %u", name, addr->deviceInstance);
+        return false;
+      }
+    }
+  }
+  if (found_type != type)
+  {
+    iot_log_error (lc, "Object %s on device %u is a %s, not a %s", name, addr->deviceInstance,
+                   bactext_object_type_name (found_type), bactext_object_type_name (type));
+    return false;
+  }
+  return true;
+}
+
+/* Find the instance of the object of a type with a given name on a device */
+bool bacnet_resolve_object_name (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type,
+                                 const char *name, uint32_t *instance)
+{
+  return bacnet_resolve_object_name_within (addr, type, name, instance, NULL);
 }
 
 void print_read_error(iot_logger_t *lc, BACNET_READ_ACCESS_DATA *data) {
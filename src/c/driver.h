@@ -6,15 +6,106 @@
  *
  */
 
+#ifndef DEVICE_BACNET_C_DRIVER_H
+#define DEVICE_BACNET_C_DRIVER_H
+
 #include <apdu.h>
 #include "address_entry.h"
 #include "return_data.h"
 #include <rpm.h>
 #include <wpm.h>
+#include <event.h>
+#include <getevent.h>
+#include <readrange.h>
 #include <devsdk/devsdk.h>
 #include <edgex/edgex-base.h>
 #include "iot/logger.h"
 #include "address_instance_map.h"
+#include "router_table.h"
+#include "binding_table.h"
+#include "object_name_map.h"
+
+#define DEFAULT_BINDING_TABLE_SIZE 4096
+#define DEFAULT_MAX_TRANSACTIONS 1024
+#define DEFAULT_DECODE_WORKERS 2
+#define DEFAULT_NETWORK_WINDOW 32
+#define DEFAULT_DEVICE_QUEUE_DEPTH 16
+#define DEFAULT_BREAKER_THRESHOLD 3
+#define DEFAULT_BREAKER_PROBE_INTERVAL 30000
+#define DEFAULT_LIVENESS_INTERVAL 60000
+#define DEFAULT_RECEIVE_TIMEOUT 100
+#define DEFAULT_COV_LIFETIME 300
+
+/* How a resource is subscribed to for COV notifications, if it is */
+#define BACNET_COV_NONE 0
+#define BACNET_COV_UNCONFIRMED 1
+#define BACNET_COV_CONFIRMED 2
+
+/* Interval in milliseconds between checks of a device's database revision */
+#define OBJECT_NAME_REVALIDATE_INTERVAL 300000
+
+/* Driver options read from the Driver section of the configuration. Those
+ * from network_window to receive_timeout, other than serve_stale, are in the
+ * Writable section and are applied while the driver runs when changed.
+ */
+typedef struct bacnet_config_t
+{
+  /* Maximum number of device address bindings held */
+  uint32_t binding_table_size;
+  /* Maximum number of confirmed requests in progress at once */
+  uint32_t max_transactions;
+  /* Number of threads decoding received frames, 0 to decode on the datalink thread */
+  uint32_t decode_workers;
+  /* Lifetime in seconds of COV subscriptions, which are renewed before it ends */
+  uint32_t cov_lifetime;
+  /* Maximum number of confirmed requests in flight on each port and network */
+  uint32_t network_window;
+  /* Maximum number of requests in progress to each device */
+  uint32_t device_queue_depth;
+  /* Consecutive timeouts after which requests to a device fail at once, 0 to
+   * never fail them, and the interval in milliseconds between probes
+   */
+  uint32_t breaker_threshold;
+  uint32_t breaker_probe_interval;
+  /* Interval in milliseconds in which each device with auto-events is checked
+   * to be up, 0 to not check devices
+   */
+  uint32_t liveness_interval;
+  /* Serve the last known good value of a point when a read fails, or when
+   * it takes longer than stale_deadline milliseconds if that is not 0
+   */
+  bool serve_stale;
+  uint32_t stale_deadline;
+  /* Budgets in packets and bytes per second, 0 for unlimited */
+  uint32_t datalink_packet_rate;
+  uint32_t datalink_byte_rate;
+  uint32_t network_packet_rate;
+  uint32_t network_byte_rate;
+  uint32_t bbmd_packet_rate;
+  uint32_t bbmd_byte_rate;
+  /* APDU timeout in milliseconds, 0 to leave the stack's setting, and
+   * retries, -1 to leave the stack's setting
+   */
+  uint32_t apdu_timeout;
+  int apdu_retries;
+  /* Milliseconds to wait for I-Am responses when binding a device and in
+   * discovery, 0 for the APDU timeout times the retries
+   */
+  uint32_t who_is_timeout;
+  uint32_t discovery_timeout;
+  /* Milliseconds the MS/TP datalink waits for a frame before checking for shutdown */
+  uint32_t receive_timeout;
+  /* Budgets of particular networks, as "network:packets:bytes" entries, read at startup */
+  const char *network_rates;
+  /* CPU the datalink thread is pinned to, or -1, and its SCHED_FIFO priority, or 0 */
+  int datalink_cpu;
+  int datalink_priority;
+  /* Comma separated CPUs the decode workers are pinned to in turn, read at
+   * startup, and their SCHED_FIFO priority, or 0
+   */
+  const char *decode_cpus;
+  int decode_priority;
+} bacnet_config_t;
 
 typedef struct bacnet_driver
 {
@@ -24,6 +115,17 @@ typedef struct bacnet_driver
   pthread_t datalink_thread;
   bool running_thread;
   const char *default_device_path;
+  bacnet_config_t config;
+  /* Auto-events read asynchronously by the driver */
+  struct autoevent_ll *autoevents;
+  /* Monitor of the operating state of devices, or NULL */
+  struct liveness_ll *liveness;
+  /* COV subscriptions of auto-events, or NULL */
+  struct cov_manager_ll *cov;
+  /* Event states of auto-events pushed by event notifications, or NULL */
+  struct event_manager_ll *events;
+  /* Trend logs harvested by auto-events, or NULL */
+  struct trend_log_ll *trends;
 } bacnet_driver;
 
 typedef struct
@@ -32,21 +134,112 @@ typedef struct
   BACNET_PROPERTY_ID property;
   BACNET_OBJECT_TYPE type;
   uint32_t index;
+  /* Object name, resolved to the instance when set */
+  char *name;
+  /* Subscription to COV notifications in place of polling, one of BACNET_COV_* */
+  uint8_t cov;
+  /* Control group written with WriteGroup, 0 for none, and the channel number in it */
+  uint32_t group;
+  uint16_t channel;
 } bacnet_attributes_t;
 
+typedef struct
+{
+  uint16_t port;
+  uint32_t deviceInstance;
+  /* Remote network number (DNET) of a routed device, 0 if directly connected */
+  uint16_t network;
+  /* Address of a routed device on its remote network (DADR) */
+  uint8_t mac_len;
+  uint8_t mac[MAX_MAC_LEN];
+  /* Request timeout in milliseconds, 0 to adapt it to the device's round
+   * trip time, and retries, -1 for the stack's default
+   */
+  uint32_t apduTimeout;
+  int apduRetries;
+  /* Notification class the service registers with for event notifications, or UINT32_MAX */
+  uint32_t notificationClass;
+} bacnet_address_t;
+
 int bacnetWriteProperty (
-  uint32_t deviceInstance, int type, uint32_t instance, int property,
-  uint32_t index, uint16_t port, uint8_t priority,
-  BACNET_APPLICATION_DATA_VALUE *value);
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority, BACNET_APPLICATION_DATA_VALUE *value);
+
+/* A value written to a channel by WriteGroup */
+typedef struct bacnet_channel_value_t
+{
+  uint16_t channel;
+  BACNET_APPLICATION_DATA_VALUE value;
+} bacnet_channel_value_t;
+
+int bacnetWriteGroup (const bacnet_address_t *addr, uint32_t group, uint8_t priority,
+                      const bacnet_channel_value_t *values, unsigned count);
 
 address_entry_ll *bacnetWhoIs (void);
 
 BACNET_APPLICATION_DATA_VALUE *bacnetReadProperty (
-  uint32_t deviceInstance, int type, uint32_t instance, int property,
-  uint32_t index, uint16_t port);
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority);
+
+bool bacnetReadPropertyAsync (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority,
+  void (*callback) (return_data_t *data, void *context), void *context,
+  const struct timespec *deadline);
+
+bool bacnetSubscribeCOVAsync (
+  const bacnet_address_t *addr, int type, uint32_t instance, uint32_t process_id,
+  bool confirmed, uint32_t lifetime, bool cancel,
+  void (*callback) (return_data_t *data, void *context), void *context);
+
+/* Handler of COV notifications, run on the thread decoding them */
+typedef void (*bacnet_cov_handler_t) (void *context, uint32_t device_id, uint32_t process_id,
+                                      BACNET_OBJECT_TYPE type, uint32_t instance,
+                                      BACNET_PROPERTY_VALUE *values);
+
+void bacnet_set_cov_handler (bacnet_cov_handler_t handler, void *context);
+
+/* Handler of event notifications, run on the thread decoding them */
+typedef void (*bacnet_event_handler_t) (void *context, const BACNET_EVENT_NOTIFICATION_DATA *data);
+
+void bacnet_set_event_handler (bacnet_event_handler_t handler, void *context);
+
+int bacnetAddEventRecipient (const bacnet_address_t *addr, uint32_t notification_class);
+
+int bacnetGetEventInformation (
+  const bacnet_address_t *addr, const BACNET_OBJECT_ID *last,
+  BACNET_GET_EVENT_INFORMATION_DATA *summaries, unsigned count, bool *more);
+
+/* A record of a log buffer. Records of a status change, time change, failure
+ * or null value have no value.
+ */
+typedef struct bacnet_log_record_t
+{
+  uint32_t sequence;
+  BACNET_DATE_TIME timestamp;
+  bool hasValue;
+  BACNET_APPLICATION_DATA_VALUE value;
+  bool hasStatus;
+  BACNET_BIT_STRING status;
+} bacnet_log_record_t;
+
+int bacnetReadRange (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  bool by_sequence, uint32_t reference, bacnet_log_record_t *records, unsigned count, bool *more);
+
+BACNET_APPLICATION_DATA_VALUE *bacnetReadPropertyWithin (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint8_t priority, const struct timespec *deadline);
+
+BACNET_APPLICATION_DATA_VALUE *bacnetCachedProperty (
+  const bacnet_address_t *addr, int type, uint32_t instance, int property,
+  uint32_t index, uint64_t *origin);
 
 int init_bacnet_driver (pthread_t *datalink_thread, bool *running,
-                        iot_logger_t *logging_client);
+                        iot_logger_t *logging_client,
+                        const bacnet_config_t *config);
+
+void reconfigure_bacnet_driver (const bacnet_config_t *config);
 
 void deinit_bacnet_driver (pthread_t *datalink_thread, bool *running);
 
@@ -54,8 +247,7 @@ BACNET_APPLICATION_DATA_VALUE *
 bacnet_read_application_data_value_add (BACNET_APPLICATION_DATA_VALUE *head,
                                         BACNET_APPLICATION_DATA_VALUE *result);
 
-bool
-find_and_bind (return_data_t *data, uint16_t port, uint32_t deviceInstance);
+bool find_and_bind (return_data_t *data, const bacnet_address_t *addr);
 
 bool wait_for_data (return_data_t *data);
 
@@ -82,7 +274,8 @@ void get_protocol_properties (const devsdk_protocols *protocols,
 bool
 read_access_data_populate (BACNET_READ_ACCESS_DATA **head, uint32_t nreadings,
                            const devsdk_commandrequest *requests,
-                           bacnet_driver *driver);
+                           const bacnet_address_t *addr,
+                           bacnet_driver *driver, const struct timespec *deadline);
 
 void read_access_data_free (BACNET_READ_ACCESS_DATA *head);
 
@@ -90,21 +283,37 @@ void devsdk_commandresult_populate (devsdk_commandresult *readings,
                                           BACNET_APPLICATION_DATA_VALUE *read_results,
                                           uint32_t nreadings);
 
+bool bacnet_value_from_data (const iot_data_t *data, BACNET_APPLICATION_DATA_VALUE *value, iot_logger_t *lc);
+
 bool
 write_access_data_populate (BACNET_WRITE_ACCESS_DATA **head, uint32_t nvalues,
                             const devsdk_commandrequest *requests,
                             const iot_data_t *values[],
+                            const bacnet_address_t *addr,
                             bacnet_driver *driver);
 
 void write_access_data_free (BACNET_WRITE_ACCESS_DATA *head);
 
 bool
-get_device_properties (address_entry_t *device, uint16_t port, iot_logger_t *lc,
+get_device_properties (address_entry_t *device, const bacnet_address_t *addr, iot_logger_t *lc,
                        char **name, char **description, devsdk_strings *labels,
                        char **profile_name);
 
 void bacnet_protocol_populate (address_entry_t *device, iot_data_t *properties, bacnet_driver *driver);
 
+void bacnet_address_from_entry (address_entry_t *device, bacnet_address_t *addr);
+
+bool bacnet_resolve_object_name (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type,
+                                 const char *name, uint32_t *instance);
+
+bool bacnet_resolve_object_name_within (const bacnet_address_t *addr, BACNET_OBJECT_TYPE type,
+                                        const char *name, uint32_t *instance,
+                                        const struct timespec *deadline);
+
+uint64_t bacnet_device_last_heard (uint32_t deviceInstance);
+
+bool bacnet_device_bound (uint32_t deviceInstance);
+
 void print_read_error(iot_logger_t *lc, BACNET_READ_ACCESS_DATA *data);
 
 #ifndef MAX_PROPERTY_VALUES
@@ -115,6 +324,10 @@ void print_read_error(iot_logger_t *lc, BACNET_READ_ACCESS_DATA *data);
 #define DISCOVERY_DESCRIPTION "automatically discovered using EdgeX discovery"
 #define BACNET_MAX_INSTANCE_LENGTH 11
 #define MAX_PORT_LENGTH 6
+#define MAX_NETWORK_LENGTH 6
+#define MAX_MAC_STRING_LENGTH (3 * MAX_MAC_LEN)
 #define DEFAULT_MSTP_PATH "/dev/ttyUSB0"
 
 extern return_data_ll *returnDataHead;
+
+#endif //DEVICE_BACNET_C_DRIVER_H
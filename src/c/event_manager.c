@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include <iot/time.h>
+#include <bactext.h>
+#include "event_manager.h"
+#include "hash.h"
+#include "deadline.h"
+
+static uint32_t event_manager_hash (uint32_t device_id)
+{
+  return hash_word (HASH_INIT, device_id) % EVENT_MANAGER_BUCKETS;
+}
+
+static event_device_t *event_manager_get_locked (event_manager_ll *list, uint32_t device_id)
+{
+  event_device_t *current = list->buckets[event_manager_hash (device_id)];
+  while (current && current->address.deviceInstance != device_id)
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+/* Find the watch of an object of a device, once its instance is known */
+static event_watch_t *event_manager_watch_locked (event_device_t *dev, BACNET_OBJECT_TYPE type,
+                                                  uint32_t instance)
+{
+  event_watch_t *watch = dev->watches;
+  while (watch && (watch->removed || (watch->name && !watch->resolved) ||
+                   watch->type != type || watch->instance != instance))
+  {
+    watch = watch->next;
+  }
+  return watch;
+}
+
+static void event_manager_free_watch (event_watch_t *watch)
+{
+  free (watch->resource);
+  free (watch->name);
+  free (watch);
+}
+
+static void event_manager_free_device (event_device_t *dev)
+{
+  event_watch_t *watch = dev->watches;
+  while (watch)
+  {
+    event_watch_t *next = watch->next;
+    event_manager_free_watch (watch);
+    watch = next;
+  }
+  free (dev->name);
+  free (dev);
+}
+
+static void event_manager_unlink_device_locked (event_manager_ll *list, event_device_t *dev)
+{
+  event_device_t **link = &list->buckets[event_manager_hash (dev->address.deviceInstance)];
+  while (*link != dev)
+  {
+    link = &(*link)->next;
+  }
+  *link = dev->next;
+  link = &list->first;
+  while (*link != dev)
+  {
+    link = &(*link)->order_next;
+  }
+  *link = dev->order_next;
+}
+
+/* Post the event state of a resource, with tags describing the notification if any */
+static void event_manager_post (event_manager_ll *list, const char *device, const char *resource,
+                                uint32_t state, iot_data_t *tags)
+{
+  /* The reading takes the value, which it frees */
+  BACNET_APPLICATION_DATA_VALUE *value = calloc (1, sizeof (BACNET_APPLICATION_DATA_VALUE));
+  value->tag = BACNET_APPLICATION_TAG_ENUMERATED;
+  value->type.Enumerated = state;
+  devsdk_commandresult *result = calloc (1, sizeof (devsdk_commandresult));
+  devsdk_commandresult_populate (result, value, 1);
+  result->origin = iot_time_nsecs ();
+  result->tags = tags;
+  devsdk_post_readings (list->service, device, resource, result);
+  devsdk_commandresult_free (result, 1);
+}
+
+/* Post the state of the watched object of a summary, if any, marking it reported */
+static void event_manager_sync_summary (event_manager_ll *list, event_device_t *dev,
+                                        const BACNET_GET_EVENT_INFORMATION_DATA *summary)
+{
+  pthread_mutex_lock (&list->mutex);
+  event_watch_t *watch = event_manager_watch_locked (dev, (BACNET_OBJECT_TYPE) summary->objectIdentifier.type,
+                                                     summary->objectIdentifier.instance);
+  if (watch == NULL)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+  watch->reported = true;
+  char *resource = strdup (watch->resource);
+  pthread_mutex_unlock (&list->mutex);
+
+  iot_data_t *tags = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (tags, "notifyType",
+                           iot_data_alloc_string (bactext_notify_type_name (summary->notifyType), IOT_DATA_COPY));
+  event_manager_post (list, dev->name, resource, (uint32_t) summary->eventState, tags);
+  free (resource);
+}
+
+/* Read the event states of a device's objects, posting those of the watched
+ * objects, and normal for the watched objects not listed. Returns false if
+ * the states could not be read.
+ */
+static bool event_manager_sync (event_manager_ll *list, event_device_t *dev)
+{
+  BACNET_GET_EVENT_INFORMATION_DATA summaries[EVENT_SUMMARIES];
+  BACNET_OBJECT_ID last;
+  bool more = true;
+  bool continued = false;
+
+  pthread_mutex_lock (&list->mutex);
+  for (event_watch_t *watch = dev->watches; watch; watch = watch->next)
+  {
+    watch->reported = false;
+  }
+  pthread_mutex_unlock (&list->mutex);
+
+  while (more)
+  {
+    int found = bacnetGetEventInformation (&dev->address, continued ? &last : NULL, summaries,
+                                           EVENT_SUMMARIES, &more);
+    if (found < 0)
+    {
+      return false;
+    }
+    for (int i = 0; i < found; i++)
+    {
+      event_manager_sync_summary (list, dev, &summaries[i]);
+    }
+    if (found == 0)
+    {
+      break;
+    }
+    last = summaries[found - 1].objectIdentifier;
+    continued = true;
+  }
+
+  /* Objects not listed are in the normal state */
+  for (;;)
+  {
+    pthread_mutex_lock (&list->mutex);
+    event_watch_t *watch = dev->watches;
+    while (watch && (watch->removed || watch->reported))
+    {
+      watch = watch->next;
+    }
+    if (watch == NULL)
+    {
+      pthread_mutex_unlock (&list->mutex);
+      break;
+    }
+    watch->reported = true;
+    char *resource = strdup (watch->resource);
+    pthread_mutex_unlock (&list->mutex);
+    event_manager_post (list, dev->name, resource, EVENT_STATE_NORMAL, NULL);
+    free (resource);
+  }
+  return true;
+}
+
+/* Resolve the object names of a device's watches, which are not freed while
+ * the device is busy
+ */
+static bool event_manager_resolve (event_manager_ll *list, event_device_t *dev)
+{
+  for (;;)
+  {
+    uint32_t instance;
+    pthread_mutex_lock (&list->mutex);
+    event_watch_t *watch = dev->watches;
+    while (watch && (watch->removed || watch->name == NULL || watch->resolved))
+    {
+      watch = watch->next;
+    }
+    pthread_mutex_unlock (&list->mutex);
+    if (watch == NULL)
+    {
+      return true;
+    }
+    if (!bacnet_resolve_object_name (&dev->address, watch->type, watch->name, &instance))
+    {
+      return false;
+    }
+    pthread_mutex_lock (&list->mutex);
+    watch->instance = instance;
+    watch->resolved = true;
+    pthread_mutex_unlock (&list->mutex);
+  }
+}
+
+/* Add the service to the recipients of a device's notification class and
+ * synchronize the event states of its watched objects
+ */
+static bool event_manager_register (event_manager_ll *list, event_device_t *dev)
+{
+  int result = bacnetAddEventRecipient (&dev->address, dev->address.notificationClass);
+  if (result < 0)
+  {
+    iot_log_debug (list->lc, "Device %s is behind a router, so its event states are polled", dev->name);
+    return false;
+  }
+  if (result != 0)
+  {
+    iot_log_warn (list->lc, "Unable to register for event notifications of device %s", dev->name);
+    return false;
+  }
+  if (!event_manager_resolve (list, dev) || !event_manager_sync (list, dev))
+  {
+    iot_log_warn (list->lc, "Unable to read the event states of device %s", dev->name);
+    return false;
+  }
+  iot_log_info (list->lc, "Registered for event notifications of device %s", dev->name);
+  return true;
+}
+
+/* Free the watches removed while a device was registering */
+static void event_manager_purge_locked (event_device_t *dev)
+{
+  event_watch_t **link = &dev->watches;
+  while (*link)
+  {
+    event_watch_t *watch = *link;
+    if (watch->removed)
+    {
+      *link = watch->next;
+      event_manager_free_watch (watch);
+    }
+    else
+    {
+      link = &watch->next;
+    }
+  }
+}
+
+/* Post an event notification for a watched object as its event state, tagged
+ * with the details of the notification. Run on the thread decoding it.
+ */
+static void event_manager_notify (void *context, const BACNET_EVENT_NOTIFICATION_DATA *data)
+{
+  event_manager_ll *list = (event_manager_ll *) context;
+  event_watch_t *watch = NULL;
+
+  pthread_mutex_lock (&list->mutex);
+  event_device_t *dev = event_manager_get_locked (list, data->initiatingObjectIdentifier.instance);
+  if (dev)
+  {
+    watch = event_manager_watch_locked (dev, (BACNET_OBJECT_TYPE) data->eventObjectIdentifier.type,
+                                        data->eventObjectIdentifier.instance);
+  }
+  if (watch == NULL)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+  char *device = strdup (dev->name);
+  char *resource = strdup (watch->resource);
+  pthread_mutex_unlock (&list->mutex);
+
+  iot_data_t *tags = iot_data_alloc_map (IOT_DATA_STRING);
+  iot_data_string_map_add (tags, "eventType",
+                           iot_data_alloc_string (bactext_event_type_name (data->eventType), IOT_DATA_COPY));
+  iot_data_string_map_add (tags, "notifyType",
+                           iot_data_alloc_string (bactext_notify_type_name (data->notifyType), IOT_DATA_COPY));
+  iot_data_string_map_add (tags, "priority", iot_data_alloc_ui8 (data->priority));
+  if (data->notifyType != NOTIFY_ACK_NOTIFICATION)
+  {
+    iot_data_string_map_add (tags, "fromState",
+                             iot_data_alloc_string (bactext_event_state_name (data->fromState), IOT_DATA_COPY));
+    iot_data_string_map_add (tags, "ackRequired", iot_data_alloc_bool (data->ackRequired));
+  }
+  if (data->messageText && characterstring_length (data->messageText))
+  {
+    iot_data_string_map_add (tags, "message",
+                             iot_data_alloc_string (characterstring_value (data->messageText), IOT_DATA_COPY));
+  }
+  event_manager_post (list, device, resource, (uint32_t) data->toState, tags);
+  free (device);
+  free (resource);
+}
+
+static void *event_manager_run (void *arg)
+{
+  event_manager_ll *list = (event_manager_ll *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  while (list->running)
+  {
+    /* Find a device due to be registered, and when the next one is */
+    event_device_t *due = NULL;
+    const struct timespec *earliest = NULL;
+    deadline_now (&now);
+    for (event_device_t *dev = list->first; dev && due == NULL; dev = dev->order_next)
+    {
+      /* Registrations of a device that is down would only time out */
+      if (dev->busy || dev->down)
+      {
+        continue;
+      }
+      if (deadline_expired (&dev->due, &now))
+      {
+        due = dev;
+      }
+      else if (earliest == NULL || deadline_expired (&dev->due, earliest))
+      {
+        earliest = &dev->due;
+      }
+    }
+
+    if (due)
+    {
+      due->busy = true;
+      due->resync = false;
+      pthread_mutex_unlock (&list->mutex);
+      bool registered = event_manager_register (list, due);
+      pthread_mutex_lock (&list->mutex);
+      due->busy = false;
+      if (due->removed)
+      {
+        event_manager_free_device (due);
+        continue;
+      }
+      event_manager_purge_locked (due);
+      /* A device already registered keeps receiving notifications if the
+       * registration fails; only the registration is retried
+       */
+      if (registered)
+      {
+        due->registered = true;
+      }
+      if (!due->resync)
+      {
+        deadline_set (&due->due, registered ? EVENT_REFRESH_INTERVAL : EVENT_RETRY_INTERVAL);
+      }
+      continue;
+    }
+
+    deadline_wait (&list->wakeup, &list->mutex, earliest);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return NULL;
+}
+
+/* Note a change of a device's state, registering it again once it is back
+ * up as it may have restarted and lost its recipients. Run on the liveness
+ * thread.
+ */
+static void event_manager_liveness (void *context, uint32_t device_id, bool up)
+{
+  event_manager_ll *list = (event_manager_ll *) context;
+
+  pthread_mutex_lock (&list->mutex);
+  event_device_t *dev = event_manager_get_locked (list, device_id);
+  if (dev && up && dev->down)
+  {
+    /* States may have changed unnoticed, so they are read until registered */
+    dev->registered = false;
+    dev->resync = true;
+    deadline_now (&dev->due);
+    pthread_cond_signal (&list->wakeup);
+  }
+  if (dev)
+  {
+    dev->down = !up;
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Create an empty set of devices, start its thread and receive the event
+ * notifications of the driver, and the state changes of the liveness monitor
+ */
+event_manager_ll *event_manager_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness)
+{
+  event_manager_ll *list = calloc (1, sizeof (event_manager_ll));
+  list->service = service;
+  list->lc = lc;
+  list->liveness = liveness;
+  list->running = true;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->wakeup);
+  pthread_create (&list->thread, NULL, event_manager_run, list);
+  bacnet_set_event_handler (event_manager_notify, list);
+  liveness_set_handler (liveness, event_manager_liveness, list);
+  return list;
+}
+
+/* Stop the thread, so that no more devices are registered */
+void event_manager_stop (event_manager_ll *list)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool running = list->running;
+  list->running = false;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  if (running)
+  {
+    pthread_join (list->thread, NULL);
+  }
+}
+
+/* Free the devices. The driver must have stopped, so that no notifications
+ * are being decoded.
+ */
+void event_manager_free (event_manager_ll *list)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  event_manager_stop (list);
+  bacnet_set_event_handler (NULL, NULL);
+
+  event_device_t *current = list->first;
+  while (current)
+  {
+    event_device_t *next = current->order_next;
+    event_manager_free_device (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->wakeup);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Watch the event state of an object for a resource of a device, which has a
+ * notification class. The device is registered, or its event states read
+ * again if it already was.
+ */
+event_watch_t *event_manager_add (event_manager_ll *list, const devsdk_device_t *device,
+                                  const char *resource, const bacnet_attributes_t *attrs)
+{
+  bacnet_address_t *address = (bacnet_address_t *) device->address;
+  event_watch_t *watch = calloc (1, sizeof (event_watch_t));
+  watch->resource = strdup (resource);
+  watch->type = attrs->type;
+  watch->instance = attrs->instance;
+  watch->name = attrs->name ? strdup (attrs->name) : NULL;
+
+  pthread_mutex_lock (&list->mutex);
+  event_device_t *dev = event_manager_get_locked (list, address->deviceInstance);
+  if (dev == NULL)
+  {
+    uint32_t bucket = event_manager_hash (address->deviceInstance);
+    dev = calloc (1, sizeof (event_device_t));
+    dev->name = strdup (device->name);
+    dev->address = *address;
+    dev->next = list->buckets[bucket];
+    list->buckets[bucket] = dev;
+    dev->order_next = list->first;
+    list->first = dev;
+  }
+  watch->device = dev;
+  watch->next = dev->watches;
+  dev->watches = watch;
+  dev->count++;
+  dev->resync = true;
+  deadline_now (&dev->due);
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  return watch;
+}
+
+/* Stop watching an object, removing its device when it has no more watches */
+void event_manager_remove (event_manager_ll *list, event_watch_t *watch)
+{
+  pthread_mutex_lock (&list->mutex);
+  event_device_t *dev = watch->device;
+  if (dev->busy)
+  {
+    watch->removed = true;
+  }
+  else
+  {
+    event_watch_t **link = &dev->watches;
+    while (*link != watch)
+    {
+      link = &(*link)->next;
+    }
+    *link = watch->next;
+    event_manager_free_watch (watch);
+  }
+  if (--dev->count == 0)
+  {
+    event_manager_unlink_device_locked (list, dev);
+    if (dev->busy)
+    {
+      dev->removed = true;
+    }
+    else
+    {
+      event_manager_free_device (dev);
+    }
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Check whether the event state of a watched object is pushed by notifications */
+bool event_manager_is_active (event_manager_ll *list, event_watch_t *watch)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool active = watch->device->registered;
+  pthread_mutex_unlock (&list->mutex);
+  return active;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <devsdk/devsdk.h>
+#include "driver.h"
+#include "liveness.h"
+
+#ifndef DEVICE_BACNET_C_EVENT_MANAGER_H
+#define DEVICE_BACNET_C_EVENT_MANAGER_H
+
+#define EVENT_MANAGER_BUCKETS 1024
+
+/* Milliseconds before a device whose registration failed is tried again */
+#define EVENT_RETRY_INTERVAL 60000
+
+/* Milliseconds between registrations of a registered device, which may have
+ * lost its recipients by restarting unnoticed
+ */
+#define EVENT_REFRESH_INTERVAL 3600000
+
+/* Event summaries read with each GetEventInformation request */
+#define EVENT_SUMMARIES 32
+
+/* A resource reporting the event state of an object, posted when an event
+ * notification for the object arrives
+ */
+typedef struct event_watch_t
+{
+  struct event_device_t *device;
+  char *resource;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  /* Object name, resolved to the instance when registering when set */
+  char *name;
+  bool resolved;
+  /* Set when the state was posted by the current synchronization */
+  bool reported;
+  /* Set when removed while its device is registering, to be freed after */
+  bool removed;
+  struct event_watch_t *next;
+} event_watch_t;
+
+/* A device sending event notifications to the service, once it has been
+ * added to the recipients of the device's notification class
+ */
+typedef struct event_device_t
+{
+  char *name;
+  bacnet_address_t address;
+  event_watch_t *watches;
+  /* Number of watches not removed */
+  uint32_t count;
+  /* Set once registered with the device and its event states synchronized,
+   * and when it must be registered again as soon as possible, as watches were
+   * added or the device came back up
+   */
+  bool registered;
+  bool resync;
+  /* Set while the liveness monitor finds the device down */
+  bool down;
+  /* When registration is next tried, or refreshed once registered */
+  struct timespec due;
+  /* Set while registering, and when removed meanwhile, so the thread frees the device */
+  bool busy;
+  bool removed;
+  /* Next device in the same hash bucket, and in the list */
+  struct event_device_t *next;
+  struct event_device_t *order_next;
+} event_device_t;
+
+/* Devices hashed by device instance, with a thread registering them and
+ * synchronizing their event states with GetEventInformation
+ */
+typedef struct event_manager_ll
+{
+  event_device_t *buckets[EVENT_MANAGER_BUCKETS];
+  event_device_t *first;
+  devsdk_service_t *service;
+  iot_logger_t *lc;
+  /* Monitor telling when devices come back up, or NULL */
+  liveness_ll *liveness;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+} event_manager_ll;
+
+event_manager_ll *event_manager_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness);
+
+void event_manager_stop (event_manager_ll *list);
+
+void event_manager_free (event_manager_ll *list);
+
+event_watch_t *event_manager_add (event_manager_ll *list, const devsdk_device_t *device,
+                                  const char *resource, const bacnet_attributes_t *attrs);
+
+void event_manager_remove (event_manager_ll *list, event_watch_t *watch);
+
+bool event_manager_is_active (event_manager_ll *list, event_watch_t *watch);
+
+#endif //DEVICE_BACNET_C_EVENT_MANAGER_H
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "frame_queue.h"
+
+/* Create a ring holding depth frames, rounded up to a power of two */
+frame_queue_t *frame_queue_alloc (uint32_t depth)
+{
+  uint32_t capacity = 1;
+  while (capacity < depth)
+  {
+    capacity <<= 1;
+  }
+  frame_queue_t *queue = aligned_alloc (FRAME_QUEUE_CACHE_LINE, sizeof (frame_queue_t));
+  memset (queue, 0, sizeof (frame_queue_t));
+  queue->frames = malloc (capacity * sizeof (frame_t));
+  queue->mask = capacity - 1;
+  sem_init (&queue->available, 0, 0);
+  return queue;
+}
+
+void frame_queue_free (frame_queue_t *queue)
+{
+  sem_destroy (&queue->available);
+  free (queue->frames);
+  free (queue);
+}
+
+/* Add a frame to the ring, returning false if it is full. Producer only. */
+bool frame_queue_push (frame_queue_t *queue, const BACNET_ADDRESS *src,
+                       const uint8_t *pdu, uint16_t pdu_len, uint64_t received)
+{
+  uint32_t tail = queue->tail;
+  if (tail - __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE) > queue->mask)
+  {
+    queue->dropped++;
+    return false;
+  }
+  frame_t *frame = &queue->frames[tail & queue->mask];
+  frame->src = *src;
+  frame->pdu_len = pdu_len;
+  frame->received = received;
+  memcpy (frame->pdu, pdu, pdu_len);
+  __atomic_store_n (&queue->tail, tail + 1, __ATOMIC_RELEASE);
+  sem_post (&queue->available);
+  return true;
+}
+
+/* Get the oldest frame without removing it, or NULL if the ring is empty. Consumer only. */
+frame_t *frame_queue_peek (frame_queue_t *queue)
+{
+  uint32_t head = queue->head;
+  if (head == __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE))
+  {
+    return NULL;
+  }
+  return &queue->frames[head & queue->mask];
+}
+
+/* Remove the frame returned by frame_queue_peek. Consumer only. */
+void frame_queue_release (frame_queue_t *queue)
+{
+  __atomic_store_n (&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Block until a frame is added or the consumer is woken */
+void frame_queue_wait (frame_queue_t *queue)
+{
+  while (sem_wait (&queue->available) != 0 && errno == EINTR)
+  {
+  }
+}
+
+void frame_queue_wake (frame_queue_t *queue)
+{
+  sem_post (&queue->available);
+}
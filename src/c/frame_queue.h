@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_FRAME_QUEUE_H
+#define DEVICE_BACNET_C_FRAME_QUEUE_H
+
+#define FRAME_QUEUE_DEPTH 256
+#define FRAME_QUEUE_CACHE_LINE 64
+
+/* A received NPDU and its source address */
+typedef struct frame_t
+{
+  BACNET_ADDRESS src;
+  uint16_t pdu_len;
+  /* When the frame was received, from stats_now */
+  uint64_t received;
+  uint8_t pdu[MAX_MPDU];
+} frame_t;
+
+/* Ring of frames with a single producer and a single consumer. The producer
+ * only writes tail and the consumer only writes head, so no lock is needed.
+ */
+typedef struct frame_queue_t
+{
+  frame_t *frames;
+  uint32_t mask;
+  /* Index of the next frame to be read, written by the consumer */
+  uint32_t head __attribute__ ((aligned (FRAME_QUEUE_CACHE_LINE)));
+  /* Index of the next frame to be written, written by the producer */
+  uint32_t tail __attribute__ ((aligned (FRAME_QUEUE_CACHE_LINE)));
+  /* Frames dropped because the ring was full */
+  uint64_t dropped;
+  /* Posted for each frame added, and to wake the consumer */
+  sem_t available __attribute__ ((aligned (FRAME_QUEUE_CACHE_LINE)));
+} frame_queue_t;
+
+frame_queue_t *frame_queue_alloc (uint32_t depth);
+
+void frame_queue_free (frame_queue_t *queue);
+
+bool frame_queue_push (frame_queue_t *queue, const BACNET_ADDRESS *src,
+                       const uint8_t *pdu, uint16_t pdu_len, uint64_t received);
+
+frame_t *frame_queue_peek (frame_queue_t *queue);
+
+void frame_queue_release (frame_queue_t *queue);
+
+void frame_queue_wait (frame_queue_t *queue);
+
+void frame_queue_wake (frame_queue_t *queue);
+
+#endif //DEVICE_BACNET_C_FRAME_QUEUE_H
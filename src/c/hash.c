@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "hash.h"
+
+#define HASH_PRIME 16777619u
+
+static uint32_t hash_byte (uint32_t hash, uint8_t byte)
+{
+  return (hash ^ byte) * HASH_PRIME;
+}
+
+/* Add a 32-bit value, least significant byte first */
+uint32_t hash_word (uint32_t hash, uint32_t word)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    hash = hash_byte (hash, (word >> (8 * i)) & 0xFF);
+  }
+  return hash;
+}
+
+/* Add the characters of a string, without its terminator */
+uint32_t hash_string (uint32_t hash, const char *str)
+{
+  while (*str)
+  {
+    hash = hash_byte (hash, (uint8_t) *str++);
+  }
+  return hash;
+}
+
+/* Add the network number and addresses that identify a device */
+uint32_t hash_address (uint32_t hash, const BACNET_ADDRESS *address)
+{
+  hash = hash_byte (hash, address->net & 0xFF);
+  hash = hash_byte (hash, address->net >> 8);
+  for (uint8_t i = 0; i < address->mac_len && i < MAX_MAC_LEN; i++)
+  {
+    hash = hash_byte (hash, address->mac[i]);
+  }
+  for (uint8_t i = 0; i < address->len && i < MAX_MAC_LEN; i++)
+  {
+    hash = hash_byte (hash, address->adr[i]);
+  }
+  return hash;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_HASH_H
+#define DEVICE_BACNET_C_HASH_H
+
+/* FNV-1a hashing for the hash tables. A hash starts as HASH_INIT and each
+ * part of a key is added to it in turn.
+ */
+#define HASH_INIT 2166136261u
+
+uint32_t hash_word (uint32_t hash, uint32_t word);
+
+uint32_t hash_string (uint32_t hash, const char *str);
+
+uint32_t hash_address (uint32_t hash, const BACNET_ADDRESS *address);
+
+#endif //DEVICE_BACNET_C_HASH_H
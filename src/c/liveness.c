@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "liveness.h"
+#include "hash.h"
+#include "deadline.h"
+#include "stats.h"
+
+/* A probe read of a device object */
+typedef struct liveness_probe_t
+{
+  liveness_ll *list;
+  liveness_entry_t *entry;
+} liveness_probe_t;
+
+static uint32_t liveness_hash (uint32_t device_id)
+{
+  return hash_word (HASH_INIT, device_id) % LIVENESS_BUCKETS;
+}
+
+static liveness_entry_t *liveness_get_locked (liveness_ll *list, uint32_t device_id)
+{
+  liveness_entry_t *current = list->buckets[liveness_hash (device_id)];
+  while (current && current->address.deviceInstance != device_id)
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+static void liveness_free_entry (liveness_entry_t *entry)
+{
+  free (entry->name);
+  free (entry);
+}
+
+/* Record the state of a device, to be set in EdgeX by the thread if it changed.
+ * The first state found is always set, as EdgeX may hold a stale one.
+ */
+static void liveness_set_state_locked (liveness_ll *list, liveness_entry_t *entry, bool up)
+{
+  if (entry->removed || (entry->known && entry->up == up))
+  {
+    return;
+  }
+  entry->known = true;
+  entry->up = up;
+  if (!entry->pending)
+  {
+    entry->pending = true;
+    list->pending++;
+  }
+  pthread_cond_signal (&list->wakeup);
+}
+
+/* Record the result of a probe, freeing the entry if it was removed meanwhile */
+static void liveness_probe_done_locked (liveness_ll *list, liveness_entry_t *entry,
+                                        bool answered, bool failed)
+{
+  entry->probing = false;
+  if (entry->removed)
+  {
+    liveness_free_entry (entry);
+    return;
+  }
+  if (answered || failed)
+  {
+    entry->awaiting = false;
+    liveness_set_state_locked (list, entry, answered);
+  }
+}
+
+/* Completion of a probe, run on the thread handling the response. Any
+ * response, even an error, shows that the device is up.
+ */
+static void liveness_probe_complete (return_data_t *data, void *context)
+{
+  liveness_probe_t *probe = (liveness_probe_t *) context;
+  liveness_ll *list = probe->list;
+  bool answered = data->responded;
+  bool failed = data->timedOut;
+
+  if (data->value)
+  {
+    free (data->value);
+  }
+  return_data_remove_by_ptr (returnDataHead, data);
+
+  pthread_mutex_lock (&list->mutex);
+  liveness_probe_done_locked (list, probe->entry, answered, failed);
+  pthread_mutex_unlock (&list->mutex);
+  free (probe);
+}
+
+/* Check a device, probing it with a read of its device object unless it has
+ * been heard from within the interval. The probe must bind to the device by
+ * the next check, so that an unbound device does not hold up the others.
+ * Called with the mutex held, which is released while the probe is started.
+ */
+static void liveness_check (liveness_ll *list, liveness_entry_t *entry)
+{
+  uint64_t heard = bacnet_device_last_heard (entry->address.deviceInstance);
+  if (heard && stats_now () - heard < list->interval * 1000000)
+  {
+    entry->awaiting = false;
+    liveness_set_state_locked (list, entry, true);
+    return;
+  }
+  if (entry->probing)
+  {
+    return;
+  }
+  entry->probing = true;
+  bacnet_address_t address = entry->address;
+  liveness_probe_t *probe = malloc (sizeof (liveness_probe_t));
+  probe->list = list;
+  probe->entry = entry;
+  struct timespec deadline = list->due;
+  pthread_mutex_unlock (&list->mutex);
+
+  /* Probes are interactive so that they are not shed when background reads are queued */
+  bool sent = bacnetReadPropertyAsync (&address, OBJECT_DEVICE, address.deviceInstance,
+                                       PROP_OBJECT_IDENTIFIER, BACNET_ARRAY_ALL,
+                                       REQUEST_PRIORITY_INTERACTIVE, liveness_probe_complete, probe, &deadline);
+  bool bound = sent || bacnet_device_bound (address.deviceInstance);
+  pthread_mutex_lock (&list->mutex);
+  if (!sent)
+  {
+    free (probe);
+    if (!bound && !entry->awaiting)
+    {
+      /* An I-Am answering the Who-Is is seen by the next check */
+      iot_log_debug (list->lc, "Device %u was not bound by the liveness check", address.deviceInstance);
+      entry->awaiting = true;
+      liveness_probe_done_locked (list, entry, false, false);
+      return;
+    }
+    /* The device did not answer a Who-Is, or its circuit breaker is open */
+    iot_log_debug (list->lc, "Liveness probe of device %u could not be sent", address.deviceInstance);
+    liveness_probe_done_locked (list, entry, false, true);
+  }
+}
+
+/* Set the operating state of the first device whose state changed. Called
+ * with the mutex held, which is released while EdgeX is updated.
+ */
+static void liveness_set_opstate (liveness_ll *list)
+{
+  liveness_entry_t *entry = list->first;
+  while (entry && !entry->pending)
+  {
+    entry = entry->order_next;
+  }
+  if (entry == NULL)
+  {
+    list->pending = 0;
+    return;
+  }
+  entry->pending = false;
+  list->pending--;
+  char *name = strdup (entry->name);
+  uint32_t device_id = entry->address.deviceInstance;
+  bool up = entry->up;
+  liveness_handler_t handler = list->handler;
+  void *context = list->context;
+  pthread_mutex_unlock (&list->mutex);
+
+  devsdk_error err;
+  err.code = 0;
+  iot_log_info (list->lc, "Device %s is %s", name, up ? "up" : "down");
+  devsdk_set_device_opstate (list->service, name, up, &err);
+  if (err.code)
+  {
+    iot_log_error (list->lc, "Unable to set operating state of device %s: %s", name, err.reason);
+  }
+  if (handler)
+  {
+    handler (context, device_id, up);
+  }
+  free (name);
+  pthread_mutex_lock (&list->mutex);
+}
+
+static void *liveness_run (void *arg)
+{
+  liveness_ll *list = (liveness_ll *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  deadline_now (&list->due);
+  while (list->running)
+  {
+    if (list->pending)
+    {
+      liveness_set_opstate (list);
+      continue;
+    }
+    if (list->first == NULL || list->interval == 0)
+    {
+      pthread_cond_wait (&list->wakeup, &list->mutex);
+      deadline_now (&list->due);
+      continue;
+    }
+    deadline_now (&now);
+    if (!deadline_expired (&list->due, &now))
+    {
+      deadline_wait (&list->wakeup, &list->mutex, &list->due);
+      continue;
+    }
+
+    /* Check the next device, spreading the checks evenly over the interval */
+    uint64_t tick = list->interval / list->count;
+    list->due = now;
+    deadline_add (&list->due, tick ? tick : 1);
+    liveness_entry_t *entry = list->cursor ? list->cursor : list->first;
+    list->cursor = entry->order_next;
+    liveness_check (list, entry);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return NULL;
+}
+
+/* Create an empty set of monitored devices and start its thread. Each
+ * device is checked once every interval milliseconds, or never if it is 0.
+ */
+liveness_ll *liveness_alloc (devsdk_service_t *service, iot_logger_t *lc, uint64_t interval)
+{
+  liveness_ll *list = calloc (1, sizeof (liveness_ll));
+  list->service = service;
+  list->lc = lc;
+  list->interval = interval;
+  list->running = true;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->wakeup);
+  pthread_create (&list->thread, NULL, liveness_run, list);
+  return list;
+}
+
+/* Stop the thread, so that no more probes are started */
+void liveness_stop (liveness_ll *list)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool running = list->running;
+  list->running = false;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  if (running)
+  {
+    pthread_join (list->thread, NULL);
+  }
+}
+
+/* Change the interval in which each device is checked, from the next check.
+ * When checks are turned off, devices that are down are set up again.
+ */
+void liveness_set_interval (liveness_ll *list, uint64_t interval)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock (&list->mutex);
+  list->interval = interval;
+  if (interval == 0)
+  {
+    for (liveness_entry_t *entry = list->first; entry; entry = entry->order_next)
+    {
+      if (entry->known && !entry->up)
+      {
+        liveness_set_state_locked (list, entry, true);
+      }
+    }
+  }
+  deadline_now (&list->due);
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Set the handler told of each change of a device's state, which must not be
+ * freed before the thread is stopped
+ */
+void liveness_set_handler (liveness_ll *list, liveness_handler_t handler, void *context)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock (&list->mutex);
+  list->handler = handler;
+  list->context = context;
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Free the monitored devices. Probes still in progress must have completed. */
+void liveness_free (liveness_ll *list)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  liveness_stop (list);
+
+  liveness_entry_t *current = list->first;
+  while (current)
+  {
+    liveness_entry_t *next = current->order_next;
+    liveness_free_entry (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->wakeup);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Monitor a device while it has auto-events; called for each of them */
+void liveness_add (liveness_ll *list, const devsdk_device_t *device)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  bacnet_address_t *address = (bacnet_address_t *) device->address;
+  pthread_mutex_lock (&list->mutex);
+  liveness_entry_t *entry = liveness_get_locked (list, address->deviceInstance);
+  if (entry == NULL)
+  {
+    uint32_t bucket = liveness_hash (address->deviceInstance);
+    entry = calloc (1, sizeof (liveness_entry_t));
+    entry->name = strdup (device->name);
+    entry->address = *address;
+    entry->next = list->buckets[bucket];
+    list->buckets[bucket] = entry;
+    entry->order_next = list->first;
+    list->first = entry;
+    list->count++;
+    pthread_cond_signal (&list->wakeup);
+  }
+  entry->refs++;
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Stop monitoring a device when its last auto-event is removed */
+void liveness_remove (liveness_ll *list, uint32_t device_id)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock (&list->mutex);
+  liveness_entry_t *entry = liveness_get_locked (list, device_id);
+  if (entry == NULL || --entry->refs > 0)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+
+  liveness_entry_t **link = &list->buckets[liveness_hash (device_id)];
+  while (*link != entry)
+  {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  link = &list->first;
+  while (*link != entry)
+  {
+    link = &(*link)->order_next;
+  }
+  *link = entry->order_next;
+  if (list->cursor == entry)
+  {
+    list->cursor = entry->order_next;
+  }
+  list->count--;
+  if (entry->pending)
+  {
+    list->pending--;
+  }
+
+  if (entry->probing)
+  {
+    entry->removed = true;
+  }
+  else
+  {
+    liveness_free_entry (entry);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Check whether a device is up; unmonitored devices always are, as are all
+ * devices while checks are off
+ */
+bool liveness_is_up (liveness_ll *list, uint32_t device_id)
+{
+  if (list == NULL)
+  {
+    return true;
+  }
+  pthread_mutex_lock (&list->mutex);
+  liveness_entry_t *entry = liveness_get_locked (list, device_id);
+  bool up = list->interval == 0 || entry == NULL || !entry->known || entry->up;
+  pthread_mutex_unlock (&list->mutex);
+  return up;
+}
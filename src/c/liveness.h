@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <devsdk/devsdk.h>
+#include "driver.h"
+
+#ifndef DEVICE_BACNET_C_LIVENESS_H
+#define DEVICE_BACNET_C_LIVENESS_H
+
+#define LIVENESS_BUCKETS 1024
+
+/* A device whose liveness is monitored, while it has auto-events */
+typedef struct liveness_entry_t
+{
+  char *name;
+  bacnet_address_t address;
+  /* Number of auto-events of the device */
+  uint32_t refs;
+  /* Whether the device is up, once its state has been checked */
+  bool known;
+  bool up;
+  /* Set while the operating state has changed and not yet been set in EdgeX */
+  bool pending;
+  /* Set while a probe is in progress, and when removed meanwhile, so the
+   * completing probe frees the entry
+   */
+  bool probing;
+  bool removed;
+  /* Set when the device could not be bound within a check, so the Who-Is
+   * sent is the probe, failed if the device is not heard from by the next
+   */
+  bool awaiting;
+  /* Next entry in the same hash bucket, and in the order devices are checked */
+  struct liveness_entry_t *next;
+  struct liveness_entry_t *order_next;
+} liveness_entry_t;
+
+/* Called on the thread with each change of a device's state */
+typedef void (*liveness_handler_t) (void *context, uint32_t device_id, bool up);
+
+/* Devices checked in turn by a thread, one every interval / count
+ * milliseconds, so that each is checked once per interval. An interval of 0
+ * turns the checks off.
+ */
+typedef struct liveness_ll
+{
+  liveness_entry_t *buckets[LIVENESS_BUCKETS];
+  liveness_entry_t *first;
+  liveness_entry_t *cursor;
+  uint32_t count;
+  /* Number of entries with an operating state to set */
+  uint32_t pending;
+  uint64_t interval;
+  struct timespec due;
+  devsdk_service_t *service;
+  iot_logger_t *lc;
+  liveness_handler_t handler;
+  void *context;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+} liveness_ll;
+
+liveness_ll *liveness_alloc (devsdk_service_t *service, iot_logger_t *lc, uint64_t interval);
+
+void liveness_stop (liveness_ll *list);
+
+void liveness_set_interval (liveness_ll *list, uint64_t interval);
+
+void liveness_set_handler (liveness_ll *list, liveness_handler_t handler, void *context);
+
+void liveness_free (liveness_ll *list);
+
+void liveness_add (liveness_ll *list, const devsdk_device_t *device);
+
+void liveness_remove (liveness_ll *list, uint32_t device_id);
+
+bool liveness_is_up (liveness_ll *list, uint32_t device_id);
+
+#endif //DEVICE_BACNET_C_LIVENESS_H
@@ -27,9 +27,17 @@
 #include "math.h"
 #include "driver.h"
 #include "address_instance_map.h"
+#include "autoevent.h"
+#include "liveness.h"
+#include "cov_manager.h"
+#include "event_manager.h"
+#include "trend_log.h"
+#include "deadline.h"
 
 #define ERR_CHECK(x) if (x.code) { fprintf (stderr, "Error: %d: %s\n", x.code, x.reason); return x.code; }
 #define SMALL_STACK 100000
+#define STRINGIFY_VALUE(x) #x
+#define STRINGIFY(x) STRINGIFY_VALUE(x)
 
 typedef struct
 {
@@ -37,11 +45,36 @@ typedef struct
   const uint32_t type;
 } stringValueMap;
 
-typedef struct
+static uint32_t parseStringInt (const iot_data_t *map, const char *name, uint32_t dfl, iot_data_t **exc)
 {
-  uint16_t port;
-  uint32_t deviceInstance;
-} bacnet_address_t;
+  const char *elem = iot_data_string_map_get_string (map, name);
+  return elem ? strtol (elem, NULL, 0) : dfl;
+}
+
+/* Read the driver options that may be changed while the service runs */
+static void parseWritable (bacnet_config_t *driver_config, const iot_data_t *config)
+{
+  driver_config->network_window = parseStringInt (config, "MaxRequestsPerNetwork", DEFAULT_NETWORK_WINDOW, NULL);
+  driver_config->device_queue_depth = parseStringInt (config, "DeviceQueueDepth", DEFAULT_DEVICE_QUEUE_DEPTH, NULL);
+  driver_config->breaker_threshold = parseStringInt (config, "CircuitBreakerThreshold", DEFAULT_BREAKER_THRESHOLD, NULL);
+  driver_config->breaker_probe_interval = parseStringInt (config, "CircuitBreakerProbeInterval", DEFAULT_BREAKER_PROBE_INTERVAL, NULL);
+  driver_config->liveness_interval = parseStringInt (config, "LivenessInterval", DEFAULT_LIVENESS_INTERVAL, NULL);
+  driver_config->stale_deadline = parseStringInt (config, "StaleReadDeadline", 0, NULL);
+  driver_config->datalink_packet_rate = parseStringInt (config, "DatalinkPacketRate", 0, NULL);
+  driver_config->datalink_byte_rate = parseStringInt (config, "DatalinkByteRate", 0, NULL);
+  driver_config->network_packet_rate = parseStringInt (config, "NetworkPacketRate", 0, NULL);
+  driver_config->network_byte_rate = parseStringInt (config, "NetworkByteRate", 0, NULL);
+#ifdef BACDL_BIP
+  driver_config->bbmd_packet_rate = parseStringInt (config, "BBMDPacketRate", 0, NULL);
+  driver_config->bbmd_byte_rate = parseStringInt (config, "BBMDByteRate", 0, NULL);
+#endif
+  driver_config->apdu_timeout = parseStringInt (config, "APDUTimeout", 0, NULL);
+  const char *retries = iot_data_string_map_get_string (config, "APDURetries");
+  driver_config->apdu_retries = (retries && *retries) ? atoi (retries) : -1;
+  driver_config->who_is_timeout = parseStringInt (config, "WhoIsTimeout", 0, NULL);
+  driver_config->discovery_timeout = parseStringInt (config, "DiscoveryTimeout", 0, NULL);
+  driver_config->receive_timeout = parseStringInt (config, "ReceiveTimeout", DEFAULT_RECEIVE_TIMEOUT, NULL);
+}
 
 /* --- Initialize ---- */
 /* Initialize performs protocol-specific initialization for the device
@@ -83,15 +116,36 @@ static bool bacnet_init
   }
 #endif
 
+  /* Read the performance related driver options */
+  driver->config.binding_table_size = parseStringInt (config, "BindingTableSize", DEFAULT_BINDING_TABLE_SIZE, NULL);
+  driver->config.max_transactions = parseStringInt (config, "MaxTransactions", DEFAULT_MAX_TRANSACTIONS, NULL);
+  driver->config.decode_workers = parseStringInt (config, "DecodeWorkers", DEFAULT_DECODE_WORKERS, NULL);
+  driver->config.cov_lifetime = parseStringInt (config, "COVLifetime", DEFAULT_COV_LIFETIME, NULL);
+  const char *stale = iot_data_string_map_get_string (config, "ServeStaleOnTimeout");
+  driver->config.serve_stale = stale && strcasecmp (stale, "true") == 0;
+  driver->config.network_rates = iot_data_string_map_get_string (config, "NetworkRates");
+  const char *cpu = iot_data_string_map_get_string (config, "DatalinkCPU");
+  driver->config.datalink_cpu = (cpu && *cpu) ? atoi (cpu) : -1;
+  driver->config.datalink_priority = parseStringInt (config, "DatalinkPriority", 0, NULL);
+  driver->config.decode_cpus = iot_data_string_map_get_string (config, "DecodeCPUs");
+  driver->config.decode_priority = parseStringInt (config, "DecodePriority", 0, NULL);
+  parseWritable (&driver->config, config);
+
   driver->aim_ll = address_instance_map_alloc ();
   driver->running_thread = true;
 
-  if (init_bacnet_driver (&driver->datalink_thread, &driver->running_thread, lc) != 0)
+  if (init_bacnet_driver (&driver->datalink_thread, &driver->running_thread, lc, &driver->config) != 0)
   {
     iot_log_error (driver->lc, "An error occurred while initializing the BACnet driver");
     deinit_bacnet_driver (&driver->datalink_thread, &driver->running_thread);
     return false;
   }
+  driver->liveness = liveness_alloc (driver->service, lc, driver->config.liveness_interval);
+  driver->cov = cov_manager_alloc (driver->service, lc, driver->config.cov_lifetime);
+  driver->events = event_manager_alloc (driver->service, lc, driver->liveness);
+  driver->trends = trend_log_alloc (driver->service, lc, driver->liveness);
+  driver->autoevents = autoevent_alloc (driver->service, lc, driver->liveness, driver->cov, driver->events,
+                                        driver->trends);
   iot_log_debug (driver->lc, "Init");
   return true;
 }
@@ -128,10 +182,56 @@ static uint32_t parseInt (const iot_data_t *map, const char *name, uint32_t dfl,
 }
 
 #ifndef BACDL_MSTP
-static uint32_t parseStringInt (const iot_data_t *map, const char *name, uint32_t dfl, iot_data_t **exc)
+/* Parse the address of a routed device on its remote network. A single byte
+ * address (e.g. an MS/TP station) may be given as a number, longer addresses
+ * as colon separated hex bytes.
+ */
+static uint8_t parseMac (const iot_data_t *map, const char *name, uint8_t *mac, iot_data_t **exc)
 {
   const char *elem = iot_data_string_map_get_string (map, name);
-  return elem ? strtol (elem, NULL, 0) : dfl;
+  uint8_t len = 0;
+  char *end;
+
+  if (elem == NULL || *elem == '\0')
+  {
+    return 0;
+  }
+  if (strchr (elem, ':') == NULL)
+  {
+    unsigned long station = strtoul (elem, &end, 0);
+    if (*end == '\0' && station <= UINT8_MAX)
+    {
+      mac[len++] = (uint8_t) station;
+      return len;
+    }
+  }
+  else
+  {
+    const char *pos = elem;
+    while (len < MAX_MAC_LEN)
+    {
+      unsigned long byte = strtoul (pos, &end, 16);
+      if (end == pos || byte > UINT8_MAX)
+      {
+        break;
+      }
+      mac[len++] = (uint8_t) byte;
+      if (*end == '\0')
+      {
+        return len;
+      }
+      if (*end != ':')
+      {
+        break;
+      }
+      pos = end + 1;
+    }
+  }
+  if (*exc == NULL)
+  {
+    *exc = bacnet_alloc_exception ("Protocol property '%s' is not a valid BACnet address", name);
+  }
+  return 0;
 }
 #endif
 
@@ -141,6 +241,7 @@ static BACNET_PROPERTY_ID parseProperty (const iot_data_t *property, iot_data_t
   {
     {"present-value", PROP_PRESENT_VALUE},
     {"object-name",   PROP_OBJECT_NAME},
+    {"log-buffer",    PROP_LOG_BUFFER},
   };
 
   if (property == NULL)
@@ -179,7 +280,9 @@ static BACNET_OBJECT_TYPE parseType (const iot_data_t *type, iot_data_t **exc)
     {"binary-input",  OBJECT_BINARY_INPUT},
     {"binary-output", OBJECT_BINARY_OUTPUT},
     {"binary-value",  OBJECT_BINARY_VALUE},
-    {"device",        OBJECT_DEVICE}
+    {"device",        OBJECT_DEVICE},
+    {"trend-log",     OBJECT_TRENDLOG},
+    {"channel",       OBJECT_CHANNEL}
   };
 
   if (type == NULL)
@@ -219,12 +322,39 @@ static devsdk_resource_attr_t bacnet_getattributes (void *impl, const iot_data_t
   attrs->property = parseProperty (iot_data_string_map_get (device_attr, "property"), exception);
   attrs->type = parseType (iot_data_string_map_get (device_attr, "type"), exception);
   attrs->index = parseInt (device_attr, "index", 0xFFFFFFFF, exception);
-  if (attrs->instance == BACNET_MAX_INSTANCE && *exception == NULL)
+  const char *name = iot_data_string_map_get_string (device_attr, "name");
+  if (name)
+  {
+    attrs->name = strdup (name);
+  }
+  const char *cov = iot_data_string_map_get_string (device_attr, "cov");
+  if (cov && strcmp (cov, "confirmed") == 0)
+  {
+    attrs->cov = BACNET_COV_CONFIRMED;
+  }
+  else if (cov && strcmp (cov, "unconfirmed") == 0)
+  {
+    attrs->cov = BACNET_COV_UNCONFIRMED;
+  }
+  else if (cov && *exception == NULL)
   {
-    *exception = bacnet_alloc_exception ("Attribute 'instance' is required");
+    *exception = bacnet_alloc_exception ("Attribute 'cov' must be confirmed or unconfirmed");
+  }
+  /* Channels written with WriteGroup are addressed by channel number, defaulting to the instance */
+  attrs->group = parseInt (device_attr, "group", 0, exception);
+  uint32_t channel = parseInt (device_attr, "channel", attrs->instance, exception);
+  if (attrs->group && channel > UINT16_MAX && *exception == NULL)
+  {
+    *exception = bacnet_alloc_exception ("Attribute 'channel' is required with 'group'");
+  }
+  attrs->channel = (uint16_t) channel;
+  if (attrs->group == 0 && attrs->instance == BACNET_MAX_INSTANCE && attrs->name == NULL && *exception == NULL)
+  {
+    *exception = bacnet_alloc_exception ("Attribute 'instance' or 'name' is required");
   }
   if (*exception)
   {
+    free (attrs->name);
     free (attrs);
     return NULL;
   }
@@ -236,26 +366,43 @@ static devsdk_resource_attr_t bacnet_getattributes (void *impl, const iot_data_t
 
 static void bacnet_freeattributes (void *impl, devsdk_resource_attr_t attrs)
 {
+  free (((bacnet_attributes_t *) attrs)->name);
   free (attrs);
 }
 
-#ifdef BACDL_MSTP
+/* Read the optional timeout, retries and notification class of a device from its protocol properties */
+static void parseDeviceOptions (const iot_data_t *props, bacnet_address_t *addr, iot_data_t **exception)
+{
+  addr->apduTimeout = parseStringInt (props, "APDUTimeout", 0, exception);
+  const char *retries = iot_data_string_map_get_string (props, "APDURetries");
+  addr->apduRetries = (retries && *retries) ? atoi (retries) : -1;
+  const char *nc = iot_data_string_map_get_string (props, "NotificationClass");
+  addr->notificationClass = (nc && *nc) ? (uint32_t) strtoul (nc, NULL, 0) : UINT32_MAX;
+}
 
-static const char *defaultPath = "(default)";
+#ifdef BACDL_MSTP
 
 static devsdk_address_t bacnet_getaddress (void *impl, const devsdk_protocols *protocols, iot_data_t **exception)
 {
-  const char *result = defaultPath;
   const iot_data_t *props = devsdk_protocols_properties (protocols, "BACnet-MSTP");
-  if (props)
+  uint32_t inst = props ? parseStringInt (props, "DeviceInstance", UINT32_MAX, exception) : UINT32_MAX;
+  if (inst == UINT32_MAX && *exception == NULL)
+  {
+    *exception = iot_data_alloc_string ("DeviceInstance must be specified", IOT_DATA_REF);
+  }
+  if (*exception)
   {
-    result = iot_data_string_map_get_string (props, "Path");
+    return NULL;
   }
-  return (devsdk_address_t)result;
+  bacnet_address_t *result = calloc (1, sizeof (bacnet_address_t));
+  result->deviceInstance = inst;
+  parseDeviceOptions (props, result, exception);
+  return result;
 }
 
 static void bacnet_freeaddress (void *impl, devsdk_address_t address)
 {
+  free (address);
 }
 
 #else
@@ -267,19 +414,30 @@ static devsdk_address_t bacnet_getaddress (void *impl, const devsdk_protocols *p
   {
     uint32_t inst = parseStringInt (props, "DeviceInstance", UINT32_MAX, exception);
     uint16_t port = parseStringInt (props, "Port", 0xBAC0, exception);
+    uint16_t network = parseStringInt (props, "Network", 0, exception);
+    uint8_t mac[MAX_MAC_LEN];
+    uint8_t mac_len = parseMac (props, "MAC", mac, exception);
     if (inst == UINT32_MAX && *exception == NULL)
     {
       *exception = iot_data_alloc_string ("DeviceInstance must be specified", IOT_DATA_REF);
     }
+    if ((network == 0) != (mac_len == 0) && *exception == NULL)
+    {
+      *exception = iot_data_alloc_string ("Network and MAC must be specified together", IOT_DATA_REF);
+    }
     if (*exception)
     {
       return NULL;
     }
     else
     {
-      bacnet_address_t *result = malloc (sizeof (bacnet_address_t));
+      bacnet_address_t *result = calloc (1, sizeof (bacnet_address_t));
       result->deviceInstance = inst;
       result->port = port;
+      result->network = network;
+      result->mac_len = mac_len;
+      memcpy (result->mac, mac, mac_len);
+      parseDeviceOptions (props, result, exception);
       return result;
     }
   }
@@ -297,12 +455,12 @@ static void bacnet_freeaddress (void *impl, devsdk_address_t address)
 
 #endif
 
-static bool get_supported_services (uint32_t device_id, uint16_t port, iot_data_t *properties)
+static bool get_supported_services (const bacnet_address_t *addr, iot_data_t *properties)
 {
   /* Get the supported BACnet services */
   BACNET_APPLICATION_DATA_VALUE *bacnet_services =
-    bacnetReadProperty (device_id, OBJECT_DEVICE, UINT32_MAX,
-                        PROP_PROTOCOL_SERVICES_SUPPORTED, UINT32_MAX, port);
+    bacnetReadProperty (addr, OBJECT_DEVICE, UINT32_MAX,
+                        PROP_PROTOCOL_SERVICES_SUPPORTED, UINT32_MAX, REQUEST_PRIORITY_BACKGROUND);
   if (bacnet_services == NULL)
   {
     return false;
@@ -359,16 +517,16 @@ static void bacnet_discover (void *impl, const char * request_id)
     bacnet_protocol_populate (discovered_device, bacnet_protocol_properties, driver);
 
     /* Get device information */
-    uint16_t port = (uint16_t) (discovered_device->address.mac[4] * 0x100u +
-                                discovered_device->address.mac[5]);
-    if (!get_device_properties (discovered_device, port, driver->lc, &name,
+    bacnet_address_t addr;
+    bacnet_address_from_entry (discovered_device, &addr);
+    if (!get_device_properties (discovered_device, &addr, driver->lc, &name,
                                 &description, labels, &profile))
     {
       free(labels);
       iot_data_free (bacnet_protocol_properties);
       continue;
     }
-    if (!get_supported_services (discovered_device->device_id, port, service_protocol_properties))
+    if (!get_supported_services (&addr, service_protocol_properties))
     {
       free(name);
       free (description);
@@ -406,6 +564,19 @@ static void bacnet_discover (void *impl, const char * request_id)
   iot_log_debug (driver->lc, "Finished BACnet Discovery");
 }
 
+/* ---- Reconfigure ---- */
+/* Reconfigure is called when the Writable driver options change. They are
+ * applied without restarting, keeping the bindings and other learned state.
+ */
+static void bacnet_reconfigure (void *impl, const iot_data_t *config)
+{
+  bacnet_driver *driver = (bacnet_driver *) impl;
+  parseWritable (&driver->config, config);
+  reconfigure_bacnet_driver (&driver->config);
+  liveness_set_interval (driver->liveness, driver->config.liveness_interval);
+  iot_log_info (driver->lc, "Driver options updated");
+}
+
 /* ---- Get ---- */
 /* Get triggers an asynchronous protocol specific GET operation.
  * The device to query is specified by the protocols. nreadings is
@@ -435,7 +606,15 @@ static bool bacnet_get_handler
   /* Pointer to the data to be read */
   BACNET_READ_ACCESS_DATA *read_data = NULL;
   bacnet_address_t *addr = (bacnet_address_t *)device->address;
-  bool success = read_access_data_populate (&read_data, nreadings, requests, driver);
+  /* With a stale read deadline, binding, name resolution and the reads all count against it */
+  struct timespec deadline;
+  const struct timespec *within = NULL;
+  if (driver->config.serve_stale && driver->config.stale_deadline)
+  {
+    deadline_set (&deadline, driver->config.stale_deadline);
+    within = &deadline;
+  }
+  bool success = read_access_data_populate (&read_data, nreadings, requests, addr, driver, within);
   /* Return false if read_data could not be set up */
   if (!success)
   {
@@ -444,15 +623,32 @@ static bool bacnet_get_handler
     return false;
   }
 
-  for (BACNET_READ_ACCESS_DATA *current_data = read_data; current_data; current_data = current_data->next)
+  /* When each stale reading was read, or 0 for live readings */
+  uint64_t *stale = calloc (nreadings, sizeof (uint64_t));
+  uint32_t i = 0;
+  for (BACNET_READ_ACCESS_DATA *current_data = read_data; current_data; current_data = current_data->next, i++)
   {
 
-    BACNET_APPLICATION_DATA_VALUE *result = bacnetReadProperty (addr->deviceInstance,
-                                                                current_data->object_type,
-                                                                current_data->object_instance,
-                                                                current_data->listOfProperties->propertyIdentifier,
-                                                                current_data->listOfProperties->propertyArrayIndex,
-                                                                addr->port);
+    BACNET_APPLICATION_DATA_VALUE *result = bacnetReadPropertyWithin (addr,
+                                                                      current_data->object_type,
+                                                                      current_data->object_instance,
+                                                                      current_data->listOfProperties->propertyIdentifier,
+                                                                      current_data->listOfProperties->propertyArrayIndex,
+                                                                      REQUEST_PRIORITY_INTERACTIVE, within);
+    /* Fall back to the last known good value */
+    if (result == NULL && driver->config.serve_stale)
+    {
+      result = bacnetCachedProperty (addr,
+                                     current_data->object_type,
+                                     current_data->object_instance,
+                                     current_data->listOfProperties->propertyIdentifier,
+                                     current_data->listOfProperties->propertyArrayIndex,
+                                     &stale[i]);
+      if (result)
+      {
+        iot_log_debug (driver->lc, "Serving stale value of %s on device: %s", requests[i].resource->name, device->name);
+      }
+    }
     if (result)
     {
       read_results = bacnet_read_application_data_value_add (read_results,
@@ -471,9 +667,96 @@ static bool bacnet_get_handler
 
   devsdk_commandresult_populate (readings, read_results, nreadings);
 
+  /* Tag stale readings with their quality and age in milliseconds */
+  uint64_t now = iot_time_nsecs ();
+  for (i = 0; ret_val && i < nreadings; i++)
+  {
+    if (stale[i])
+    {
+      readings[i].origin = stale[i];
+      readings[i].tags = iot_data_alloc_map (IOT_DATA_STRING);
+      iot_data_string_map_add (readings[i].tags, "quality", iot_data_alloc_string ("stale", IOT_DATA_REF));
+      iot_data_string_map_add (readings[i].tags, "age", iot_data_alloc_ui64 ((now - stale[i]) / 1000000));
+    }
+  }
+  free (stale);
+
   return ret_val;
 }
 
+/* ---- AutoEvents ---- */
+/* Auto-events are read by the driver rather than by SDK threads calling the
+ * get handler. Reads are started on a timer and the readings are posted with
+ * devsdk_post_readings when the responses arrive.
+*/
+static void *bacnet_autoevent_start_handler
+  (
+    void *impl,
+    const devsdk_device_t *device,
+    const char *resource_name,
+    uint32_t nreadings,
+    const devsdk_commandrequest *requests,
+    uint64_t interval,
+    bool onChange
+  )
+{
+  bacnet_driver *driver = (bacnet_driver *) impl;
+  iot_log_debug (driver->lc, "Starting auto-event of %s on device: %s", resource_name, device->name);
+  liveness_add (driver->liveness, device);
+  return autoevent_add (driver->autoevents, device, resource_name, nreadings, requests, interval, onChange);
+}
+
+static void bacnet_autoevent_stop_handler (void *impl, void *handle)
+{
+  bacnet_driver *driver = (bacnet_driver *) impl;
+  autoevent_t *event = (autoevent_t *) handle;
+  liveness_remove (driver->liveness, event->address.deviceInstance);
+  autoevent_remove (driver->autoevents, event);
+}
+
+/* Write the values of resources of channels in a control group with one
+ * WriteGroup broadcast, in place of a WriteProperty to each member device
+ */
+static bool bacnet_put_group
+  (
+    bacnet_driver *driver,
+    const devsdk_device_t *device,
+    uint32_t group,
+    uint32_t nvalues,
+    const devsdk_commandrequest *requests,
+    const iot_data_t *values[],
+    iot_data_t **exception
+  )
+{
+  bacnet_channel_value_t *changes = calloc (nvalues, sizeof (bacnet_channel_value_t));
+  for (uint32_t i = 0; i < nvalues; i++)
+  {
+    bacnet_attributes_t *attrs = (bacnet_attributes_t *) requests[i].resource->attrs;
+    if (attrs->group != group)
+    {
+      *exception = iot_data_alloc_string ("Resources written together must be in the same group", IOT_DATA_REF);
+      free (changes);
+      return false;
+    }
+    changes[i].channel = attrs->channel;
+    if (!bacnet_value_from_data (values[i], &changes[i].value, driver->lc))
+    {
+      *exception = iot_data_alloc_string ("Error populating write_data", IOT_DATA_REF);
+      free (changes);
+      return false;
+    }
+  }
+  /* Written at the same priority as by WriteProperty */
+  int error = bacnetWriteGroup ((bacnet_address_t *) device->address, group, 1, changes, nvalues);
+  free (changes);
+  if (error != 0)
+  {
+    *exception = iot_data_alloc_string ("Error writing group", IOT_DATA_REF);
+    return false;
+  }
+  return true;
+}
+
 /* ---- Put ---- */
 /* Put triggers an asynchronous protocol specific SET operation.
  * The device to set values on is specified by the protocols.
@@ -499,13 +782,23 @@ static bool bacnet_put_handler
   /* Log the name of the device */
   iot_log_debug (driver->lc, "PUT on device: %s", device->name);
 
+  /* Resources of channels in a control group are written with WriteGroup */
+  for (uint32_t i = 0; i < nvalues; i++)
+  {
+    uint32_t group = ((bacnet_attributes_t *) requests[i].resource->attrs)->group;
+    if (group)
+    {
+      return bacnet_put_group (driver, device, group, nvalues, requests, values, exception);
+    }
+  }
+
   bacnet_address_t *addr = (bacnet_address_t *)device->address;
   int error = 0;
   /* Create pointer for the read_data structure */
   BACNET_WRITE_ACCESS_DATA *write_data = NULL;
   bool success;
   success = write_access_data_populate (&write_data, nvalues, requests,
-                                           values, driver);
+                                           values, addr, driver);
   /* Return false if write_data could not be set up */
   if (!success)
   {
@@ -517,12 +810,11 @@ static bool bacnet_put_handler
   for (BACNET_WRITE_ACCESS_DATA *current_data = write_data; current_data; current_data = current_data->next)
   {
 
-    error = bacnetWriteProperty (addr->deviceInstance,
+    error = bacnetWriteProperty (addr,
                                  current_data->object_type,
                                  current_data->object_instance,
                                  current_data->listOfProperties->propertyIdentifier,
                                  current_data->listOfProperties->propertyArrayIndex,
-                                 addr->port,
                                  current_data->listOfProperties->priority,
                                  &current_data->listOfProperties->value);
     if (error)
@@ -553,8 +845,44 @@ static void bacnet_stop (void *impl, bool force)
 
   address_instance_map_free (driver->aim_ll);
 
+  /* Stop starting auto-event reads, probes, subscriptions, registrations and harvests; those in progress are failed by the driver */
+  if (driver->autoevents)
+  {
+    autoevent_stop (driver->autoevents);
+  }
+  if (driver->liveness)
+  {
+    liveness_stop (driver->liveness);
+  }
+  if (driver->cov)
+  {
+    cov_manager_stop (driver->cov);
+  }
+  if (driver->events)
+  {
+    event_manager_stop (driver->events);
+  }
+  if (driver->trends)
+  {
+    trend_log_stop (driver->trends);
+  }
+
   deinit_bacnet_driver (&driver->datalink_thread, &driver->running_thread);
 
+  if (driver->autoevents)
+  {
+    autoevent_free (driver->autoevents);
+    driver->autoevents = NULL;
+  }
+  liveness_free (driver->liveness);
+  driver->liveness = NULL;
+  cov_manager_free (driver->cov);
+  driver->cov = NULL;
+  event_manager_free (driver->events);
+  driver->events = NULL;
+  trend_log_free (driver->trends);
+  driver->trends = NULL;
+
 }
 
 int main (int argc, char *argv[])
@@ -626,6 +954,8 @@ int main (int argc, char *argv[])
   );
 
   devsdk_callbacks_set_discovery (bacnetImpls, bacnet_discover, NULL);
+  devsdk_callbacks_set_autoevent_handlers (bacnetImpls, bacnet_autoevent_start_handler, bacnet_autoevent_stop_handler);
+  devsdk_callbacks_set_reconfiguration (bacnetImpls, bacnet_reconfigure);
 
   /* Initalise a new device service */
   impl->service = devsdk_service_new
@@ -670,6 +1000,35 @@ int main (int argc, char *argv[])
   iot_data_string_map_add (defaults, "BBMD_ADDRESS", iot_data_alloc_string ("", IOT_DATA_REF));
   iot_data_string_map_add (defaults, "BBMD_PORT", iot_data_alloc_string ("", IOT_DATA_REF));
 #endif
+  iot_data_string_map_add (defaults, "BindingTableSize", iot_data_alloc_string (STRINGIFY (DEFAULT_BINDING_TABLE_SIZE), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "MaxTransactions", iot_data_alloc_string (STRINGIFY (DEFAULT_MAX_TRANSACTIONS), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DecodeWorkers", iot_data_alloc_string (STRINGIFY (DEFAULT_DECODE_WORKERS), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "COVLifetime", iot_data_alloc_string (STRINGIFY (DEFAULT_COV_LIFETIME), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "MaxRequestsPerNetwork", iot_data_alloc_string (STRINGIFY (DEFAULT_NETWORK_WINDOW), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DeviceQueueDepth", iot_data_alloc_string (STRINGIFY (DEFAULT_DEVICE_QUEUE_DEPTH), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "CircuitBreakerThreshold", iot_data_alloc_string (STRINGIFY (DEFAULT_BREAKER_THRESHOLD), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "CircuitBreakerProbeInterval", iot_data_alloc_string (STRINGIFY (DEFAULT_BREAKER_PROBE_INTERVAL), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "LivenessInterval", iot_data_alloc_string (STRINGIFY (DEFAULT_LIVENESS_INTERVAL), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "ServeStaleOnTimeout", iot_data_alloc_string ("false", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "StaleReadDeadline", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "APDUTimeout", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "APDURetries", iot_data_alloc_string ("", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "WhoIsTimeout", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DiscoveryTimeout", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "ReceiveTimeout", iot_data_alloc_string (STRINGIFY (DEFAULT_RECEIVE_TIMEOUT), IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DatalinkPacketRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DatalinkByteRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "NetworkPacketRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "NetworkByteRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "NetworkRates", iot_data_alloc_string ("", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DatalinkCPU", iot_data_alloc_string ("", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DatalinkPriority", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DecodeCPUs", iot_data_alloc_string ("", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "DecodePriority", iot_data_alloc_string ("0", IOT_DATA_REF));
+#ifdef BACDL_BIP
+  iot_data_string_map_add (defaults, "BBMDPacketRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+  iot_data_string_map_add (defaults, "BBMDByteRate", iot_data_alloc_string ("0", IOT_DATA_REF));
+#endif
 
   /* Start the device service*/
   devsdk_service_start (impl->service, defaults, &e);
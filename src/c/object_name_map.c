@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "object_name_map.h"
+#include "hash.h"
+#include "deadline.h"
+
+static uint32_t object_name_map_hash (uint32_t device_id, const char *name)
+{
+  return hash_string (hash_word (HASH_INIT, device_id), name) % OBJECT_NAME_MAP_BUCKETS;
+}
+
+static object_name_map_t *
+object_name_map_get_locked (object_name_map_ll *map, uint32_t device_id, const char *name)
+{
+  object_name_map_t *current = map->buckets[object_name_map_hash (device_id, name)];
+
+  /* Walk the hash chain */
+  while (current)
+  {
+    if (current->device_id == device_id && strcmp (current->name, name) == 0)
+    {
+      break;
+    }
+    current = current->next;
+  }
+  /* Return NULL if not found */
+  return current;
+}
+
+/* Find the object with a given name on a device, ignoring a name recorded as missing */
+static object_name_map_t *
+object_name_map_find_locked (object_name_map_ll *map, uint32_t device_id, const char *name)
+{
+  object_name_map_t *entry = object_name_map_get_locked (map, device_id, name);
+  return (entry && !entry->missing) ? entry : NULL;
+}
+
+static object_name_revision_t *
+object_name_revision_get_locked (object_name_map_ll *map, uint32_t device_id)
+{
+  object_name_revision_t *current = map->revisions;
+  while (current && current->device_id != device_id)
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+/* Remove all object names of a device */
+static void object_name_map_flush_locked (object_name_map_ll *map, uint32_t device_id)
+{
+  for (int i = 0; i < OBJECT_NAME_MAP_BUCKETS; i++)
+  {
+    object_name_map_t **link = &map->buckets[i];
+    while (*link)
+    {
+      object_name_map_t *current = *link;
+      if (current->device_id == device_id)
+      {
+        *link = current->next;
+        free (current->name);
+        free (current);
+      }
+      else
+      {
+        link = &current->next;
+      }
+    }
+  }
+}
+
+/* Create a new map */
+object_name_map_ll *object_name_map_alloc (void)
+{
+  object_name_map_ll *map = calloc (1, sizeof (object_name_map_ll));
+  pthread_mutex_init (&map->mutex, NULL);
+  deadline_cond_init (&map->updated);
+  return map;
+}
+
+/* Remove all entries and free the map */
+void object_name_map_free (object_name_map_ll *map)
+{
+  for (int i = 0; i < OBJECT_NAME_MAP_BUCKETS; i++)
+  {
+    object_name_map_t *current = map->buckets[i];
+    while (current)
+    {
+      object_name_map_t *next = current->next;
+      free (current->name);
+      free (current);
+      current = next;
+    }
+  }
+  object_name_revision_t *revision = map->revisions;
+  while (revision)
+  {
+    object_name_revision_t *next = revision->next;
+    free (revision);
+    revision = next;
+  }
+  pthread_cond_destroy (&map->updated);
+  pthread_mutex_destroy (&map->mutex);
+  free (map);
+}
+
+/* Look up the object with a given name on a device */
+bool object_name_map_get (object_name_map_ll *map, uint32_t device_id,
+                          const char *name, BACNET_OBJECT_TYPE *type,
+                          uint32_t *instance)
+{
+  pthread_mutex_lock (&map->mutex);
+  object_name_map_t *entry = object_name_map_find_locked (map, device_id, name);
+  if (entry)
+  {
+    *type = entry->type;
+    *instance = entry->instance;
+  }
+  pthread_mutex_unlock (&map->mutex);
+  return entry != NULL;
+}
+
+/* Add or update the object with a given name on a device */
+void object_name_map_set (object_name_map_ll *map, uint32_t device_id,
+                          const char *name, BACNET_OBJECT_TYPE type,
+                          uint32_t instance)
+{
+  pthread_mutex_lock (&map->mutex);
+  object_name_map_t *entry = object_name_map_get_locked (map, device_id, name);
+  if (entry == NULL)
+  {
+    uint32_t bucket = object_name_map_hash (device_id, name);
+    entry = malloc (sizeof (object_name_map_t));
+    entry->device_id = device_id;
+    entry->name = strdup (name);
+    entry->next = map->buckets[bucket];
+    map->buckets[bucket] = entry;
+  }
+  entry->type = type;
+  entry->instance = instance;
+  entry->missing = false;
+  pthread_cond_broadcast (&map->updated);
+  pthread_mutex_unlock (&map->mutex);
+}
+
+/* Check whether a device was found to have no object with a given name, and
+ * the name is not yet due to be looked up again
+ */
+bool object_name_map_missing (object_name_map_ll *map, uint32_t device_id,
+                              const char *name)
+{
+  struct timespec now;
+  deadline_now (&now);
+  pthread_mutex_lock (&map->mutex);
+  object_name_map_t *entry = object_name_map_get_locked (map, device_id, name);
+  bool missing = entry && entry->missing && !deadline_expired (&entry->expires, &now);
+  pthread_mutex_unlock (&map->mutex);
+  return missing;
+}
+
+/* Record that a device has no object with a given name, so that it is not
+ * looked up again for the interval in milliseconds, or until the device's
+ * database revision changes
+ */
+void object_name_map_set_missing (object_name_map_ll *map, uint32_t device_id,
+                                  const char *name, uint64_t interval)
+{
+  pthread_mutex_lock (&map->mutex);
+  object_name_map_t *entry = object_name_map_get_locked (map, device_id, name);
+  if (entry == NULL)
+  {
+    uint32_t bucket = object_name_map_hash (device_id, name);
+    entry = calloc (1, sizeof (object_name_map_t));
+    entry->device_id = device_id;
+    entry->name = strdup (name);
+    entry->next = map->buckets[bucket];
+    map->buckets[bucket] = entry;
+    entry->missing = true;
+  }
+  /* A name found meanwhile, by a Who-Has answer, is kept */
+  if (entry->missing)
+  {
+    deadline_set (&entry->expires, interval);
+  }
+  pthread_mutex_unlock (&map->mutex);
+}
+
+/* Wait until the object with a given name on a device is known, or the timeout expires */
+bool object_name_map_wait (object_name_map_ll *map, uint32_t device_id,
+                           const char *name, BACNET_OBJECT_TYPE *type,
+                           uint32_t *instance, const struct timespec *timeout)
+{
+  int rc = 0;
+  pthread_mutex_lock (&map->mutex);
+  object_name_map_t *entry = object_name_map_find_locked (map, device_id, name);
+  while (entry == NULL && rc == 0)
+  {
+    rc = pthread_cond_timedwait (&map->updated, &map->mutex, timeout);
+    entry = object_name_map_find_locked (map, device_id, name);
+  }
+  if (entry)
+  {
+    *type = entry->type;
+    *instance = entry->instance;
+  }
+  pthread_mutex_unlock (&map->mutex);
+  return entry != NULL;
+}
+
+/* Check whether the database revision of a device should be read again. If
+ * so, the next check is scheduled after the interval in milliseconds, so that
+ * a device that does not answer is not asked again at every check.
+ */
+bool object_name_map_revision_due (object_name_map_ll *map, uint32_t device_id,
+                                   uint64_t interval)
+{
+  struct timespec now;
+  deadline_now (&now);
+  pthread_mutex_lock (&map->mutex);
+  object_name_revision_t *revision = object_name_revision_get_locked (map, device_id);
+  if (revision == NULL)
+  {
+    revision = calloc (1, sizeof (object_name_revision_t));
+    revision->device_id = device_id;
+    revision->next = map->revisions;
+    map->revisions = revision;
+    revision->due = now;
+  }
+  bool due = deadline_expired (&revision->due, &now);
+  if (due)
+  {
+    revision->due = now;
+    deadline_add (&revision->due, interval);
+  }
+  pthread_mutex_unlock (&map->mutex);
+  return due;
+}
+
+/* Record the database revision of a device, discarding its object names if it has changed */
+void object_name_map_set_revision (object_name_map_ll *map, uint32_t device_id,
+                                   uint32_t database_revision)
+{
+  pthread_mutex_lock (&map->mutex);
+  object_name_revision_t *revision = object_name_revision_get_locked (map, device_id);
+  if (revision)
+  {
+    if (revision->known && revision->database_revision != database_revision)
+    {
+      object_name_map_flush_locked (map, device_id);
+    }
+    revision->known = true;
+    revision->database_revision = database_revision;
+  }
+  pthread_mutex_unlock (&map->mutex);
+}
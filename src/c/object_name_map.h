@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_OBJECT_NAME_MAP_H
+#define DEVICE_BACNET_C_OBJECT_NAME_MAP_H
+
+#define OBJECT_NAME_MAP_BUCKETS 4096
+
+/* Structure mapping an object name on a device to the object's identifier,
+ * or recording that the device has no object of that name
+ */
+typedef struct object_name_map_t
+{
+  uint32_t device_id;
+  char *name;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  /* Set if no object has the name, until the name is looked up again */
+  bool missing;
+  /* When a missing name is looked up again (CLOCK_MONOTONIC) */
+  struct timespec expires;
+  /* Next entry in the same hash bucket */
+  struct object_name_map_t *next;
+} object_name_map_t;
+
+/* Database revision of a device, used to invalidate its object names */
+typedef struct object_name_revision_t
+{
+  uint32_t device_id;
+  /* Set once the database revision has been read */
+  bool known;
+  uint32_t database_revision;
+  /* When the database revision is next read (CLOCK_MONOTONIC) */
+  struct timespec due;
+  struct object_name_revision_t *next;
+} object_name_revision_t;
+
+/* Hash table of object names */
+typedef struct object_name_map_ll
+{
+  object_name_map_t *buckets[OBJECT_NAME_MAP_BUCKETS];
+  object_name_revision_t *revisions;
+  pthread_mutex_t mutex;
+  /* Signalled whenever an object name is added */
+  pthread_cond_t updated;
+} object_name_map_ll;
+
+object_name_map_ll *object_name_map_alloc (void);
+
+void object_name_map_free (object_name_map_ll *map);
+
+bool object_name_map_get (object_name_map_ll *map, uint32_t device_id,
+                          const char *name, BACNET_OBJECT_TYPE *type,
+                          uint32_t *instance);
+
+void object_name_map_set (object_name_map_ll *map, uint32_t device_id,
+                          const char *name, BACNET_OBJECT_TYPE type,
+                          uint32_t instance);
+
+bool object_name_map_missing (object_name_map_ll *map, uint32_t device_id,
+                              const char *name);
+
+void object_name_map_set_missing (object_name_map_ll *map, uint32_t device_id,
+                                  const char *name, uint64_t interval);
+
+bool object_name_map_wait (object_name_map_ll *map, uint32_t device_id,
+                           const char *name, BACNET_OBJECT_TYPE *type,
+                           uint32_t *instance, const struct timespec *timeout);
+
+bool object_name_map_revision_due (object_name_map_ll *map, uint32_t device_id,
+                                   uint64_t interval);
+
+void object_name_map_set_revision (object_name_map_ll *map, uint32_t device_id,
+                                   uint32_t database_revision);
+
+#endif //DEVICE_BACNET_C_OBJECT_NAME_MAP_H
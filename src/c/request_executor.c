@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iot/os.h>
+#include <apdu.h>
+#include "request_executor.h"
+#include "deadline.h"
+#include "rtt_table.h"
+#include "stats.h"
+
+/* Remove a request from the in-flight list, returning false if it is not there */
+static bool request_executor_remove_locked (request_executor_t *executor, return_data_t *data)
+{
+  return_data_t **link = &executor->inflight;
+  while (*link && *link != data)
+  {
+    link = &(*link)->queueNext;
+  }
+  if (*link == NULL)
+  {
+    return false;
+  }
+  *link = data->queueNext;
+  data->queueNext = NULL;
+  executor->inflight_count--;
+  return true;
+}
+
+/* Fail a request and wake its caller */
+static void request_executor_fail (return_data_t *data)
+{
+  data->errorDetected = true;
+  return_data_complete (data);
+}
+
+/* Set a request aside to be failed once the executor's mutex is released,
+ * as completing it may run a callback
+ */
+static void request_executor_fail_locked (request_executor_t *executor, return_data_t *data)
+{
+  data->queueNext = executor->failed;
+  executor->failed = data;
+}
+
+/* Fail the requests set aside, releasing the mutex while doing so */
+static void request_executor_complete_failed (request_executor_t *executor)
+{
+  return_data_t *data = executor->failed;
+  executor->failed = NULL;
+  if (data == NULL)
+  {
+    return;
+  }
+  pthread_mutex_unlock (&executor->mutex);
+  while (data)
+  {
+    return_data_t *next = data->queueNext;
+    data->queueNext = NULL;
+    request_executor_fail (data);
+    data = next;
+  }
+  pthread_mutex_lock (&executor->mutex);
+}
+
+/* Take the oldest queued request of a class */
+static return_data_t *request_executor_dequeue_locked (request_executor_t *executor, int priority)
+{
+  return_data_t *data = executor->queued[priority];
+  executor->queued[priority] = data->queueNext;
+  if (executor->queued[priority] == NULL)
+  {
+    executor->queued_last[priority] = NULL;
+  }
+  executor->queued_count[priority]--;
+  return data;
+}
+
+/* Take the next request to send while the window and budgets allow, highest
+ * class first. If the budgets do not allow it, note when they will.
+ */
+static return_data_t *request_executor_next_locked (request_executor_t *executor)
+{
+  executor->paced = false;
+  for (int priority = 0; priority < REQUEST_PRIORITY_CLASSES; priority++)
+  {
+    uint32_t window = (priority == REQUEST_PRIORITY_BACKGROUND) ?
+                      executor->background_window : executor->window;
+    if (executor->queued[priority] && executor->inflight_count < window)
+    {
+      unsigned len = executor->queued[priority]->pduLen;
+      uint64_t delay = token_bucket_delay (&executor->bucket, len);
+      uint64_t datalink_delay = token_bucket_delay (executor->datalink, len);
+      if (datalink_delay > delay)
+      {
+        delay = datalink_delay;
+      }
+      if (delay)
+      {
+        deadline_set (&executor->paced_until, (delay + 999999) / 1000000);
+        executor->paced = true;
+        return NULL;
+      }
+      return request_executor_dequeue_locked (executor, priority);
+    }
+  }
+  return NULL;
+}
+
+/* Transmit a request, failing it if it cannot be sent */
+static void request_executor_transmit_locked (request_executor_t *executor, return_data_t *data)
+{
+  if (!executor->send (data))
+  {
+    request_executor_fail_locked (executor, data);
+    return;
+  }
+  /* Retransmissions are not delayed, but still use the budgets */
+  token_bucket_take (&executor->bucket, data->pduLen);
+  token_bucket_take (executor->datalink, data->pduLen);
+  deadline_set (&data->deadline, data->timeout);
+  data->sent = stats_now ();
+  data->queueNext = executor->inflight;
+  executor->inflight = data;
+  executor->inflight_count++;
+}
+
+static void *request_executor_run (void *arg)
+{
+  request_executor_t *executor = (request_executor_t *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&executor->mutex);
+  while (executor->running)
+  {
+    /* Retransmit or fail the requests that have timed out */
+    deadline_now (&now);
+    return_data_t *data = executor->inflight;
+    const struct timespec *earliest = NULL;
+    while (data)
+    {
+      return_data_t *next = data->queueNext;
+      if (deadline_expired (&data->deadline, &now))
+      {
+        request_executor_remove_locked (executor, data);
+        if (data->retriesLeft > 0)
+        {
+          /* Back off, doubling the timeout for each retransmission */
+          data->retriesLeft--;
+          data->retransmitted = true;
+          data->timeout = (data->timeout * 2 < RTT_MAX_TIMEOUT) ? data->timeout * 2 : RTT_MAX_TIMEOUT;
+          request_executor_transmit_locked (executor, data);
+        }
+        else
+        {
+          data->timedOut = true;
+          request_executor_fail_locked (executor, data);
+        }
+      }
+      data = next;
+    }
+
+    /* Send queued requests while the window allows */
+    while ((data = request_executor_next_locked (executor)))
+    {
+      request_executor_transmit_locked (executor, data);
+    }
+    request_executor_complete_failed (executor);
+    if (!executor->running)
+    {
+      break;
+    }
+
+    /* Sleep until the next request times out or may be sent, or there is more work */
+    if (executor->paced)
+    {
+      earliest = &executor->paced_until;
+    }
+    for (data = executor->inflight; data; data = data->queueNext)
+    {
+      if (earliest == NULL || deadline_expired (&data->deadline, earliest))
+      {
+        earliest = &data->deadline;
+      }
+    }
+    deadline_wait (&executor->wakeup, &executor->mutex, earliest);
+  }
+
+  /* Fail everything outstanding so that no caller is left waiting */
+  while (executor->inflight)
+  {
+    return_data_t *data = executor->inflight;
+    request_executor_remove_locked (executor, data);
+    request_executor_fail_locked (executor, data);
+  }
+  for (int priority = 0; priority < REQUEST_PRIORITY_CLASSES; priority++)
+  {
+    while (executor->queued[priority])
+    {
+      request_executor_fail_locked (executor, request_executor_dequeue_locked (executor, priority));
+    }
+  }
+  request_executor_complete_failed (executor);
+  pthread_mutex_unlock (&executor->mutex);
+  return NULL;
+}
+
+/* Create an empty list of executors, whose sends share a datalink budget */
+request_executor_ll *request_executor_alloc (uint32_t window, request_send_t send,
+                                             token_bucket_t *datalink)
+{
+  request_executor_ll *list = calloc (1, sizeof (request_executor_ll));
+  list->first = NULL;
+  list->window = window ? window : 1;
+  list->send = send;
+  list->datalink = datalink;
+  pthread_mutex_init (&list->mutex, NULL);
+  return list;
+}
+
+/* Set the budget of a network, or of all networks without their own budget,
+ * including the executors already running
+ */
+void request_executor_set_rate (request_executor_ll *list, bool all, uint16_t network,
+                                uint32_t packet_rate, uint32_t byte_rate)
+{
+  pthread_mutex_lock (&list->mutex);
+  request_rate_t *rate = &list->default_rate;
+  if (!all)
+  {
+    rate = list->rates;
+    while (rate && rate->network != network)
+    {
+      rate = rate->next;
+    }
+    if (rate == NULL)
+    {
+      rate = calloc (1, sizeof (request_rate_t));
+      rate->network = network;
+      rate->next = list->rates;
+      list->rates = rate;
+    }
+  }
+  rate->packet_rate = packet_rate;
+  rate->byte_rate = byte_rate;
+  for (request_executor_t *current = list->first; current; current = current->next)
+  {
+    request_rate_t *own = list->rates;
+    while (own && own->network != current->network)
+    {
+      own = own->next;
+    }
+    if (own == rate || (own == NULL && all))
+    {
+      token_bucket_set_rate (&current->bucket, packet_rate, byte_rate);
+    }
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Set the number of requests each executor may have in flight */
+void request_executor_set_window (request_executor_ll *list, uint32_t window)
+{
+  pthread_mutex_lock (&list->mutex);
+  list->window = window ? window : 1;
+  for (request_executor_t *current = list->first; current; current = current->next)
+  {
+    pthread_mutex_lock (&current->mutex);
+    current->window = list->window;
+    current->background_window = list->window - list->window / 4;
+    /* A larger window may let queued requests be sent */
+    pthread_cond_signal (&current->wakeup);
+    pthread_mutex_unlock (&current->mutex);
+  }
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Stop the executors, failing their outstanding requests, and free the list */
+void request_executor_free (request_executor_ll *list)
+{
+  request_executor_t *current = list->first;
+  while (current)
+  {
+    request_executor_t *next = current->next;
+    pthread_mutex_lock (&current->mutex);
+    current->running = false;
+    pthread_cond_signal (&current->wakeup);
+    pthread_mutex_unlock (&current->mutex);
+    pthread_join (current->thread, NULL);
+    token_bucket_fini (&current->bucket);
+    pthread_cond_destroy (&current->wakeup);
+    pthread_mutex_destroy (&current->mutex);
+    free (current);
+    current = next;
+  }
+  while (list->rates)
+  {
+    request_rate_t *next = list->rates->next;
+    free (list->rates);
+    list->rates = next;
+  }
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Get the executor for a port and network, starting it on first use */
+request_executor_t *request_executor_get (request_executor_ll *list, uint16_t port, uint16_t network)
+{
+  pthread_mutex_lock (&list->mutex);
+  request_executor_t *current = list->first;
+  while (current && (current->port != port || current->network != network))
+  {
+    current = current->next;
+  }
+  if (current == NULL)
+  {
+    current = calloc (1, sizeof (request_executor_t));
+    current->port = port;
+    current->network = network;
+    current->running = true;
+    current->window = list->window;
+    /* Keep a quarter of the window for commands and interactive requests */
+    current->background_window = list->window - list->window / 4;
+    request_rate_t *rate = list->rates;
+    while (rate && rate->network != network)
+    {
+      rate = rate->next;
+    }
+    if (rate == NULL)
+    {
+      rate = &list->default_rate;
+    }
+    token_bucket_init (&current->bucket, rate->packet_rate, rate->byte_rate,
+                       &bacnetStats.network_throttled_ns);
+    current->datalink = list->datalink;
+    current->send = list->send;
+    pthread_mutex_init (&current->mutex, NULL);
+    deadline_cond_init (&current->wakeup);
+    pthread_create (&current->thread, NULL, request_executor_run, current);
+    current->next = list->first;
+    list->first = current;
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return current;
+}
+
+/* Queue an encoded request in its priority class. The caller sets its timeout
+ * and retries, or leaves them 0 for the stack's defaults, and waits for it
+ * with return_data_wait. A background request is failed at once if a full
+ * window of background requests is already queued.
+ */
+void request_executor_submit (request_executor_t *executor, return_data_t *data)
+{
+  int priority = data->priority < REQUEST_PRIORITY_CLASSES ? data->priority : REQUEST_PRIORITY_BACKGROUND;
+  data->executor = executor;
+  if (data->timeout == 0)
+  {
+    data->timeout = apdu_timeout ();
+    data->retriesLeft = apdu_retries ();
+  }
+  data->queueNext = NULL;
+  pthread_mutex_lock (&executor->mutex);
+  if (!executor->running ||
+      (priority == REQUEST_PRIORITY_BACKGROUND &&
+       executor->queued_count[priority] >= executor->window))
+  {
+    bool shed = executor->running;
+    pthread_mutex_unlock (&executor->mutex);
+    if (shed)
+    {
+      stats_record_shed ();
+    }
+    request_executor_fail (data);
+    return;
+  }
+  if (executor->queued_last[priority])
+  {
+    executor->queued_last[priority]->queueNext = data;
+  }
+  else
+  {
+    executor->queued[priority] = data;
+  }
+  executor->queued_last[priority] = data;
+  executor->queued_count[priority]++;
+  pthread_cond_signal (&executor->wakeup);
+  pthread_mutex_unlock (&executor->mutex);
+}
+
+/* Take a request out of flight for its response to be stored, called by
+ * return_data_claim with the pool locked. Returns false if the request has
+ * already timed out or been answered, in which case the response must be
+ * ignored.
+ */
+bool request_executor_claim (return_data_t *data, uint8_t invoke_id)
+{
+  request_executor_t *executor = data->executor;
+  if (executor == NULL)
+  {
+    return false;
+  }
+  pthread_mutex_lock (&executor->mutex);
+  bool claimed = data->requestInvokeID == invoke_id &&
+                 request_executor_remove_locked (executor, data);
+  if (claimed)
+  {
+    stats_record_latency (bacnetStats.response_latency, data->sent);
+    /* The window has room for another request */
+    pthread_cond_signal (&executor->wakeup);
+  }
+  pthread_mutex_unlock (&executor->mutex);
+  return claimed;
+}
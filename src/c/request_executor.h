@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "return_data.h"
+#include "token_bucket.h"
+
+#ifndef DEVICE_BACNET_C_REQUEST_EXECUTOR_H
+#define DEVICE_BACNET_C_REQUEST_EXECUTOR_H
+
+/* Function transmitting the encoded request held in a return_data structure */
+typedef bool (*request_send_t) (return_data_t *data);
+
+/* Thread owning the confirmed requests to the devices reached through one
+ * BACnet/IP port and network. It sends queued requests while fewer than
+ * window are in flight, highest priority class first, retransmits them on
+ * timeout, and completes them on failure. Background requests may only use
+ * background_window of the window, so that commands are never stuck behind
+ * polling. Sends are paced by the executor's own budget and the budget
+ * shared by the datalink.
+ */
+typedef struct request_executor_t
+{
+  /* UDP port (BACnet/IP only) and network number of the devices served */
+  uint16_t port;
+  uint16_t network;
+  pthread_t thread;
+  bool running;
+  /* Requests waiting to be sent in each priority class, oldest first */
+  return_data_t *queued[REQUEST_PRIORITY_CLASSES];
+  return_data_t *queued_last[REQUEST_PRIORITY_CLASSES];
+  uint32_t queued_count[REQUEST_PRIORITY_CLASSES];
+  /* Requests sent and waiting for a response */
+  return_data_t *inflight;
+  uint32_t inflight_count;
+  uint32_t window;
+  uint32_t background_window;
+  /* Budget of the network, and of the datalink it shares */
+  token_bucket_t bucket;
+  token_bucket_t *datalink;
+  /* When the budget allows the next queued request to be sent, while paced */
+  struct timespec paced_until;
+  bool paced;
+  /* Requests that have failed, completed once the mutex is released */
+  return_data_t *failed;
+  request_send_t send;
+  pthread_mutex_t mutex;
+  /* Signalled when requests are queued, completed or the executor stops */
+  pthread_cond_t wakeup;
+  struct request_executor_t *next;
+} request_executor_t;
+
+/* Budget of packets and bytes per second on a network */
+typedef struct request_rate_t
+{
+  uint16_t network;
+  uint32_t packet_rate;
+  uint32_t byte_rate;
+  struct request_rate_t *next;
+} request_rate_t;
+
+/* Linked list of executors, one per port and network in use */
+typedef struct request_executor_ll
+{
+  request_executor_t *first;
+  uint32_t window;
+  request_send_t send;
+  token_bucket_t *datalink;
+  /* Budget of networks without their own entry in rates */
+  request_rate_t default_rate;
+  request_rate_t *rates;
+  pthread_mutex_t mutex;
+} request_executor_ll;
+
+request_executor_ll *request_executor_alloc (uint32_t window, request_send_t send,
+                                             token_bucket_t *datalink);
+
+void request_executor_set_rate (request_executor_ll *list, bool all, uint16_t network,
+                                uint32_t packet_rate, uint32_t byte_rate);
+
+void request_executor_set_window (request_executor_ll *list, uint32_t window);
+
+void request_executor_free (request_executor_ll *list);
+
+request_executor_t *request_executor_get (request_executor_ll *list, uint16_t port, uint16_t network);
+
+void request_executor_submit (request_executor_t *executor, return_data_t *data);
+
+bool request_executor_claim (return_data_t *data, uint8_t invoke_id);
+
+#endif //DEVICE_BACNET_C_REQUEST_EXECUTOR_H
@@ -10,19 +10,43 @@
 #include <malloc.h>
 #include <memory.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <iot/os.h>
 #include "return_data.h"
+#include "hash.h"
+
+/* Check if two BACnet addresses identify the same device */
+static bool return_data_address_matches (BACNET_ADDRESS *a1, BACNET_ADDRESS *a2)
+{
+  if (a1->mac_len != a2->mac_len || a1->net != a2->net || a1->len != a2->len)
+  {
+    return false;
+  }
+  return memcmp (a1->mac, a2->mac, a1->mac_len) == 0 &&
+         memcmp (a1->adr, a2->adr, a1->len) == 0;
+}
+
+/* Hash a target address and invoke ID to a bucket */
+static uint32_t return_data_hash (return_data_ll *list, BACNET_ADDRESS *address,
+                                  uint8_t invoke_id)
+{
+  return hash_word (hash_address (HASH_INIT, address), invoke_id) & list->mask;
+}
 
 static return_data_t *
-return_data_get_locked (return_data_ll *list, uint8_t invoke_id)
+return_data_get_locked (return_data_ll *list, BACNET_ADDRESS *src, uint8_t invoke_id)
 {
-  return_data_t *current = list->first;
+  return_data_t *current = list->buckets[return_data_hash (list, src, invoke_id)];
 
-  /* While the linked list is not empty*/
+  /* Walk the hash chain */
   while (current)
   {
-    /* If the current element of the linked list is equal to the incoke ID*/
-    if (current->requestInvokeID == invoke_id)
+    /* If the current element matches the device and invoke ID */
+    if (current->requestInvokeID == invoke_id &&
+        return_data_address_matches (&current->targetAddress, src))
     {
       break;
     }
@@ -32,122 +56,221 @@ return_data_get_locked (return_data_ll *list, uint8_t invoke_id)
   return current;
 }
 
-static bool return_data_remove_by_ptr_locked (return_data_ll *list, return_data_t *data)
+static void return_data_unregister_locked (return_data_ll *list, return_data_t *data)
 {
-  if (data == NULL)
-  {
-    return false;
-  }
-  /* If the current link is the first link */
-  if (data == list->first)
+  return_data_t **link = &list->buckets[return_data_hash (list, &data->targetAddress,
+                                                          data->requestInvokeID)];
+  while (*link && *link != data)
   {
-    /* Update the first link to point to the next link */
-    list->first = list->first->next;
-
-    /* Set the next links previous pointer to NULL */
-    if (data->next)
-    {
-      data->next->prev = NULL;
-    }
+    link = &(*link)->next;
   }
-  else
+  if (*link)
   {
-    /* Exclude the current link from the linked list */
-    data->prev->next = data->next;
-    if (data->next)
-    {
-      data->next->prev = data->prev;
-    }
+    *link = data->next;
   }
-
-  free (data);
-
-  return true;
+  data->registered = false;
 }
 
-/* Create a new list */
-return_data_ll *return_data_alloc (void)
+/* Create a new pool of capacity return_data structures */
+return_data_ll *return_data_alloc (uint32_t capacity)
 {
   return_data_ll *list = malloc (sizeof (return_data_ll));
-  list->first = NULL;
+  uint32_t nbuckets = 1;
+
+  if (capacity == 0)
+  {
+    capacity = 1;
+  }
+  while (nbuckets < capacity && nbuckets < 0x80000000u)
+  {
+    nbuckets <<= 1;
+  }
+  list->buckets = calloc (nbuckets, sizeof (return_data_t *));
+  list->mask = nbuckets - 1;
+  list->capacity = capacity;
+  list->nextInvokeID = 1;
+  list->pool = calloc (capacity, sizeof (return_data_t));
+  list->free = NULL;
+  /* Chain the structures into the free pool */
+  for (uint32_t i = capacity; i > 0; i--)
+  {
+    return_data_t *data = &list->pool[i - 1];
+    data->next = list->free;
+    list->free = data;
+  }
   pthread_mutex_init (&list->mutex, NULL);
   return list;
 }
 
-/* Remove all nodes from a linked list*/
+/* Free the pool */
 void return_data_free (return_data_ll *list)
 {
-
-  return_data_t *current = list->first;
-  return_data_t *next;
-
-  while (current)
-  {
-    next = current->next;
-    /* Free the link */
-    free (current);
-    current = next;
-  }
   pthread_mutex_destroy (&list->mutex);
+  free (list->pool);
+  free (list->buckets);
   free (list);
 }
 
-/* Function for finding the return_data structure for a invoke ID */
+/* Find the structure registered for a device and invoke ID and claim it for
+ * its response. The pool stays locked until the claim is made, so that a
+ * structure returned to the pool and registered for another device meanwhile
+ * cannot take the response. Returns NULL if none is found or the claim fails.
+ */
 return_data_t *
-return_data_get (return_data_ll *list, uint8_t invoke_id)
+return_data_claim (return_data_ll *list, BACNET_ADDRESS *src, uint8_t invoke_id,
+                   bool (*claim) (return_data_t *data, uint8_t invoke_id))
 {
-  if (!list)
+  if (!list || !src)
   {
     return NULL;
   }
   pthread_mutex_lock (&list->mutex);
-  return_data_t *entry = return_data_get_locked (list, invoke_id);
+  return_data_t *entry = return_data_get_locked (list, src, invoke_id);
+  if (entry && !claim (entry, invoke_id))
+  {
+    entry = NULL;
+  }
   pthread_mutex_unlock (&list->mutex);
-  /* Return NULL if not found */
   return entry;
 }
 
-/* Function for adding new return_data structure linked list*/
-return_data_t *return_data_set (return_data_ll *list,
-                                uint8_t invoke_id)
+/* Take an unused return_data structure from the pool, or NULL if all are in use */
+return_data_t *return_data_set (return_data_ll *list)
 {
   pthread_mutex_lock (&list->mutex);
-  return_data_t *value;
-
-  /* Allocate memory and copy values to new variable*/
-  value = malloc (sizeof (return_data_t));
-  memset (value, 0, sizeof (return_data_t));
-  /* Add the given invoke ID */
-  value->requestInvokeID = invoke_id;
-  /* Allocate memory for return value*/
-  memset (&value->value, 0, sizeof (BACNET_READ_ACCESS_DATA));
-  /* Initialize condition variable, to indicate that the return value has not yet been set */
-  pthread_cond_init (&value->condition, NULL);
-  /* Initialize mutex used by condition variable */
-  pthread_mutex_init (&value->mutex, NULL);
-  /* Set the error detected flag to false */
-  value->errorDetected = false;
-  value->prev = NULL;
-  value->next = list->first;
-
-  if (list->first != NULL)
-  {
-    list->first->prev = value;
-  }
-
-  /* Point the link head to the new link */
-  list->first = value;
+  return_data_t *value = list->free;
+  if (value)
+  {
+    list->free = value->next;
+    /* Reset everything */
+    value->value = NULL;
+    value->requestInvokeID = 0;
+    memset (&value->targetAddress, 0, sizeof (BACNET_ADDRESS));
+    value->maxApdu = 0;
+    value->errorDetected = false;
+    value->timedOut = false;
+    value->registered = false;
+    value->pduLen = 0;
+    value->executor = NULL;
+    value->deviceInstance = 0;
+    value->retriesLeft = 0;
+    value->timeout = 0;
+    value->retransmitted = false;
+    value->responded = false;
+    value->priority = REQUEST_PRIORITY_INTERACTIVE;
+    value->queueNext = NULL;
+    value->state = RETURN_DATA_PENDING;
+    value->callback = NULL;
+    value->context = NULL;
+    value->next = NULL;
+  }
   pthread_mutex_unlock (&list->mutex);
   return value;
 }
 
-/* Free and remove a single link from the linked list */
-bool return_data_remove_by_ptr (return_data_ll *list, return_data_t *data)
+/* Assign an invoke ID that is not in use for the target device, so that
+ * responses can be matched. Returns false if all invoke IDs for the device
+ * are in use.
+ */
+bool return_data_register (return_data_ll *list, return_data_t *data)
 {
+  pthread_mutex_lock (&list->mutex);
+  uint8_t invoke_id = list->nextInvokeID;
+  /* Invoke ID 0 is reserved to mean that no request has been sent */
+  for (int tries = 0; tries < UINT8_MAX; tries++)
+  {
+    if (return_data_get_locked (list, &data->targetAddress, invoke_id) == NULL)
+    {
+      data->requestInvokeID = invoke_id;
+      uint32_t bucket = return_data_hash (list, &data->targetAddress, invoke_id);
+      data->next = list->buckets[bucket];
+      list->buckets[bucket] = data;
+      data->registered = true;
+      list->nextInvokeID = (invoke_id == UINT8_MAX) ? 1 : invoke_id + 1;
+      break;
+    }
+    invoke_id = (invoke_id == UINT8_MAX) ? 1 : invoke_id + 1;
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return data->registered;
+}
 
+/* Return a return_data structure to the pool */
+bool return_data_remove_by_ptr (return_data_ll *list, return_data_t *data)
+{
+  if (data == NULL)
+  {
+    return false;
+  }
   pthread_mutex_lock (&list->mutex);
-  bool ret = return_data_remove_by_ptr_locked (list, data);
+  if (data->registered)
+  {
+    return_data_unregister_locked (list, data);
+  }
+  data->next = list->free;
+  list->free = data;
   pthread_mutex_unlock (&list->mutex);
 
-  return ret;
+  return true;
+}
+
+static void return_data_futex_wake (uint32_t *addr)
+{
+  syscall (SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Sleep while the state is waiting, until woken or the absolute monotonic deadline passes */
+static int return_data_futex_wait (uint32_t *addr, const struct timespec *abstime)
+{
+  return (int) syscall (SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE,
+                        RETURN_DATA_WAITING, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/* Mark a request as complete, waking the thread waiting for it or running its callback */
+void return_data_complete (return_data_t *data)
+{
+  if (data->callback)
+  {
+    __atomic_store_n (&data->state, RETURN_DATA_COMPLETE, __ATOMIC_RELEASE);
+    data->callback (data, data->context);
+    return;
+  }
+  /* Only enter the kernel if a thread is sleeping on the request */
+  if (__atomic_exchange_n (&data->state, RETURN_DATA_COMPLETE, __ATOMIC_ACQ_REL) ==
+      RETURN_DATA_WAITING)
+  {
+    return_data_futex_wake (&data->state);
+  }
+}
+
+/* Wait until a request is complete, or until an absolute monotonic deadline
+ * if one is given. Returns false if the deadline passed first.
+ */
+bool return_data_timedwait (return_data_t *data, const struct timespec *abstime)
+{
+  for (;;)
+  {
+    uint32_t state = __atomic_load_n (&data->state, __ATOMIC_ACQUIRE);
+    if (state == RETURN_DATA_COMPLETE)
+    {
+      return true;
+    }
+    if (state == RETURN_DATA_PENDING &&
+        !__atomic_compare_exchange_n (&data->state, &state, RETURN_DATA_WAITING, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      /* Completed or changed meanwhile; check again */
+      continue;
+    }
+    if (return_data_futex_wait (&data->state, abstime) < 0 && errno == ETIMEDOUT)
+    {
+      return __atomic_load_n (&data->state, __ATOMIC_ACQUIRE) == RETURN_DATA_COMPLETE;
+    }
+  }
+}
+
+/* Wait until a request is complete */
+void return_data_wait (return_data_t *data)
+{
+  return_data_timedwait (data, NULL);
 }
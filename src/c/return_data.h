@@ -7,48 +7,117 @@
  */
 
 #include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 #include <bacdef.h>
+#include <npdu.h>
 #include <bacapp.h>
 #include <rpm.h>
 
 #ifndef DEVICE_BACNET_C_RETURN_DATA_H
 #define DEVICE_BACNET_C_RETURN_DATA_H
 
+/* Completion states of a request. A waiter moves a pending request to
+ * waiting before sleeping, so that completion only wakes when necessary.
+ */
+#define RETURN_DATA_PENDING 0
+#define RETURN_DATA_WAITING 1
+#define RETURN_DATA_COMPLETE 2
+
+/* Priority classes of requests. Queued requests of a higher class (lower
+ * value) are always sent first, and background requests may be shed when
+ * their queue is long.
+ */
+#define REQUEST_PRIORITY_COMMAND 0
+#define REQUEST_PRIORITY_INTERACTIVE 1
+#define REQUEST_PRIORITY_BACKGROUND 2
+#define REQUEST_PRIORITY_CLASSES 3
+
 typedef struct return_data_t
 {
   /* The value to be returned to EdgeX */
   BACNET_APPLICATION_DATA_VALUE *value;
-  /* The Request Invoke ID of the message */
+  /* The Request Invoke ID of the message, unique per target device */
   uint8_t requestInvokeID;
   /* The Address of the Target Device */
   BACNET_ADDRESS targetAddress;
+  /* The maximum APDU length accepted by the Target Device */
+  unsigned maxApdu;
   /* Error Bool */
   bool errorDetected;
-  /* Condition variable to test if a response have been received */
-  pthread_cond_t condition;
-  /* Mutex used by the condition variable */
-  pthread_mutex_t mutex;
+  /* Set when no response was received after all retries */
+  bool timedOut;
+  /* Set while the structure is registered under its invoke ID */
+  bool registered;
+  /* Encoded request, kept for retransmission */
+  uint8_t pdu[MAX_PDU];
+  uint16_t pduLen;
+  BACNET_NPDU_DATA npduData;
+  /* Executor the request was submitted to, and the request's priority class */
+  struct request_executor_t *executor;
+  uint8_t priority;
+  /* Device the request is for, used to measure its round trip time */
+  uint32_t deviceInstance;
+  /* Retransmissions left, the timeout of the current attempt in milliseconds,
+   * and when the current attempt times out (CLOCK_MONOTONIC)
+   */
+  uint8_t retriesLeft;
+  uint32_t timeout;
+  struct timespec deadline;
+  /* Set once retransmitted, when responses no longer give a round trip time */
+  bool retransmitted;
+  /* Set when the device sent a response, even an error */
+  bool responded;
+  /* When the request was last transmitted, from stats_now */
+  uint64_t sent;
+  /* Next request in the executor's queue or in-flight list */
+  struct return_data_t *queueNext;
+  /* Completion state, waited on with a futex */
+  uint32_t state;
+  /* Called on completion in place of waking a waiting thread, for requests
+   * no thread waits for. The callback returns the structure to the pool.
+   * Without a callback, the context is where an ACK handler decodes a result
+   * other than a value.
+   */
+  void (*callback) (struct return_data_t *data, void *context);
+  void *context;
+  /* Next structure in the same hash bucket, or in the free pool */
   struct return_data_t *next;
-  struct return_data_t *prev;
 } return_data_t;
 
-/* Linked list of return_data structures */
+/* Pool of return_data structures, hashed by target address and invoke ID */
 typedef struct return_data_ll
 {
-  return_data_t *first;
+  /* Preallocated structures, and those currently unused */
+  return_data_t *pool;
+  return_data_t *free;
+  uint32_t capacity;
+  /* Hash buckets of registered structures */
+  return_data_t **buckets;
+  uint32_t mask;
+  /* Where the search for the next free invoke ID starts */
+  uint8_t nextInvokeID;
   pthread_mutex_t mutex;
 } return_data_ll;
 
-return_data_ll *return_data_alloc (void);
+return_data_ll *return_data_alloc (uint32_t capacity);
 
 void return_data_free (return_data_ll *list);
 
 return_data_t *
-return_data_get (return_data_ll *list, uint8_t invoke_id);
+return_data_claim (return_data_ll *list, BACNET_ADDRESS *src, uint8_t invoke_id,
+                   bool (*claim) (return_data_t *data, uint8_t invoke_id));
 
-return_data_t *return_data_set (return_data_ll *list,
-                                uint8_t invoke_id);
+return_data_t *return_data_set (return_data_ll *list);
+
+bool return_data_register (return_data_ll *list, return_data_t *data);
 
 bool return_data_remove_by_ptr (return_data_ll *list, return_data_t *data);
 
+void return_data_complete (return_data_t *data);
+
+void return_data_wait (return_data_t *data);
+
+bool return_data_timedwait (return_data_t *data, const struct timespec *abstime);
+
 #endif //DEVICE_BACNET_C_RETURN_DATA_H
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iot/os.h>
+#include "router_table.h"
+#include "deadline.h"
+
+static router_table_t *
+router_table_get_locked (router_table_ll *list, uint16_t network)
+{
+  router_table_t *current = list->first;
+
+  /* While the linked list is not empty*/
+  while (current)
+  {
+    /* If the current element of the linked list serves the network */
+    if (current->network == network)
+    {
+      break;
+    }
+    current = current->next;
+  }
+  /* Return NULL if not found */
+  return current;
+}
+
+/* Create a new list */
+router_table_ll *router_table_alloc (void)
+{
+  router_table_ll *list = malloc (sizeof (router_table_ll));
+  list->first = NULL;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->updated);
+  return list;
+}
+
+/* Remove all nodes from a linked list*/
+void router_table_free (router_table_ll *list)
+{
+  router_table_t *current = list->first;
+  router_table_t *next;
+
+  while (current)
+  {
+    next = current->next;
+    /* Free the link */
+    free (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->updated);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Copy the address of the router serving a network, if it is known */
+bool router_table_get (router_table_ll *list, uint16_t network,
+                       BACNET_ADDRESS *router)
+{
+  if (!list)
+  {
+    return false;
+  }
+  pthread_mutex_lock (&list->mutex);
+  router_table_t *entry = router_table_get_locked (list, network);
+  if (entry)
+  {
+    *router = entry->router;
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return entry != NULL;
+}
+
+/* Add or update the router serving a network */
+void router_table_set (router_table_ll *list, uint16_t network,
+                       BACNET_ADDRESS *router)
+{
+  pthread_mutex_lock (&list->mutex);
+  router_table_t *entry = router_table_get_locked (list, network);
+  if (entry == NULL)
+  {
+    /* Allocate memory and add the new link at the head of the list */
+    entry = malloc (sizeof (router_table_t));
+    memset (entry, 0, sizeof (router_table_t));
+    entry->network = network;
+    entry->prev = NULL;
+    entry->next = list->first;
+    if (list->first != NULL)
+    {
+      list->first->prev = entry;
+    }
+    list->first = entry;
+  }
+
+  /* Only the local datalink part of the address identifies the router */
+  memset (&entry->router, 0, sizeof (BACNET_ADDRESS));
+  entry->router.mac_len = router->mac_len;
+  memcpy (entry->router.mac, router->mac, router->mac_len);
+
+  pthread_cond_broadcast (&list->updated);
+  pthread_mutex_unlock (&list->mutex);
+}
+
+/* Wait until a router for the network is known or the timeout expires */
+bool router_table_wait (router_table_ll *list, uint16_t network,
+                        BACNET_ADDRESS *router, const struct timespec *timeout)
+{
+  int rc = 0;
+  pthread_mutex_lock (&list->mutex);
+  router_table_t *entry = router_table_get_locked (list, network);
+  while (entry == NULL && rc == 0)
+  {
+    rc = pthread_cond_timedwait (&list->updated, &list->mutex, timeout);
+    entry = router_table_get_locked (list, network);
+  }
+  if (entry)
+  {
+    *router = entry->router;
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return entry != NULL;
+}
+
+/* Forget the router for a network, e.g. after the route has gone stale */
+void router_table_remove (router_table_ll *list, uint16_t network)
+{
+  pthread_mutex_lock (&list->mutex);
+  router_table_t *entry = router_table_get_locked (list, network);
+  if (entry == NULL)
+  {
+    pthread_mutex_unlock (&list->mutex);
+    return;
+  }
+  /* If the current link is the first link */
+  if (entry == list->first)
+  {
+    /* Update the first link to point to the next link */
+    list->first = list->first->next;
+
+    /* Set the next links previous pointer to NULL */
+    if (entry->next)
+    {
+      entry->next->prev = NULL;
+    }
+  }
+  else
+  {
+    /* Exclude the current link from the linked list */
+    entry->prev->next = entry->next;
+    if (entry->next)
+    {
+      entry->next->prev = entry->prev;
+    }
+  }
+  pthread_mutex_unlock (&list->mutex);
+  free (entry);
+}
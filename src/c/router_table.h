@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <bacdef.h>
+
+#ifndef DEVICE_BACNET_C_ROUTER_TABLE_H
+#define DEVICE_BACNET_C_ROUTER_TABLE_H
+
+/* Structure containing a remote network number and the router serving it */
+typedef struct router_table_t
+{
+  /* Remote network number (DNET) */
+  uint16_t network;
+  /* Local datalink address of the router */
+  BACNET_ADDRESS router;
+  struct router_table_t *next;
+  struct router_table_t *prev;
+} router_table_t;
+
+/* Linked list of router table entries */
+typedef struct router_table_ll
+{
+  router_table_t *first;
+  pthread_mutex_t mutex;
+  /* Signalled whenever a route is added or updated */
+  pthread_cond_t updated;
+} router_table_ll;
+
+router_table_ll *router_table_alloc (void);
+
+void router_table_free (router_table_ll *list);
+
+bool router_table_get (router_table_ll *list, uint16_t network,
+                       BACNET_ADDRESS *router);
+
+void router_table_set (router_table_ll *list, uint16_t network,
+                       BACNET_ADDRESS *router);
+
+bool router_table_wait (router_table_ll *list, uint16_t network,
+                        BACNET_ADDRESS *router, const struct timespec *timeout);
+
+void router_table_remove (router_table_ll *list, uint16_t network);
+
+#endif //DEVICE_BACNET_C_ROUTER_TABLE_H
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include "rtt_table.h"
+#include "hash.h"
+
+static uint32_t rtt_table_hash (uint32_t device_id)
+{
+  return hash_word (HASH_INIT, device_id) % RTT_TABLE_BUCKETS;
+}
+
+static rtt_entry_t *rtt_table_get_locked (rtt_table_ll *table, uint32_t device_id)
+{
+  rtt_entry_t *current = table->buckets[rtt_table_hash (device_id)];
+  while (current && current->device_id != device_id)
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+/* Find the entry of a device, adding an empty one if there is none */
+static rtt_entry_t *rtt_table_entry_locked (rtt_table_ll *table, uint32_t device_id)
+{
+  rtt_entry_t *entry = rtt_table_get_locked (table, device_id);
+  if (entry == NULL)
+  {
+    uint32_t bucket = rtt_table_hash (device_id);
+    entry = calloc (1, sizeof (rtt_entry_t));
+    entry->device_id = device_id;
+    entry->next = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+  }
+  return entry;
+}
+
+rtt_table_ll *rtt_table_alloc (void)
+{
+  rtt_table_ll *table = calloc (1, sizeof (rtt_table_ll));
+  pthread_mutex_init (&table->mutex, NULL);
+  return table;
+}
+
+void rtt_table_free (rtt_table_ll *table)
+{
+  for (int i = 0; i < RTT_TABLE_BUCKETS; i++)
+  {
+    rtt_entry_t *current = table->buckets[i];
+    while (current)
+    {
+      rtt_entry_t *next = current->next;
+      free (current);
+      current = next;
+    }
+  }
+  pthread_mutex_destroy (&table->mutex);
+  free (table);
+}
+
+/* Get the timeout in milliseconds for a request to a device: the smoothed
+ * round trip time plus four times its variation, or initial if the device
+ * has not yet been measured
+ */
+uint32_t rtt_table_timeout (rtt_table_ll *table, uint32_t device_id, uint32_t initial)
+{
+  uint64_t timeout = initial;
+  pthread_mutex_lock (&table->mutex);
+  rtt_entry_t *entry = rtt_table_get_locked (table, device_id);
+  if (entry && entry->measured)
+  {
+    timeout = (entry->srtt + 4 * entry->rttvar + 999) / 1000;
+  }
+  pthread_mutex_unlock (&table->mutex);
+  if (timeout < RTT_MIN_TIMEOUT)
+  {
+    timeout = RTT_MIN_TIMEOUT;
+  }
+  return timeout > RTT_MAX_TIMEOUT ? RTT_MAX_TIMEOUT : (uint32_t) timeout;
+}
+
+/* Add a round trip time in nanoseconds, measured on a request that was not retransmitted */
+void rtt_table_sample (rtt_table_ll *table, uint32_t device_id, uint64_t rtt)
+{
+  rtt /= 1000;
+  pthread_mutex_lock (&table->mutex);
+  rtt_entry_t *entry = rtt_table_entry_locked (table, device_id);
+  if (!entry->measured)
+  {
+    entry->measured = true;
+    entry->srtt = rtt;
+    entry->rttvar = rtt / 2;
+  }
+  else
+  {
+    uint64_t delta = (entry->srtt > rtt) ? entry->srtt - rtt : rtt - entry->srtt;
+    entry->rttvar = (3 * entry->rttvar + delta) / 4;
+    entry->srtt = (7 * entry->srtt + rtt) / 8;
+  }
+  pthread_mutex_unlock (&table->mutex);
+}
+
+/* Record that a message was received from a device */
+void rtt_table_heard (rtt_table_ll *table, uint32_t device_id, uint64_t now)
+{
+  pthread_mutex_lock (&table->mutex);
+  rtt_table_entry_locked (table, device_id)->heard = now;
+  pthread_mutex_unlock (&table->mutex);
+}
+
+/* Get when a device was last heard from, or 0 if it never has been */
+uint64_t rtt_table_last_heard (rtt_table_ll *table, uint32_t device_id)
+{
+  uint64_t heard = 0;
+  pthread_mutex_lock (&table->mutex);
+  rtt_entry_t *entry = rtt_table_get_locked (table, device_id);
+  if (entry)
+  {
+    heard = entry->heard;
+  }
+  pthread_mutex_unlock (&table->mutex);
+  return heard;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifndef DEVICE_BACNET_C_RTT_TABLE_H
+#define DEVICE_BACNET_C_RTT_TABLE_H
+
+#define RTT_TABLE_BUCKETS 1024
+
+/* Limits of the adaptive timeouts, in milliseconds */
+#define RTT_MIN_TIMEOUT 20
+#define RTT_MAX_TIMEOUT 30000
+
+/* Smoothed round trip time of a device and its variation, in microseconds,
+ * estimated as for TCP (RFC 6298), and when the device was last heard from
+ */
+typedef struct rtt_entry_t
+{
+  uint32_t device_id;
+  bool measured;
+  uint64_t srtt;
+  uint64_t rttvar;
+  /* Time of the last message from the device, from stats_now */
+  uint64_t heard;
+  /* Next entry in the same hash bucket */
+  struct rtt_entry_t *next;
+} rtt_entry_t;
+
+/* Hash table of the round trip times of devices */
+typedef struct rtt_table_ll
+{
+  rtt_entry_t *buckets[RTT_TABLE_BUCKETS];
+  pthread_mutex_t mutex;
+} rtt_table_ll;
+
+rtt_table_ll *rtt_table_alloc (void);
+
+void rtt_table_free (rtt_table_ll *table);
+
+uint32_t rtt_table_timeout (rtt_table_ll *table, uint32_t device_id, uint32_t initial);
+
+void rtt_table_sample (rtt_table_ll *table, uint32_t device_id, uint64_t rtt);
+
+void rtt_table_heard (rtt_table_ll *table, uint32_t device_id, uint64_t now);
+
+uint64_t rtt_table_last_heard (rtt_table_ll *table, uint32_t device_id);
+
+#endif //DEVICE_BACNET_C_RTT_TABLE_H
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <time.h>
+#include "stats.h"
+
+bacnet_stats_t bacnetStats;
+
+/* Raise a maximum to at least value */
+static void stats_update_max (uint64_t *max, uint64_t value)
+{
+  uint64_t current = __atomic_load_n (max, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n (max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+}
+
+void stats_record_rx_batch (uint64_t datagrams)
+{
+  __atomic_fetch_add (&bacnetStats.rx_batches, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&bacnetStats.rx_datagrams, datagrams, __ATOMIC_RELAXED);
+  stats_update_max (&bacnetStats.rx_max_batch, datagrams);
+}
+
+void stats_record_tx_batch (uint64_t datagrams)
+{
+  __atomic_fetch_add (&bacnetStats.tx_batches, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&bacnetStats.tx_datagrams, datagrams, __ATOMIC_RELAXED);
+  stats_update_max (&bacnetStats.tx_max_batch, datagrams);
+}
+
+void stats_record_shed (void)
+{
+  __atomic_fetch_add (&bacnetStats.requests_shed, 1, __ATOMIC_RELAXED);
+}
+
+/* Get a monotonic timestamp in nanoseconds, for measuring latencies */
+uint64_t stats_now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Count the latency from a timestamp until now in a histogram */
+void stats_record_latency (uint64_t *histogram, uint64_t since)
+{
+  uint64_t now = stats_now ();
+  uint64_t us = (now > since) ? (now - since) / 1000 : 0;
+  unsigned bucket = 0;
+  while (us && bucket < STATS_LATENCY_BUCKETS - 1)
+  {
+    us >>= 1;
+    bucket++;
+  }
+  __atomic_fetch_add (&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/* Log the non-empty buckets of a latency histogram */
+static void stats_log_latency (iot_logger_t *lc, const char *name, uint64_t *histogram)
+{
+  for (unsigned i = 0; i < STATS_LATENCY_BUCKETS; i++)
+  {
+    uint64_t count = __atomic_load_n (&histogram[i], __ATOMIC_RELAXED);
+    if (count == 0)
+    {
+      continue;
+    }
+    if (i < STATS_LATENCY_BUCKETS - 1)
+    {
+      iot_log_info (lc, "%s latency under %lluus: %llu", name, 1ULL << i, (unsigned long long) count);
+    }
+    else
+    {
+      iot_log_info (lc, "%s latency over %lluus: %llu", name, 1ULL << (i - 1), (unsigned long long) count);
+    }
+  }
+}
+
+/* Log the counters, with the average batch sizes */
+void stats_log (iot_logger_t *lc)
+{
+  uint64_t rx_batches = __atomic_load_n (&bacnetStats.rx_batches, __ATOMIC_RELAXED);
+  uint64_t rx_datagrams = __atomic_load_n (&bacnetStats.rx_datagrams, __ATOMIC_RELAXED);
+  uint64_t tx_batches = __atomic_load_n (&bacnetStats.tx_batches, __ATOMIC_RELAXED);
+  uint64_t tx_datagrams = __atomic_load_n (&bacnetStats.tx_datagrams, __ATOMIC_RELAXED);
+
+  iot_log_info (lc, "Received %llu datagrams in %llu calls (average %.2f, maximum %llu)",
+                (unsigned long long) rx_datagrams, (unsigned long long) rx_batches,
+                rx_batches ? (double) rx_datagrams / rx_batches : 0.0,
+                (unsigned long long) __atomic_load_n (&bacnetStats.rx_max_batch, __ATOMIC_RELAXED));
+  iot_log_info (lc, "Sent %llu datagrams in %llu calls (average %.2f, maximum %llu)",
+                (unsigned long long) tx_datagrams, (unsigned long long) tx_batches,
+                tx_batches ? (double) tx_datagrams / tx_batches : 0.0,
+                (unsigned long long) __atomic_load_n (&bacnetStats.tx_max_batch, __ATOMIC_RELAXED));
+  iot_log_info (lc, "Shed %llu background requests",
+                (unsigned long long) __atomic_load_n (&bacnetStats.requests_shed, __ATOMIC_RELAXED));
+  iot_log_info (lc, "Throttled for %.3fs by the datalink budget, %.3fs by network budgets and %.3fs by the BBMD budget",
+                __atomic_load_n (&bacnetStats.datalink_throttled_ns, __ATOMIC_RELAXED) / 1e9,
+                __atomic_load_n (&bacnetStats.network_throttled_ns, __ATOMIC_RELAXED) / 1e9,
+                __atomic_load_n (&bacnetStats.bbmd_throttled_ns, __ATOMIC_RELAXED) / 1e9);
+  stats_log_latency (lc, "Decode", bacnetStats.decode_latency);
+  stats_log_latency (lc, "Response", bacnetStats.response_latency);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include "iot/logger.h"
+
+#ifndef DEVICE_BACNET_C_STATS_H
+#define DEVICE_BACNET_C_STATS_H
+
+/* Latency histograms have power of two buckets: bucket i counts latencies
+ * under 2^i microseconds, and the last bucket counts the rest
+ */
+#define STATS_LATENCY_BUCKETS 24
+
+/* Counters of datalink and request activity, updated atomically from any thread */
+typedef struct bacnet_stats_t
+{
+  /* Receive calls that returned data, and the datagrams they returned */
+  uint64_t rx_batches;
+  uint64_t rx_datagrams;
+  uint64_t rx_max_batch;
+  /* Send calls, and the datagrams they sent */
+  uint64_t tx_batches;
+  uint64_t tx_datagrams;
+  uint64_t tx_max_batch;
+  /* Background requests failed without being sent, due to overload */
+  uint64_t requests_shed;
+  /* Nanoseconds traffic waited for the datalink, network and BBMD budgets */
+  uint64_t datalink_throttled_ns;
+  uint64_t network_throttled_ns;
+  uint64_t bbmd_throttled_ns;
+  /* Time from receiving a frame to decoding it, and from sending a request to its response */
+  uint64_t decode_latency[STATS_LATENCY_BUCKETS];
+  uint64_t response_latency[STATS_LATENCY_BUCKETS];
+} bacnet_stats_t;
+
+extern bacnet_stats_t bacnetStats;
+
+void stats_record_rx_batch (uint64_t datagrams);
+
+void stats_record_tx_batch (uint64_t datagrams);
+
+void stats_record_shed (void);
+
+uint64_t stats_now (void);
+
+void stats_record_latency (uint64_t *histogram, uint64_t since);
+
+void stats_log (iot_logger_t *lc);
+
+#endif //DEVICE_BACNET_C_STATS_H
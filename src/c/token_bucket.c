@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <iot/os.h>
+#include "token_bucket.h"
+
+static uint64_t token_bucket_elapsed (const struct timespec *from, const struct timespec *to)
+{
+  int64_t ns = (int64_t) (to->tv_sec - from->tv_sec) * 1000000000 + (to->tv_nsec - from->tv_nsec);
+  return ns > 0 ? (uint64_t) ns : 0;
+}
+
+/* Add the tokens earned since the last refill, up to one second's worth */
+static void token_bucket_refill_locked (token_bucket_t *bucket, const struct timespec *now)
+{
+  double seconds = token_bucket_elapsed (&bucket->refilled, now) / 1e9;
+  bucket->refilled = *now;
+  if (bucket->packet_rate)
+  {
+    bucket->packets += seconds * bucket->packet_rate;
+    if (bucket->packets > bucket->packet_rate)
+    {
+      bucket->packets = bucket->packet_rate;
+    }
+  }
+  if (bucket->byte_rate)
+  {
+    bucket->bytes += seconds * bucket->byte_rate;
+    if (bucket->bytes > bucket->byte_rate)
+    {
+      bucket->bytes = bucket->byte_rate;
+    }
+  }
+}
+
+/* Initialize a bucket, full, adding the time traffic waits to a counter */
+void token_bucket_init (token_bucket_t *bucket, uint32_t packet_rate, uint32_t byte_rate,
+                        uint64_t *throttled)
+{
+  bucket->packet_rate = packet_rate;
+  bucket->byte_rate = byte_rate;
+  bucket->packets = packet_rate;
+  bucket->bytes = byte_rate;
+  clock_gettime (CLOCK_MONOTONIC, &bucket->refilled);
+  bucket->is_blocked = false;
+  bucket->throttled = throttled;
+  pthread_mutex_init (&bucket->mutex, NULL);
+}
+
+void token_bucket_fini (token_bucket_t *bucket)
+{
+  pthread_mutex_destroy (&bucket->mutex);
+}
+
+/* Change the rates of a bucket, keeping the tokens it holds up to the new
+ * rates. A bucket that was unlimited starts full.
+ */
+void token_bucket_set_rate (token_bucket_t *bucket, uint32_t packet_rate, uint32_t byte_rate)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock (&bucket->mutex);
+  token_bucket_refill_locked (bucket, &now);
+  if (bucket->packet_rate == 0 || bucket->packets > packet_rate)
+  {
+    bucket->packets = packet_rate;
+  }
+  if (bucket->byte_rate == 0 || bucket->bytes > byte_rate)
+  {
+    bucket->bytes = byte_rate;
+  }
+  __atomic_store_n (&bucket->packet_rate, packet_rate, __ATOMIC_RELAXED);
+  __atomic_store_n (&bucket->byte_rate, byte_rate, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&bucket->mutex);
+}
+
+/* Check whether a bucket limits traffic at all */
+bool token_bucket_limited (const token_bucket_t *bucket)
+{
+  return bucket->packet_rate || bucket->byte_rate;
+}
+
+/* Get the nanoseconds until a packet of len bytes may be sent, 0 if it may
+ * be sent now. No tokens are taken.
+ */
+uint64_t token_bucket_delay (token_bucket_t *bucket, unsigned len)
+{
+  struct timespec now;
+  double wait = 0.0;
+
+  if (!token_bucket_limited (bucket))
+  {
+    return 0;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock (&bucket->mutex);
+  token_bucket_refill_locked (bucket, &now);
+  if (bucket->packet_rate && bucket->packets < 1.0)
+  {
+    wait = (1.0 - bucket->packets) / bucket->packet_rate;
+  }
+  /* A packet larger than the byte budget is sent once the bucket is full */
+  double needed = (bucket->byte_rate && len > bucket->byte_rate) ? bucket->byte_rate : len;
+  if (bucket->byte_rate && bucket->bytes < needed)
+  {
+    double byte_wait = (needed - bucket->bytes) / bucket->byte_rate;
+    if (byte_wait > wait)
+    {
+      wait = byte_wait;
+    }
+  }
+  if (wait > 0.0 && !bucket->is_blocked)
+  {
+    bucket->blocked = now;
+    bucket->is_blocked = true;
+  }
+  pthread_mutex_unlock (&bucket->mutex);
+  /* Round up so that the tokens are available when the wait ends */
+  return wait > 0.0 ? (uint64_t) (wait * 1e9) + 1 : 0;
+}
+
+/* Take the tokens for a packet of len bytes, which may leave the bucket in debt */
+void token_bucket_take (token_bucket_t *bucket, unsigned len)
+{
+  struct timespec now;
+
+  if (!token_bucket_limited (bucket))
+  {
+    return;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock (&bucket->mutex);
+  token_bucket_refill_locked (bucket, &now);
+  bucket->packets -= 1.0;
+  bucket->bytes -= len;
+  if (bucket->is_blocked)
+  {
+    __atomic_fetch_add (bucket->throttled, token_bucket_elapsed (&bucket->blocked, &now), __ATOMIC_RELAXED);
+    bucket->is_blocked = false;
+  }
+  pthread_mutex_unlock (&bucket->mutex);
+}
+
+/* Sleep until a packet of len bytes may be sent, then take its tokens */
+void token_bucket_wait (token_bucket_t *bucket, unsigned len)
+{
+  uint64_t delay;
+  while ((delay = token_bucket_delay (bucket, len)) > 0)
+  {
+    struct timespec pause = { (time_t) (delay / 1000000000), (long) (delay % 1000000000) };
+    nanosleep (&pause, NULL);
+  }
+  token_bucket_take (bucket, len);
+}
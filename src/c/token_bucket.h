@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef DEVICE_BACNET_C_TOKEN_BUCKET_H
+#define DEVICE_BACNET_C_TOKEN_BUCKET_H
+
+/* Budget of packets and bytes per second for traffic sharing a link. Each
+ * bucket holds up to one second of tokens, so bursts up to the rate are
+ * sent at once. A rate of 0 is unlimited.
+ */
+typedef struct token_bucket_t
+{
+  uint32_t packet_rate;
+  uint32_t byte_rate;
+  /* Tokens available, which may be negative after an unpaced send */
+  double packets;
+  double bytes;
+  /* When the tokens were last refilled */
+  struct timespec refilled;
+  /* When traffic first had to wait for tokens, while it is waiting */
+  struct timespec blocked;
+  bool is_blocked;
+  /* Counter of the nanoseconds traffic has waited, which may be shared */
+  uint64_t *throttled;
+  pthread_mutex_t mutex;
+} token_bucket_t;
+
+void token_bucket_init (token_bucket_t *bucket, uint32_t packet_rate, uint32_t byte_rate,
+                        uint64_t *throttled);
+
+void token_bucket_fini (token_bucket_t *bucket);
+
+void token_bucket_set_rate (token_bucket_t *bucket, uint32_t packet_rate, uint32_t byte_rate);
+
+bool token_bucket_limited (const token_bucket_t *bucket);
+
+uint64_t token_bucket_delay (token_bucket_t *bucket, unsigned len);
+
+void token_bucket_take (token_bucket_t *bucket, unsigned len);
+
+void token_bucket_wait (token_bucket_t *bucket, unsigned len);
+
+#endif //DEVICE_BACNET_C_TOKEN_BUCKET_H
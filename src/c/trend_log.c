@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include <iot/time.h>
+#include "trend_log.h"
+#include "deadline.h"
+
+static void trend_log_free_log (trend_log_t *log)
+{
+  free (log->device);
+  free (log->resource);
+  free (log->name);
+  free (log);
+}
+
+/* The sequence number after another, which skips zero when it wraps */
+static uint32_t trend_log_next (uint32_t sequence)
+{
+  return (sequence == UINT32_MAX) ? 1 : sequence + 1;
+}
+
+/* Nanoseconds since the epoch of a record's timestamp, taken as local time */
+static uint64_t trend_log_time (const BACNET_DATE_TIME *timestamp)
+{
+  struct tm tm;
+  memset (&tm, 0, sizeof (tm));
+  tm.tm_year = timestamp->date.year - 1900;
+  tm.tm_mon = timestamp->date.month - 1;
+  tm.tm_mday = timestamp->date.day;
+  tm.tm_hour = timestamp->time.hour;
+  tm.tm_min = timestamp->time.min;
+  tm.tm_sec = timestamp->time.sec;
+  tm.tm_isdst = -1;
+  time_t secs = mktime (&tm);
+  if (secs == (time_t) -1)
+  {
+    return iot_time_nsecs ();
+  }
+  uint64_t hundredths = (timestamp->time.hundredths < 100) ? timestamp->time.hundredths : 0;
+  return (uint64_t) secs * 1000000000u + hundredths * 10000000u;
+}
+
+/* Post the value of a record as a reading at the time it was logged, tagged
+ * with its sequence number and status flags
+ */
+static void trend_log_post (trend_log_ll *list, trend_log_t *log, const bacnet_log_record_t *record)
+{
+  if (!record->hasValue)
+  {
+    return;
+  }
+  /* Populating the result frees the value */
+  BACNET_APPLICATION_DATA_VALUE *value = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
+  *value = record->value;
+  value->next = NULL;
+  devsdk_commandresult *result = calloc (1, sizeof (devsdk_commandresult));
+  devsdk_commandresult_populate (result, value, 1);
+  if (result->value)
+  {
+    result->origin = trend_log_time (&record->timestamp);
+    result->tags = iot_data_alloc_map (IOT_DATA_STRING);
+    iot_data_string_map_add (result->tags, "sequence", iot_data_alloc_ui32 (record->sequence));
+    if (record->hasStatus)
+    {
+      BACNET_APPLICATION_DATA_VALUE *status = calloc (1, sizeof (BACNET_APPLICATION_DATA_VALUE));
+      devsdk_commandresult flags = { 0 };
+      status->tag = BACNET_APPLICATION_TAG_BIT_STRING;
+      status->type.Bit_String = record->status;
+      devsdk_commandresult_populate (&flags, status, 1);
+      iot_data_string_map_add (result->tags, "statusFlags", flags.value);
+    }
+    devsdk_post_readings (list->service, log->device, log->resource, result);
+  }
+  devsdk_commandresult_free (result, 1);
+}
+
+/* Check whether records after the cursor were overwritten before they were
+ * read, moving the cursor to before the oldest record if so
+ */
+static bool trend_log_skip_lost (trend_log_ll *list, trend_log_t *log, uint32_t instance)
+{
+  bacnet_log_record_t oldest;
+  bool more;
+  if (bacnetReadRange (&log->address, log->type, instance, PROP_LOG_BUFFER, false, 1, &oldest, 1, &more) != 1 ||
+      (int32_t) (oldest.sequence - trend_log_next (log->cursor)) <= 0)
+  {
+    return false;
+  }
+  iot_log_warn (list->lc, "Records %u to %u of trend log %s of %s were overwritten before they were read",
+                trend_log_next (log->cursor), oldest.sequence - 1, log->resource, log->device);
+  log->cursor = oldest.sequence - 1;
+  return true;
+}
+
+/* Check whether records were logged after the cursor, from the
+ * Total_Record_Count, which is the sequence number of the newest record
+ */
+static bool trend_log_moved (trend_log_t *log, uint32_t instance)
+{
+  BACNET_APPLICATION_DATA_VALUE *total = bacnetReadProperty (&log->address, log->type, instance,
+                                                             PROP_TOTAL_RECORD_COUNT, BACNET_ARRAY_ALL,
+                                                             REQUEST_PRIORITY_BACKGROUND);
+  if (total == NULL)
+  {
+    return false;
+  }
+  bool moved = total->tag == BACNET_APPLICATION_TAG_UNSIGNED_INT && total->type.Unsigned_Int != log->cursor;
+  free (total);
+  return moved;
+}
+
+/* Read and post the records logged since the last harvest, or the whole
+ * buffer at first
+ */
+static void trend_log_harvest (trend_log_ll *list, trend_log_t *log)
+{
+  bacnet_log_record_t records[TREND_LOG_RECORDS];
+  uint32_t instance = log->instance;
+  bool more = true;
+
+  if (log->name && !bacnet_resolve_object_name (&log->address, log->type, log->name, &instance))
+  {
+    iot_log_debug (list->lc, "Unable to resolve trend log %s of %s", log->resource, log->device);
+    return;
+  }
+  while (more)
+  {
+    int found = bacnetReadRange (&log->address, log->type, instance, PROP_LOG_BUFFER, log->started,
+                                 log->started ? trend_log_next (log->cursor) : 1,
+                                 records, TREND_LOG_RECORDS, &more);
+    if (found < 0)
+    {
+      /* Some devices reject a reference to a record that was overwritten */
+      if (log->started && trend_log_skip_lost (list, log, instance))
+      {
+        more = true;
+        continue;
+      }
+      iot_log_debug (list->lc, "Harvest of trend log %s of %s failed", log->resource, log->device);
+      return;
+    }
+    if (found == 0)
+    {
+      /* No records follow the cursor, either as none are new or as they were
+       * overwritten, which is only looked for when records were logged since
+       */
+      more = !more && log->started && trend_log_moved (log, instance) && trend_log_skip_lost (list, log, instance);
+      continue;
+    }
+    for (int i = 0; i < found; i++)
+    {
+      trend_log_post (list, log, &records[i]);
+    }
+    log->started = true;
+    log->cursor = records[found - 1].sequence;
+  }
+}
+
+static void *trend_log_run (void *arg)
+{
+  trend_log_ll *list = (trend_log_ll *) arg;
+  struct timespec now;
+
+  pthread_mutex_lock (&list->mutex);
+  while (list->running)
+  {
+    /* Find a log due to be harvested, and when the next one is */
+    trend_log_t *due = NULL;
+    const struct timespec *earliest = NULL;
+    deadline_now (&now);
+    for (trend_log_t *log = list->first; log && due == NULL; log = log->next)
+    {
+      if (!deadline_expired (&log->due, &now))
+      {
+        if (earliest == NULL || deadline_expired (&log->due, earliest))
+        {
+          earliest = &log->due;
+        }
+        continue;
+      }
+      deadline_next (&log->due, log->interval, &now);
+      /* Reads of a device that is down would only time out */
+      if (liveness_is_up (list->liveness, log->address.deviceInstance))
+      {
+        due = log;
+      }
+    }
+
+    if (due)
+    {
+      due->busy = true;
+      pthread_mutex_unlock (&list->mutex);
+      trend_log_harvest (list, due);
+      pthread_mutex_lock (&list->mutex);
+      due->busy = false;
+      if (due->removed)
+      {
+        trend_log_free_log (due);
+      }
+      continue;
+    }
+
+    deadline_wait (&list->wakeup, &list->mutex, earliest);
+  }
+  pthread_mutex_unlock (&list->mutex);
+  return NULL;
+}
+
+/* Create an empty list of trend logs and start its thread */
+trend_log_ll *trend_log_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness)
+{
+  trend_log_ll *list = calloc (1, sizeof (trend_log_ll));
+  list->service = service;
+  list->lc = lc;
+  list->liveness = liveness;
+  list->running = true;
+  pthread_mutex_init (&list->mutex, NULL);
+  deadline_cond_init (&list->wakeup);
+  pthread_create (&list->thread, NULL, trend_log_run, list);
+  return list;
+}
+
+/* Stop the thread, so that no more harvests are started */
+void trend_log_stop (trend_log_ll *list)
+{
+  pthread_mutex_lock (&list->mutex);
+  bool running = list->running;
+  list->running = false;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  if (running)
+  {
+    pthread_join (list->thread, NULL);
+  }
+}
+
+/* Free the trend logs */
+void trend_log_free (trend_log_ll *list)
+{
+  if (list == NULL)
+  {
+    return;
+  }
+  trend_log_stop (list);
+
+  trend_log_t *current = list->first;
+  while (current)
+  {
+    trend_log_t *next = current->next;
+    trend_log_free_log (current);
+    current = next;
+  }
+  pthread_cond_destroy (&list->wakeup);
+  pthread_mutex_destroy (&list->mutex);
+  free (list);
+}
+
+/* Add the trend log object of a resource, with its first harvest due immediately */
+trend_log_t *trend_log_add (trend_log_ll *list, const devsdk_device_t *device, const char *resource,
+                            const bacnet_attributes_t *attrs, uint64_t interval)
+{
+  trend_log_t *log = calloc (1, sizeof (trend_log_t));
+  log->device = strdup (device->name);
+  log->resource = strdup (resource);
+  log->address = *(bacnet_address_t *) device->address;
+  log->type = attrs->type;
+  log->instance = attrs->instance;
+  log->name = attrs->name ? strdup (attrs->name) : NULL;
+  log->interval = interval ? interval : 1;
+  deadline_now (&log->due);
+
+  pthread_mutex_lock (&list->mutex);
+  log->next = list->first;
+  list->first = log;
+  pthread_cond_signal (&list->wakeup);
+  pthread_mutex_unlock (&list->mutex);
+  return log;
+}
+
+/* Remove a trend log, freeing it now or when its harvest in progress completes */
+void trend_log_remove (trend_log_ll *list, trend_log_t *log)
+{
+  pthread_mutex_lock (&list->mutex);
+  trend_log_t **link = &list->first;
+  while (*link != log)
+  {
+    link = &(*link)->next;
+  }
+  *link = log->next;
+  bool busy = log->busy;
+  log->removed = true;
+  pthread_mutex_unlock (&list->mutex);
+  if (!busy)
+  {
+    trend_log_free_log (log);
+  }
+}
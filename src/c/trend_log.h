@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <devsdk/devsdk.h>
+#include "driver.h"
+#include "liveness.h"
+
+#ifndef DEVICE_BACNET_C_TREND_LOG_H
+#define DEVICE_BACNET_C_TREND_LOG_H
+
+/* Most log records read with each ReadRange request */
+#define TREND_LOG_RECORDS 64
+
+/* The log buffer of a trend log object, whose new records are read
+ * periodically and posted as readings of a resource
+ */
+typedef struct trend_log_t
+{
+  char *device;
+  char *resource;
+  bacnet_address_t address;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  /* Object name, resolved to the instance before each harvest when set */
+  char *name;
+  /* Sequence number of the last record read, once any has been */
+  bool started;
+  uint32_t cursor;
+  /* Interval between harvests in milliseconds, and when the next is due */
+  uint64_t interval;
+  struct timespec due;
+  /* Set while harvesting, and when removed meanwhile, so the thread frees the log */
+  bool busy;
+  bool removed;
+  struct trend_log_t *next;
+} trend_log_t;
+
+/* Linked list of trend logs, with a thread harvesting them with ReadRange */
+typedef struct trend_log_ll
+{
+  trend_log_t *first;
+  devsdk_service_t *service;
+  iot_logger_t *lc;
+  /* Monitor whose down devices are not read, or NULL */
+  liveness_ll *liveness;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;
+} trend_log_ll;
+
+trend_log_ll *trend_log_alloc (devsdk_service_t *service, iot_logger_t *lc, liveness_ll *liveness);
+
+void trend_log_stop (trend_log_ll *list);
+
+void trend_log_free (trend_log_ll *list);
+
+trend_log_t *trend_log_add (trend_log_ll *list, const devsdk_device_t *device, const char *resource,
+                            const bacnet_attributes_t *attrs, uint64_t interval);
+
+void trend_log_remove (trend_log_ll *list, trend_log_t *log);
+
+#endif //DEVICE_BACNET_C_TREND_LOG_H
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stddef.h>
+#include <malloc.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <iot/os.h>
+#include <iot/time.h>
+#include "value_cache.h"
+#include "hash.h"
+
+static uint32_t value_cache_hash (uint32_t device_id, BACNET_OBJECT_TYPE type, uint32_t instance,
+                                  BACNET_PROPERTY_ID property, uint32_t index)
+{
+  uint32_t hash = hash_word (HASH_INIT, device_id);
+  hash = hash_word (hash, (uint32_t) type);
+  hash = hash_word (hash, instance);
+  hash = hash_word (hash, (uint32_t) property);
+  hash = hash_word (hash, index);
+  return hash % VALUE_CACHE_BUCKETS;
+}
+
+static value_cache_entry_t *
+value_cache_get_locked (value_cache_ll *cache, uint32_t device_id, BACNET_OBJECT_TYPE type,
+                        uint32_t instance, BACNET_PROPERTY_ID property, uint32_t index)
+{
+  value_cache_entry_t *current = cache->buckets[value_cache_hash (device_id, type, instance,
+                                                                  property, index)];
+  while (current && (current->device_id != device_id || current->type != type ||
+                     current->instance != instance || current->property != property ||
+                     current->index != index))
+  {
+    current = current->next;
+  }
+  return current;
+}
+
+value_cache_ll *value_cache_alloc (void)
+{
+  value_cache_ll *cache = calloc (1, sizeof (value_cache_ll));
+  pthread_mutex_init (&cache->mutex, NULL);
+  return cache;
+}
+
+void value_cache_free (value_cache_ll *cache)
+{
+  if (cache == NULL)
+  {
+    return;
+  }
+  for (int i = 0; i < VALUE_CACHE_BUCKETS; i++)
+  {
+    value_cache_entry_t *current = cache->buckets[i];
+    while (current)
+    {
+      value_cache_entry_t *next = current->next;
+      free (current);
+      current = next;
+    }
+  }
+  pthread_mutex_destroy (&cache->mutex);
+  free (cache);
+}
+
+/* Remember a value read from a property */
+void value_cache_put (value_cache_ll *cache, uint32_t device_id, BACNET_OBJECT_TYPE type,
+                      uint32_t instance, BACNET_PROPERTY_ID property, uint32_t index,
+                      const BACNET_APPLICATION_DATA_VALUE *value)
+{
+  if (cache == NULL || value == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock (&cache->mutex);
+  value_cache_entry_t *entry = value_cache_get_locked (cache, device_id, type, instance,
+                                                       property, index);
+  if (entry == NULL)
+  {
+    uint32_t bucket = value_cache_hash (device_id, type, instance, property, index);
+    entry = malloc (sizeof (value_cache_entry_t));
+    entry->device_id = device_id;
+    entry->type = type;
+    entry->instance = instance;
+    entry->property = property;
+    entry->index = index;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+  }
+  memcpy (&entry->value, value, sizeof (BACNET_APPLICATION_DATA_VALUE));
+  entry->value.next = NULL;
+  entry->origin = iot_time_nsecs ();
+  pthread_mutex_unlock (&cache->mutex);
+}
+
+/* Get a copy of the last value read from a property and when it was read,
+ * or NULL if it has not been read
+ */
+BACNET_APPLICATION_DATA_VALUE *
+value_cache_get (value_cache_ll *cache, uint32_t device_id, BACNET_OBJECT_TYPE type,
+                 uint32_t instance, BACNET_PROPERTY_ID property, uint32_t index,
+                 uint64_t *origin)
+{
+  BACNET_APPLICATION_DATA_VALUE *copy = NULL;
+  if (cache == NULL)
+  {
+    return NULL;
+  }
+  pthread_mutex_lock (&cache->mutex);
+  value_cache_entry_t *entry = value_cache_get_locked (cache, device_id, type, instance,
+                                                       property, index);
+  if (entry)
+  {
+    copy = malloc (sizeof (BACNET_APPLICATION_DATA_VALUE));
+    memcpy (copy, &entry->value, sizeof (BACNET_APPLICATION_DATA_VALUE));
+    *origin = entry->origin;
+  }
+  pthread_mutex_unlock (&cache->mutex);
+  return copy;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2019
+ * IoTech Ltd
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <bacdef.h>
+#include <bacapp.h>
+
+#ifndef DEVICE_BACNET_C_VALUE_CACHE_H
+#define DEVICE_BACNET_C_VALUE_CACHE_H
+
+#define VALUE_CACHE_BUCKETS 4096
+
+/* The last value successfully read from a property */
+typedef struct value_cache_entry_t
+{
+  uint32_t device_id;
+  BACNET_OBJECT_TYPE type;
+  uint32_t instance;
+  BACNET_PROPERTY_ID property;
+  uint32_t index;
+  BACNET_APPLICATION_DATA_VALUE value;
+  /* When the value was read, in nanoseconds since the epoch */
+  uint64_t origin;
+  /* Next entry in the same hash bucket */
+  struct value_cache_entry_t *next;
+} value_cache_entry_t;
+
+/* Hash table of the last known good values of properties */
+typedef struct value_cache_ll
+{
+  value_cache_entry_t *buckets[VALUE_CACHE_BUCKETS];
+  pthread_mutex_t mutex;
+} value_cache_ll;
+
+value_cache_ll *value_cache_alloc (void);
+
+void value_cache_free (value_cache_ll *cache);
+
+void value_cache_put (value_cache_ll *cache, uint32_t device_id, BACNET_OBJECT_TYPE type,
+                      uint32_t instance, BACNET_PROPERTY_ID property, uint32_t index,
+                      const BACNET_APPLICATION_DATA_VALUE *value);
+
+BACNET_APPLICATION_DATA_VALUE *
+value_cache_get (value_cache_ll *cache, uint32_t device_id, BACNET_OBJECT_TYPE type,
+                 uint32_t instance, BACNET_PROPERTY_ID property, uint32_t index,
+                 uint64_t *origin);
+
+#endif //DEVICE_BACNET_C_VALUE_CACHE_H